@@ -11,6 +11,18 @@
 /*
 modification history
 --------------------
+01s,17oct26,agt  cached rtg descriptor rings
+01r,17oct26,agt  document busy-poll RX for rtg0
+01q,17oct26,agt  enable zero-copy polled receive for rtg
+01p,17oct26,agt  list rtg units 0-7 for MSI
+01o,17oct26,agt  use the rtg hardware tally counters
+01n,17oct26,agt  enable rtg TCP segmentation offload
+01m,17oct26,agt  enable rtg interrupt-free TX reclaim
+01l,17oct26,agt  enable rtg batched RX delivery
+01k,17oct26,agt  enable rtg RX buffer recycling
+01j,17oct26,agt  enable rtg RX copybreak
+01i,17oct26,agt  add rtg descriptor ring size parameters
+01h,17oct26,agt  add rtg interrupt moderation parameters
 01g,24may13,jjk  WIND00364942 - Removing AMP and GUEST
 01f,09may13,jjk  WIND00364942 - Adding Unified BSP.
 01e,18oct12,c_t  add panicPrint
@@ -356,8 +368,17 @@ LOCAL const struct intrCtlrInputs loApicInputs[] = {
     { VXB_INTR_DYNAMIC, "gei", 8, 0 },
     { VXB_INTR_DYNAMIC, "gei", 9, 0 },
 
+/*
+ * MSI for the rtg Ethernet driver, on parts which support it
+ */
     { VXB_INTR_DYNAMIC, "rtg", 0, 0 },
     { VXB_INTR_DYNAMIC, "rtg", 1, 0 },
+    { VXB_INTR_DYNAMIC, "rtg", 2, 0 },
+    { VXB_INTR_DYNAMIC, "rtg", 3, 0 },
+    { VXB_INTR_DYNAMIC, "rtg", 4, 0 },
+    { VXB_INTR_DYNAMIC, "rtg", 5, 0 },
+    { VXB_INTR_DYNAMIC, "rtg", 6, 0 },
+    { VXB_INTR_DYNAMIC, "rtg", 7, 0 },
 
 #ifdef DRV_TIMER_HPET
     { VXB_INTR_DYNAMIC, "iaHpetTimerDev", 0, 0 },
@@ -466,6 +487,94 @@ const int hcfDeviceNum = NELEMENTS(hcfDeviceList);
 
 VXB_INST_PARAM_OVERRIDE sysInstParamTable[] =
     {
+    /*
+     * rtg interrupt moderation: mode 0 = off, 1 = static holdoff,
+     * 2 = adaptive. See rtl8169VxbEndA.c for details.
+     */
+
+    { "rtg", 0, "intrModMode",   VXB_PARAM_INT32, {(void *)2} },
+    { "rtg", 0, "intrModUsecs",  VXB_PARAM_INT32, {(void *)100} },
+    { "rtg", 0, "intrModFrames", VXB_PARAM_INT32, {(void *)8} },
+    { "rtg", 1, "intrModMode",   VXB_PARAM_INT32, {(void *)2} },
+    { "rtg", 1, "intrModUsecs",  VXB_PARAM_INT32, {(void *)100} },
+    { "rtg", 1, "intrModFrames", VXB_PARAM_INT32, {(void *)8} },
+
+    /*
+     * rtg descriptor ring sizes; must be a power of two, up to 1024.
+     */
+
+    { "rtg", 0, "rxDescCnt",     VXB_PARAM_INT32, {(void *)512} },
+    { "rtg", 0, "txDescCnt",     VXB_PARAM_INT32, {(void *)256} },
+    { "rtg", 1, "rxDescCnt",     VXB_PARAM_INT32, {(void *)512} },
+    { "rtg", 1, "txDescCnt",     VXB_PARAM_INT32, {(void *)256} },
+
+    /*
+     * rtg RX copybreak: frames up to this many bytes are copied into
+     * small clusters. 0 disables copybreak.
+     */
+
+    { "rtg", 0, "rxCopybreak",   VXB_PARAM_INT32, {(void *)128} },
+    { "rtg", 1, "rxCopybreak",   VXB_PARAM_INT32, {(void *)128} },
+
+    /*
+     * rtg recycled RX buffers, DMA mapped once at init time.
+     */
+
+    { "rtg", 0, "rxRecycleCnt",  VXB_PARAM_INT32, {(void *)1024} },
+    { "rtg", 1, "rxRecycleCnt",  VXB_PARAM_INT32, {(void *)1024} },
+
+    /*
+     * rtg RX delivery: 0 = per frame, 1 = per frame after each RX
+     * pass, 2 = one m_nextpkt chain per RX pass.
+     */
+
+    { "rtg", 0, "rxBatch",       VXB_PARAM_INT32, {(void *)1} },
+    { "rtg", 1, "rxBatch",       VXB_PARAM_INT32, {(void *)1} },
+
+    /*
+     * rtg TX reclaim without TX completion interrupts.
+     */
+
+    { "rtg", 0, "txReclaim",     VXB_PARAM_INT32, {(void *)1} },
+    { "rtg", 1, "txReclaim",     VXB_PARAM_INT32, {(void *)1} },
+
+    /*
+     * rtg TCP segmentation offload: 1 = chip large send, 2 = driver
+     * segmentation.
+     */
+
+    { "rtg", 0, "tsoMode",       VXB_PARAM_INT32, {(void *)1} },
+    { "rtg", 1, "tsoMode",       VXB_PARAM_INT32, {(void *)1} },
+
+    /*
+     * rtg RX packet and error statistics from the chip's tally counters.
+     */
+
+    { "rtg", 0, "hwStats",       VXB_PARAM_INT32, {(void *)1} },
+    { "rtg", 1, "hwStats",       VXB_PARAM_INT32, {(void *)1} },
+
+    /*
+     * rtg polled mode receive without copying, for WDB and boot.
+     */
+
+    { "rtg", 0, "pollZeroCopy",  VXB_PARAM_INT32, {(void *)1} },
+    { "rtg", 1, "pollZeroCopy",  VXB_PARAM_INT32, {(void *)1} },
+
+    /*
+     * rtg busy-poll RX is left off, since the polling task keeps a whole
+     * CPU busy. To poll the control-plane port on a CPU of its own, add:
+     *
+     * { "rtg", 0, "busyPoll",      VXB_PARAM_INT32, {(void *)1} },
+     * { "rtg", 0, "busyPollCpu",   VXB_PARAM_INT32, {(void *)3} },
+     */
+
+    /*
+     * rtg descriptor rings in write-back memory; DMA is coherent here.
+     */
+
+    { "rtg", 0, "cachedRings",   VXB_PARAM_INT32, {(void *)1} },
+    { "rtg", 1, "cachedRings",   VXB_PARAM_INT32, {(void *)1} },
+
     { NULL, 0, NULL, VXB_PARAM_END_OF_LIST, {(void *)0} }
     };
 
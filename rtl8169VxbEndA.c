@@ -11,6 +11,43 @@
 /*
 modification history
 --------------------
+03n,17oct26,agt  Add a high priority TX ring with a classification hook,
+                 factor out the TX offload bits and accounting
+03m,17oct26,agt  Add a pre-mapped bounce ring for coalesced transmits
+03l,17oct26,agt  Add software RSS across several job queues
+03k,17oct26,agt  Add RX pipeline latency histograms and rtgLatShow()
+03j,17oct26,agt  Add a capture tap on the RX and TX fast paths
+03i,17oct26,agt  Add a fast probe path that takes the station address from
+                 the ID registers, shorten the EEPROM clock delay
+03h,17oct26,agt  Maintain the multicast hash filter incrementally
+03g,17oct26,agt  Add cached descriptor rings, factor out RX descriptor
+                 re-arming
+03f,17oct26,agt  Add busy-poll RX and RX latency counters
+03e,17oct26,agt  Add zero-copy polled receive
+03d,17oct26,agt  Use MSI where the dynamic interrupt library provides it,
+                 add the intCpu parameter for interrupt and job queue
+                 placement
+03c,17oct26,agt  Replace the fixed instance array with a growable registry,
+                 bring ports up in parallel and report their latency
+03b,17oct26,agt  Collect the hardware tally counters, extended to 64 bits
+03a,17oct26,agt  Keep software statistics in 64-bit counters, one set
+                 per direction with seq-protected reads; classify TX
+                 frames at send time
+02z,17oct26,agt  Add scatter RX, chaining standard-size descriptors into
+                 jumbo frames
+02y,17oct26,agt  Add IPv6 TCP/UDP checksum offload on V2 descriptor chips
+02x,17oct26,agt  Add TCP segmentation offload, with a software fallback
+02w,17oct26,agt  Add interrupt-free TX completion reclaim with a
+                 backstop timer
+02v,17oct26,agt  Add batched transmit with a single doorbell write
+02u,17oct26,agt  Add batched RX delivery to the MUX
+02t,17oct26,agt  Add a pool of recycled, persistently mapped RX buffers
+02s,17oct26,agt  Add RX copybreak using a private small-cluster pool
+02r,17oct26,agt  Make the RX and TX ring sizes per-instance parameters,
+                 size the netpool to match, wrap ring indexes with a mask
+02q,17oct26,agt  Make the RX budget a per-instance parameter, add
+                 weighted round-robin RX service across instances
+02p,17oct26,agt  Add static and adaptive interrupt moderation
 16dec13,p_x Correct transaction size when reading PCIe capability ID 
                  register(WIND00444940)
 02o,16sep13,xms  fix CHECKED_RETURN error. (WIND00414265)
@@ -134,19 +171,19 @@ and integrated directly onto the system main board. All configurations
 are jumperless.
 
 EXTERNAL INTERFACE
-The driver provides a vxBus external interface. The only exported
-routine is the rtgRegister() function, which registers the driver
-with VxBus.
+The driver provides a vxBus external interface. The exported
+routines are rtgRegister(), which registers the driver with VxBus,
+and sysRtgEndInit(), which also registers the PHY drivers and then
+brings up all attached rtg ports.
 
 The RealTek gigE devices also support jumbo frames. Note however that
 the maximum MTU possible is 7400 bytes (not 9000, which is normal for
 most jumbo-capable NICs). This driver supports jumbo frames on the
 8169S/8110S, 8169SB/8110SB, 8169SC/8110SC and 8168B/8111B devices.
 They are not supported on the 8139C+, 8100E, 8101E, 8102E and 8103E
-devices, which are 10/100 only, nor on the original 8169 (MAC only,
-no internal PHY) which doesn't seem to be jumbo-capable. (The first
-generation 8169 is no longer in production however, so this should
-not be a problem for new designs.)
+devices, which are 10/100 only. The original 8169 (MAC only, no
+internal PHY) can't receive jumbo frames into a single buffer, so it
+always uses scatter RX, described below.
  
 Jumbo frame support is disabled by default in order to conserve memory
 (jumbo frames require the use of an buffer pool with larger clusters).
@@ -157,6 +194,272 @@ added to the VXB_INST_PARAM_OVERRIDE table:
 
     { "rtg", 0, "jumboEnable", VXB_PARAM_INT32, {(void *)1} }
 
+By default, every completed receive or transmit raises an interrupt.
+At high packet rates this can consume a great deal of CPU time, so the
+driver also supports interrupt moderation using the chip's countdown
+timer. When moderation is engaged, the RX and TX completion interrupts
+are masked and the rings are serviced when the timer expires instead.
+The policy is selected with the "intrModMode" parameter: 0 disables
+moderation, 1 selects a static holdoff of "intrModUsecs" microseconds
+which is engaged whenever an interrupt finds at least "intrModFrames"
+frames of work, and 2 selects adaptive moderation, where the holdoff
+is varied (up to "intrModUsecs") to keep the number of frames serviced
+per interrupt close to "intrModFrames". For example:
+
+    { "rtg", 0, "intrModMode", VXB_PARAM_INT32, {(void *)2} },
+    { "rtg", 0, "intrModUsecs", VXB_PARAM_INT32, {(void *)100} },
+    { "rtg", 0, "intrModFrames", VXB_PARAM_INT32, {(void *)8} }
+
+The current moderation settings can be retrieved with the EIOCGRTGINTRMOD
+ioctl, which fills in an RTG_INTRMOD_INFO structure.
+
+The RX handler processes at most "rxBudget" frames (default 16) before
+rescheduling itself so that other work on the same job queue can run.
+The budget may also be changed at runtime with the EIOCSRTGRXBUDGET
+ioctl, and the EIOCGRTGRXSTATS ioctl reports how many frames each pass
+handled. When several rtg instances share one job queue, setting
+"rxFairness" to 1 places them in a common RX group which services the
+instances in weighted round-robin order: each instance may handle up to
+"rxBudget" times "rxWeight" frames per round.
+
+Frames no longer than the "rxCopybreak" parameter (at most 240 bytes)
+are copied into a cluster from a small private pool instead of being
+passed up in the RX ring buffer. The ring buffer then stays DMA-mapped
+and is handed straight back to the chip, which saves a buffer swap and
+a map unload/reload for each small frame, such as TCP ACKs. Copybreak
+is off by default. The number of frames copied is reported by the
+EIOCGRTGRXSTATS ioctl.
+
+The RX ring is normally refilled with a fresh mBlk tuple for every
+received frame, which costs a DMA map unload and reload each time. With
+the "rxRecycleCnt" parameter set, the driver also allocates that many
+RX buffers which are DMA mapped once, when the instance is created.
+When the stack frees one of these buffers, it goes back on a free list
+and is used to re-arm the next RX descriptor directly. When the free
+list is empty, the driver falls back to the netpool. EIOCGRTGRXSTATS
+reports how many refills were satisfied from each source.
+
+By default, each received frame is passed to the MUX as soon as it has
+been reaped from the ring. The "rxBatch" parameter changes this: with a
+value of 1, the frames reaped in one RX pass are collected and passed
+up one at a time after the pass, and with a value of 2 they are linked
+through m_nextpkt and passed up with a single call, which amortizes the
+cost of entering the stack. Mode 2 must only be selected if the stack
+accepts packet chains; mode 1 is the fallback for stacks that don't.
+The number of receive upcalls is reported by EIOCGRTGRXSTATS.
+
+The driver exports rtgEndSendBatch(), which accepts a list of packets
+linked through m_nextpkt, queues them all on the TX ring under a single
+acquisition of the TX semaphore and notifies the chip with one write to
+the TX poll register. The MUX send routine is a wrapper which passes a
+list of one packet. The EIOCGRTGTXSTATS ioctl reports the number of
+packets queued and TX poll register writes made.
+
+Setting the "txReclaim" parameter masks the TX completion interrupts.
+Completed TX descriptors are then reclaimed by the send path whenever
+fewer than "txReclaimThresh" descriptors are free (a quarter of the
+ring by default), and a backstop timer running every "txReclaimMs"
+milliseconds (10 by default) makes sure buffers are released and a
+stalled transmitter is restarted even when nothing more is sent.
+
+TCP segmentation offload for IPv4 is selected with the "tsoMode"
+parameter. In mode 1, large sends are handed to the chip, with the MSS
+programmed into the TX descriptors; in mode 2, or when a large send has
+too many fragments for the chip, the driver cuts the packet into MSS
+sized frames itself. Mode 1 is not available with jumbo frames, and
+falls back to mode 2. TSO can be turned on and off at runtime through
+the IFCAP_TSO4 capability with EIOCSIFCAP.
+
+On the V2 descriptor chips (RTL8168C/CP/D/DP and RTL8102E), TCP and UDP
+checksums are also offloaded for IPv6, on both transmit and receive.
+This is controlled by the IFCAP_IPV6CSUM capability.
+
+When jumbo frames are enabled, setting the "rxScatter" parameter keeps
+standard size buffers in the RX ring. A jumbo frame is then received
+into several descriptors, which are handed to the stack as one mBlk
+chain. This avoids tying up an END_JUMBO_CLSIZE cluster in every ring
+slot, and is always used on the original 8169, which can't receive
+jumbo frames into a single buffer. Scattered frames are not returned
+by the polled receive routine.
+
+The software statistics are kept in 64-bit counters, one set per
+direction, each on its own cache line. Transmitted frames are
+counted as they are queued, not when the TX descriptor is reclaimed.
+The counters are never reset: the polled statistics routine reports
+the difference from the previous poll, and the EIOCGRTGSTATS64 ioctl
+returns the running totals as an RTG_STATS64 structure.
+
+When the "hwStats" parameter is set, the chip's tally counters are
+dumped into a DMA buffer on every stats poll and extended to 64 bits
+in software. The RX unicast, multicast and broadcast counts then come
+from the chip instead of being counted per frame, and the chip's
+missed packet, alignment error and error counts, plus the number of
+RX FIFO overflows, are added to the error and discard statistics. The
+EIOCGRTGTALLY ioctl returns the 64-bit tally totals as an RTG_TALLY64
+structure.
+
+Each attached instance is added to a registry which grows as needed,
+so there is no fixed limit on the number of ports. sysRtgEndInit()
+brings the ports up in parallel: each one is handled by its own task,
+which gets the station address, creates the MII bus
+and starts autonegotiation, and then loads and starts the END
+interface. The time each port took is logged, and kept in the
+rtgUpMsecs field of its RTG_DRV_CTRL structure.
+
+The rtg instances are listed as dynamic inputs of the local APIC in
+hwconf.c, so on parts with an MSI capability (the PCIe 8168/8111 and
+810x families), vxbIntConnect() gives each port its own message
+signaled interrupt. Other parts fall back to the legacy INTx line.
+With MSI the vector is never shared, so the interrupt handler skips
+the ISR and IMR reads it otherwise needs to tell whether the interrupt
+is ours. The "intCpu" parameter selects a CPU to which the port's
+interrupt is routed, and to which the task servicing the port's job
+queue is bound while the interface is up, so that interrupt and RX
+processing run on the same core. Only a job queue given with the
+"rxQueue00" parameter is bound; the stack's own tNet0 queue never is.
+Ports sharing a job queue should use the same CPU, and stopping any of
+them unbinds the queue. To place ports on different CPUs, give each its
+own job queue. For example:
+
+    { "rtg", 0, "rxQueue00", VXB_PARAM_POINTER, {(void *)&rtg0RxQueue} },
+    { "rtg", 0, "intCpu", VXB_PARAM_INT32, {(void *)1} }
+
+In polled mode (used by WDB and the network boot path), each frame
+is normally copied out of the ring into the caller's buffer. When the
+"pollZeroCopy" parameter is set, rtgEndPollReceive() instead swaps the
+ring's cluster with the caller's, handing the received frame over in
+place and re-arming the descriptor with the caller's cluster. This is
+only done when the caller's cluster is at least as large as the ring's,
+8-byte aligned and isn't shared, and when it can be mapped for DMA;
+otherwise the frame is copied as before.
+
+Setting the "busyPoll" parameter gives a port a busy-poll task, for
+latency-sensitive traffic. The task is woken by the first RX interrupt,
+then masks the RX interrupts and spins on the RX ring, passing frames
+up as soon as the chip hands them over. Once no frame has arrived for
+"busyPollIdle" microseconds (1000 by default), the RX interrupts are
+unmasked and the task sleeps until the next one. The task runs at
+priority "busyPollPri" (10 by default) and is bound to the CPU given by
+"busyPollCpu", which should be one not otherwise needed, since the task
+keeps it busy while traffic flows. Received frames are passed to the
+MUX from this task rather than from the port's job queue. The task is
+parked while the port is in polled mode. Busy-poll ports don't take
+part in RX fairness groups. The EIOCGRTGLATENCY ioctl returns an RTG_LATENCY
+structure with the interrupt to RX service latency and, for busy-poll
+ports, the interval between the checks which found frames, so the two
+modes can be compared. For example:
+
+    { "rtg", 0, "busyPoll", VXB_PARAM_INT32, {(void *)1} },
+    { "rtg", 0, "busyPollCpu", VXB_PARAM_INT32, {(void *)3} }
+
+By default the descriptor rings are allocated from uncached memory,
+so every descriptor access goes to memory. Setting the "cachedRings"
+parameter allocates them from cached memory instead. On x86, where DMA
+is cache coherent, no further work is needed. On other architectures
+only the RX ring is cached: the driver invalidates just the cache line
+holding the descriptor it is about to read, rather than the whole ring,
+and hands descriptors back to the chip four at a time, a full cache
+line, with a flush after each line.
+
+Multicast joins and leaves update the hash filter incrementally. The
+driver keeps a reference count for each of the 64 hash buckets and
+only reloads the MAR registers when a bucket becomes used or unused;
+the filter is rebuilt from the multicast list only when the receive
+filter is reprogrammed. The number of filter register loads is
+reported by the EIOCGRTGRXSTATS ioctl.
+
+The station address is normally taken from the ID registers, which
+the chip loads from the EEPROM by itself after a reset. The EEPROM is
+only read directly when the ID registers don't hold a valid unicast
+address, or when the "fastProbe" parameter is set to 0; its clock is
+then run at the part's maximum rate. The time taken is logged, and
+kept in the rtgProbeUsecs field of the RTG_DRV_CTRL structure.
+
+For debugging, a capture tap can record the frames seen by the RX
+handler and queued on the TX rings. The first "snapLen" bytes of each
+frame (at most 128) are copied into a per-direction ring of "tapSlots"
+records (1024 by default), which is allocated when the tap is first
+enabled. The rings are lock-free: RX records are only written from the
+RX pass, which the driver already runs in one context at a time, and
+TX records only by the sender holding the TX semaphore. A frame that
+finds its ring full is counted as a drop rather than waited for. A filter of up to four masked four-byte compares against
+the frame headers selects which frames are kept. While the tap is
+disabled, it costs one test of a pointer per frame. From the shell,
+rtgTapStart() enables the tap, rtgTapSave() drains it to a libpcap
+file and rtgTapStop() disables it. Applications use the EIOCSRTGTAP
+ioctl to set up the tap and filter, EIOCGRTGTAPREAD to drain it and
+EIOCGRTGTAP for its counters. For example:
+
+    -> rtgTapStart 0, 64, 0
+    -> rtgTapSave 0, "/tgtsvr/rtg0.pcap", 10000
+    -> rtgTapStop 0
+
+Setting the "latHist" parameter turns on instrumentation of the RX
+pipeline. Log2 histograms of time stamped latencies are kept for three
+stages: from the ISR to the interrupt job, from the interrupt to the
+start of the RX pass serving it, and from the start of the pass to each
+hand-off to the MUX. The first two reuse the interrupt time stamps of
+the RTG_LATENCY counters, so reposted interrupt jobs, which have no
+interrupt of their own, aren't sampled. Time stamps come from the TSC on
+x86, scaled with sysGetTSCCountPerSec(), and from the system tick
+elsewhere. The number of frames per RX pass and the RX and TX ring
+high-water marks are kept as well; the RX mark is the most descriptors
+reaped by a pass that emptied the ring. rtgLatShow() prints them, and the
+EIOCGRTGLATHIST ioctl returns them as an RTG_LAT_HIST structure.
+
+The chips have a single RX queue, so by default all received frames
+are passed up from the instance's job queue. Software RSS spreads them
+over more job queues, typically each serviced by a task bound to its
+own CPU: the "rxQueue01" to "rxQueue07" parameters name further
+HEND_RX_QUEUE_PARAM structures, in the same way as "rxQueue00". Each
+IPv4 or IPv6 frame is hashed on its addresses and, for unfragmented
+TCP and UDP, its ports, so every frame of a flow goes to the same
+queue and the order within a flow is kept. Frames for queue 0 are
+passed up inline as before; the others are handed over at the end of
+each RX pass. The EIOCGRCVJOBQ ioctl reports all the queues, and
+EIOCGRTGRXSTATS the number of frames given to each.
+
+A frame whose mBlk chain has too many fragments, or a short frame that
+needs manual padding because of the checksum offload bugs described in
+rtgEndTxQueue(), has to be copied into a single buffer before it can be
+sent. The driver keeps a ring of "txBounceCnt" (32 by default) cache
+aligned TX buffers for this, each big enough for a full frame and DMA
+mapped once, when the instance is created, so a coalesced frame costs
+one copy and no mBlk allocation or map load. The buffers are released
+in order as their descriptors complete. When none is free, the driver
+falls back to an mBlk tuple from the netpool; setting "txBounceCnt" to
+0 always does. EIOCGRTGTXSTATS reports how many frames were coalesced
+and how many of them went through the bounce ring.
+
+The chip has a second, high priority TX ring, which it serves ahead of
+the normal one. Setting the "txHpDescCnt" parameter sets it up with that
+many descriptors (a power of two from 32 to 64). Latency critical frames,
+such as control and heartbeat traffic, are then sent on it, instead of
+waiting behind bulk transfers already queued on the normal ring. By
+default, these are the frames with a VLAN priority of at least
+"txHpPcp" (6), or an IP DSCP of at least "txHpDscp" (48, CS6); either
+test is disabled by setting its parameter to -1. rtgTxClassifySet()
+replaces both tests with a routine of the application's own, which can
+pick frames by any mark it likes. High priority frames are copied into
+buffers which stay DMA mapped, and large sends are segmented by the
+driver onto the ring; a large send needing more descriptors than the
+whole ring has is dropped, so use 64 descriptors if classified flows
+use large sends. High priority frames never go on the normal ring, so
+the frames of a flow are not reordered: while the ring is full,
+transmission blocks until the ring is reclaimed, as it does when the
+normal ring fills. EIOCGRTGTXSTATS reports how many were sent on it,
+and how often it was found full.
+
+The RX and TX DMA rings default to 128 descriptors each (64 on the
+8139C+). Larger rings help absorb traffic bursts, and can be selected
+with the "rxDescCnt" and "txDescCnt" parameters, up to the hardware
+limit of 1024 descriptors (64 on the 8139C+). Ring sizes must be a
+power of two; other values are rounded down. The buffer pool is sized
+to match the rings. For example:
+
+    { "rtg", 0, "rxDescCnt", VXB_PARAM_INT32, {(void *)512} },
+    { "rtg", 0, "txDescCnt", VXB_PARAM_INT32, {(void *)256} }
+
 INCLUDE FILES:
 rtl8139VxbEnd.h end.h endLib.h netBufLib.h muxLib.h
 
@@ -170,6 +473,7 @@ SEE ALSO: vxBus, ifLib
 
 #include <vxWorks.h>
 #include <intLib.h>
+#include <cacheLib.h>
 #include <muxLib.h>
 #include <netLib.h>
 #include <netBufLib.h>
@@ -184,6 +488,14 @@ SEE ALSO: vxBus, ifLib
 #include <endLib.h>
 #include <endMedia.h>
 #include <vxAtomicLib.h>
+#include <vxCpuLib.h>
+#include <spinLockLib.h>
+#include <ioLib.h>
+#include <stdio.h>
+#include <time.h>
+#if (CPU_FAMILY == I80X86)
+#include <arch/i86/pentiumLib.h>
+#endif
 
 #include <hwif/vxbus/vxBus.h>
 #include <hwif/vxbus/hwConf.h>
@@ -205,8 +517,17 @@ SEE ALSO: vxBus, ifLib
 #include "rtl8169VxbEndA.h"
 
 
-LOCAL VXB_DEVICE_ID pDevTemp[10];
-LOCAL int CurrentRtgNum;
+/* Registry of attached rtg instances, grown on demand */
+
+LOCAL VXB_DEVICE_ID * rtgInsts = NULL;
+LOCAL int rtgInstCnt = 0;
+LOCAL int rtgInstMax = 0;
+LOCAL SEM_ID rtgInstSem = NULL;
+
+/* RX fairness groups, one per job queue shared by rtg instances */
+
+LOCAL RTG_RX_GROUP * rtgRxGroups = NULL;
+LOCAL SEM_ID rtgRxGroupSem = NULL;
 
 /* defines */
 
@@ -232,6 +553,9 @@ IMPORT STATUS vxbNextUnitGet (VXB_DEVICE_ID);
 IMPORT void vxbUsDelay (int);
 
 IMPORT FUNCPTR _func_m2PollStatsIfPoll;
+#if (CPU_FAMILY == I80X86)
+IMPORT UINT64 sysGetTSCCountPerSec (void);
+#endif
 
 /* VxBus methods */
 
@@ -240,6 +564,7 @@ LOCAL void	rtgInstInit2 (VXB_DEVICE_ID);
 LOCAL void	rtgInstConnect (VXB_DEVICE_ID);
 LOCAL STATUS	rtgInstUnlink (VXB_DEVICE_ID, void *);
 LOCAL BOOL	rtgProbe (VXB_DEVICE_ID);
+LOCAL int	rtgDescCntGet (VXB_DEVICE_ID, char *, int, int);
 
 /* miiBus methods */
 
@@ -252,6 +577,23 @@ LOCAL STATUS    rtgLinkUpdate (VXB_DEVICE_ID);
 /* mux methods */
 
 LOCAL void	rtgMuxConnect (VXB_DEVICE_ID, void *);
+LOCAL STATUS	rtgInstAdd (VXB_DEVICE_ID);
+LOCAL void	rtgInstRemove (VXB_DEVICE_ID);
+LOCAL void	rtgPortAttach (VXB_DEVICE_ID);
+LOCAL BOOL	rtgIdrAddrGet (VXB_DEVICE_ID, UINT8 *);
+LOCAL void	rtgPortUp (VXB_DEVICE_ID, SEM_ID);
+LOCAL void	rtgJobQueuePin (int, int);
+LOCAL void	rtgBusyPollTask (RTG_DRV_CTRL *);
+LOCAL void	rtgLatRecord (UINT64 *, UINT64 *, UINT64 *, UINT64);
+LOCAL UINT64	rtgTsToUsecs (UINT64);
+LOCAL UINT64	rtgTsToNsecs (UINT64);
+LOCAL void	rtgHistAdd (UINT64 *, int, UINT64);
+LOCAL void	rtgHistStamp (RTG_DRV_CTRL *, int, UINT64);
+LOCAL RTG_DRV_CTRL * rtgInstFind (int);
+LOCAL int	rtgTapConfig (RTG_DRV_CTRL *, RTG_TAP_CONF *);
+LOCAL void	rtgTapFree (RTG_TAP *);
+LOCAL void	rtgTapRecord (RTG_TAP *, M_BLK_ID, int);
+LOCAL BOOL	rtgTapNext (RTG_TAP *, RTG_TAP_REC *);
 
 LOCAL struct drvBusFuncs rtgFuncs =
     {
@@ -319,8 +661,45 @@ LOCAL HEND_TX_QUEUE_PARAM rtgTxQueueDefault = {
 LOCAL VXB_PARAMETERS rtgParamDefaults[] =
     {
        {"rxQueue00", VXB_PARAM_POINTER, {(void *)&rtgRxQueueDefault}},
+       {"rxQueue01", VXB_PARAM_POINTER, {(void *)NULL}},
+       {"rxQueue02", VXB_PARAM_POINTER, {(void *)NULL}},
+       {"rxQueue03", VXB_PARAM_POINTER, {(void *)NULL}},
+       {"rxQueue04", VXB_PARAM_POINTER, {(void *)NULL}},
+       {"rxQueue05", VXB_PARAM_POINTER, {(void *)NULL}},
+       {"rxQueue06", VXB_PARAM_POINTER, {(void *)NULL}},
+       {"rxQueue07", VXB_PARAM_POINTER, {(void *)NULL}},
        {"txQueue00", VXB_PARAM_POINTER, {(void *)&rtgTxQueueDefault}},
        {"jumboEnable", VXB_PARAM_INT32, {(void *)0}},
+       {"intrModMode", VXB_PARAM_INT32, {(void *)RTG_INTRMOD_OFF}},
+       {"intrModUsecs", VXB_PARAM_INT32, {(void *)RTG_INTRMOD_USECS}},
+       {"intrModFrames", VXB_PARAM_INT32, {(void *)RTG_INTRMOD_FRAMES}},
+       {"rxBudget", VXB_PARAM_INT32, {(void *)RTG_MAX_RX}},
+       {"rxFairness", VXB_PARAM_INT32, {(void *)0}},
+       {"rxWeight", VXB_PARAM_INT32, {(void *)1}},
+       {"rxDescCnt", VXB_PARAM_INT32, {(void *)0}},
+       {"txDescCnt", VXB_PARAM_INT32, {(void *)0}},
+       {"rxCopybreak", VXB_PARAM_INT32, {(void *)0}},
+       {"rxRecycleCnt", VXB_PARAM_INT32, {(void *)0}},
+       {"rxBatch", VXB_PARAM_INT32, {(void *)RTG_RXBATCH_OFF}},
+       {"txReclaim", VXB_PARAM_INT32, {(void *)0}},
+       {"txReclaimThresh", VXB_PARAM_INT32, {(void *)0}},
+       {"txReclaimMs", VXB_PARAM_INT32, {(void *)RTG_TXRECLAIM_MS}},
+       {"tsoMode", VXB_PARAM_INT32, {(void *)RTG_TSO_OFF}},
+       {"hwStats", VXB_PARAM_INT32, {(void *)0}},
+       {"intCpu", VXB_PARAM_INT32, {(void *)-1}},
+       {"pollZeroCopy", VXB_PARAM_INT32, {(void *)0}},
+       {"busyPoll", VXB_PARAM_INT32, {(void *)0}},
+       {"cachedRings", VXB_PARAM_INT32, {(void *)0}},
+       {"busyPollCpu", VXB_PARAM_INT32, {(void *)-1}},
+       {"busyPollPri", VXB_PARAM_INT32, {(void *)RTG_BUSY_PRI}},
+       {"busyPollIdle", VXB_PARAM_INT32, {(void *)RTG_BUSY_IDLE}},
+       {"fastProbe", VXB_PARAM_INT32, {(void *)1}},
+       {"tapSlots", VXB_PARAM_INT32, {(void *)RTG_TAP_SLOTS}},
+       {"latHist", VXB_PARAM_INT32, {(void *)0}},
+       {"txBounceCnt", VXB_PARAM_INT32, {(void *)RTG_TX_BOUNCE}},
+       {"txHpDescCnt", VXB_PARAM_INT32, {(void *)0}},
+       {"txHpPcp", VXB_PARAM_INT32, {(void *)RTG_TX_HP_PCP}},
+       {"txHpDscp", VXB_PARAM_INT32, {(void *)RTG_TX_HP_DSCP}},
         {NULL, VXB_PARAM_END_OF_LIST, {NULL}}
     };
 
@@ -359,18 +738,60 @@ LOCAL int	rtgEndIoctl (END_OBJ *, int, caddr_t);
 LOCAL STATUS	rtgEndMCastAddrAdd (END_OBJ *, char *);
 LOCAL STATUS	rtgEndMCastAddrDel (END_OBJ *, char *);
 LOCAL STATUS	rtgEndMCastAddrGet (END_OBJ *, MULTI_TABLE *);
+LOCAL void	rtgEndHashTblWrite (RTG_DRV_CTRL *);
 LOCAL void	rtgEndHashTblPopulate (RTG_DRV_CTRL *);
+LOCAL void	rtgEndHashTblUpdate (RTG_DRV_CTRL *, char *, BOOL);
 LOCAL STATUS	rtgEndStatsDump (RTG_DRV_CTRL *);
+LOCAL void	rtgEndStatsRead (RTG_DRV_CTRL *, RTG_STATS64 *);
+LOCAL void	rtgTallyCollect (RTG_DRV_CTRL *);
 LOCAL void	rtgEndRxConfig (RTG_DRV_CTRL *);
 LOCAL STATUS	rtgEndStart (END_OBJ *);
 LOCAL STATUS	rtgEndStop (END_OBJ *);
 LOCAL int	rtgEndSend (END_OBJ *, M_BLK_ID);
+LOCAL void	rtgEndTxOffload (RTG_DRV_CTRL *, M_BLK_ID, BOOL, UINT32 *,
+    UINT32 *);
+LOCAL void	rtgEndTxAccount (RTG_DRV_CTRL *, M_BLK_ID);
+LOCAL int	rtgEndTxQueue (RTG_DRV_CTRL *, M_BLK_ID);
+LOCAL int	rtgEndTsoSoft (RTG_DRV_CTRL *, M_BLK_ID, BOOL);
+LOCAL BOOL	rtgHpClassify (RTG_DRV_CTRL *, M_BLK_ID);
+LOCAL int	rtgEndHpSend (RTG_DRV_CTRL *, M_BLK_ID);
+LOCAL void	rtgEndHpPut (RTG_DRV_CTRL *, M_BLK_ID);
+LOCAL BOOL	rtgEndHpReclaim (RTG_DRV_CTRL *);
+LOCAL UINT32	rtgCksumAdd (UINT32, UINT8 *, int);
+LOCAL UINT16	rtgCksumFold (UINT32);
 LOCAL STATUS	rtgEndPollSend (END_OBJ *, M_BLK_ID);
 LOCAL int	rtgEndPollReceive (END_OBJ *, M_BLK_ID);
+LOCAL void	rtgEndPollSwap (RTG_DRV_CTRL *, M_BLK_ID);
+LOCAL void	rtgEndRxArm (RTG_DRV_CTRL *, UINT32);
 LOCAL void	rtgEndInt (RTG_DRV_CTRL *);
 LOCAL void	rtgEndRxHandle (void *);
+LOCAL int	rtgEndRxProcess (RTG_DRV_CTRL *, int);
+LOCAL void	rtgEndRxDeliver (RTG_DRV_CTRL *, M_BLK_ID);
+LOCAL void	rtgEndRxCsum (RTG_DRV_CTRL *, M_BLK_ID, UINT32, UINT32);
+LOCAL int	rtgRssHash (RTG_DRV_CTRL *, M_BLK_ID);
+LOCAL void	rtgRssPost (RTG_DRV_CTRL *, M_BLK_ID *, M_BLK_ID *);
+LOCAL void	rtgRssHandle (void *);
+LOCAL M_BLK_ID	rtgEndRxCopy (RTG_DRV_CTRL *, int);
+LOCAL M_BLK_ID	rtgEndRxChain (RTG_DRV_CTRL *, M_BLK_ID, UINT32, int, int);
+LOCAL STATUS	rtgCbPoolCreate (RTG_DRV_CTRL *);
+LOCAL void	rtgCbPoolDestroy (RTG_DRV_CTRL *);
+LOCAL void	rtgRbPoolCreate (RTG_DRV_CTRL *, int);
+LOCAL void	rtgRbPoolDestroy (RTG_DRV_CTRL *);
+LOCAL M_BLK_ID	rtgRbGet (RTG_DRV_CTRL *, RTG_RX_BUF **);
+LOCAL void	rtgRbFree (RTG_DRV_CTRL *, RTG_RX_BUF *);
+LOCAL void	rtgRbRelease (void *);
+LOCAL void	rtgBncRingCreate (RTG_DRV_CTRL *, int);
+LOCAL void	rtgBncRingDestroy (RTG_DRV_CTRL *);
+LOCAL void	rtgHpRingCreate (RTG_DRV_CTRL *, int, ULONG);
+LOCAL void	rtgHpRingDestroy (RTG_DRV_CTRL *);
+LOCAL void	rtgRxGroupJoin (RTG_DRV_CTRL *);
+LOCAL void	rtgRxGroupLeave (RTG_DRV_CTRL *);
+LOCAL void	rtgRxGroupHandle (void *);
 LOCAL void	rtgEndTxHandle (void *);
+LOCAL BOOL	rtgEndTxReclaim (RTG_DRV_CTRL *);
+LOCAL void	rtgEndTxReclaimTimer (RTG_DRV_CTRL *);
 LOCAL void	rtgEndIntHandle (void *);
+LOCAL UINT16	rtgIntrModUpdate (RTG_DRV_CTRL *);
 
 LOCAL NET_FUNCS rtgNetFuncs =
     {
@@ -403,6 +824,12 @@ LOCAL NET_FUNCS rtgNetFuncs =
 
 void rtgRegister(void)
     {
+    if (rtgRxGroupSem == NULL)
+        rtgRxGroupSem = semMCreate (SEM_Q_PRIORITY|
+            SEM_DELETE_SAFE|SEM_INVERSION_SAFE);
+    if (rtgInstSem == NULL)
+        rtgInstSem = semMCreate (SEM_Q_PRIORITY|
+            SEM_DELETE_SAFE|SEM_INVERSION_SAFE);
     vxbDevRegister((struct vxbDevRegInfo *)&rtgDevPciRegistration);
     return;
     }
@@ -531,8 +958,8 @@ LOCAL void rtgInstInit2
     RTG_DRV_CTRL *pDrvCtrl;
     VXB_INST_PARAM_VALUE val;
     UINT32 hwRev;
-    UINT16 devId;
     ULONG lowAddr;
+    bus_size_t mapSize;
     UINT8 pciCfgType = 0;
     int i;
 
@@ -551,9 +978,15 @@ LOCAL void rtgInstInit2
     VXB_PCI_BUS_CFG_READ(pDev, RTG_PCI_PCIE_CAP_OFFSET, 1, pciCfgType); 
 
     if (pciCfgType == PCI_EXT_CAP_EXP)
+        {
         lowAddr = VXB_SPACE_MAXADDR;
+        pDrvCtrl->rtgTimerClk = RTG_TIMER_CLK_PCIE;
+        }
     else
+        {
         lowAddr = VXB_SPACE_MAXADDR_32BIT;
+        pDrvCtrl->rtgTimerClk = RTG_TIMER_CLK_PCI;
+        }
 
     /*
      * We want to choose the memory mapped BAR. Usually this is
@@ -594,6 +1027,7 @@ LOCAL void rtgInstInit2
             pDrvCtrl->rtgTxDescCnt = RTG_TX_DESC_8139;
             pDrvCtrl->rtgRxLenMask = RTG_RDESC_STAT_FRAGLEN;
             pDrvCtrl->rtgTxStartReg = RTG_TXPRIOPOLL_8139;
+            pDrvCtrl->rtgTimerIntReg = RTG_TIMERINT_8139;
             pDrvCtrl->rtgDescV2 = FALSE;
             break;
         case RTG_HWREV_8168_SPIN1:
@@ -614,6 +1048,7 @@ LOCAL void rtgInstInit2
             pDrvCtrl->rtgTxDescCnt = RTG_TX_DESC_8169;
             pDrvCtrl->rtgRxLenMask = RTG_RDESC_STAT_GFRAGLEN;
             pDrvCtrl->rtgTxStartReg = RTG_TXPRIOPOLL_8169;
+            pDrvCtrl->rtgTimerIntReg = RTG_TIMERINT_8169;
             pDrvCtrl->rtgDescV2 = FALSE;
 
             logMsg("rtg %d detect OK\n", pDev->unitNumber, 0,0,0,0,0);
@@ -631,6 +1066,7 @@ LOCAL void rtgInstInit2
             pDrvCtrl->rtgTxDescCnt = RTG_TX_DESC_8169;
             pDrvCtrl->rtgRxLenMask = RTG_RDESC_STAT_GFRAGLEN;
             pDrvCtrl->rtgTxStartReg = RTG_TXPRIOPOLL_8169;
+            pDrvCtrl->rtgTimerIntReg = RTG_TIMERINT_8169;
             pDrvCtrl->rtgDescV2 = TRUE;
 
             /*
@@ -668,46 +1104,125 @@ LOCAL void rtgInstInit2
             break;
         }
 
-    /* Determine EEPROM size. */
-
-    pDrvCtrl->rtgEeWidth = 6;
-    rtgEepromRead (pDev, (UINT8 *)&devId, 0, 1);
-    if (devId != htole16(RTG_EE_SIGNATURE))
-        pDrvCtrl->rtgEeWidth = 8;
+    pDrvCtrl->rtgDevSem = semMCreate (SEM_Q_PRIORITY|
+        SEM_DELETE_SAFE|SEM_INVERSION_SAFE);
 
-    /* Save the station address */
+    /*
+     * Reading the station address from the EEPROM and creating
+     * the MII bus are slow, so they are left to rtgPortAttach(),
+     * which runs when the port is brought up.
+     */
 
-    rtgEepromRead (pDev, (UINT8 *)&devId, 0, 1);
+    /*
+     * paramDesc {
+     * The rxDescCnt parameter specifies the number of
+     * descriptors in the RX DMA ring. It must be a power of
+     * two; other values are rounded down. The limit is 64 on
+     * the 8139C+ and 1024 on all other devices. The default
+     * of 0 selects 64 on the 8139C+ and 128 otherwise. }
+     */
+    pDrvCtrl->rtgRxDescCnt = rtgDescCntGet (pDev, "rxDescCnt",
+        pDrvCtrl->rtgRxDescCnt,
+        pDrvCtrl->rtgDevType == RTG_DEVTYPE_8139CPLUS ?
+        RTG_DESC_MAX_8139 : RTG_DESC_MAX_8169);
 
     /*
-     * If this is an RTL8168DP, then there is no attached
-     * EEPROM: the MAC is directly programmed into the MAC
-     * by setting fuse bits. If reading the EEPROM fails
-     * completely, then just recover the MAC address from
-     * the RX filter registers.
+     * paramDesc {
+     * The txDescCnt parameter specifies the number of
+     * descriptors in the TX DMA ring. The same rules as
+     * for rxDescCnt apply. }
      */
+    pDrvCtrl->rtgTxDescCnt = rtgDescCntGet (pDev, "txDescCnt",
+        pDrvCtrl->rtgTxDescCnt,
+        pDrvCtrl->rtgDevType == RTG_DEVTYPE_8139CPLUS ?
+        RTG_DESC_MAX_8139 : RTG_DESC_MAX_8169);
 
-    if (devId != htole16(RTG_EE_SIGNATURE))
+    /*
+     * paramDesc {
+     * The rxCopybreak parameter specifies the length in
+     * bytes at or below which received frames are copied
+     * into a small cluster, leaving the DMA buffer in the
+     * RX ring. The maximum is 240. The default of 0 disables
+     * copybreak. }
+     */
+    if (vxbInstParamByNameGet (pDev, "rxCopybreak",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val > 0)
         {
-        UINT32 addr[2];
-        addr[0] =  CSR_READ_4(pDev, RTG_IDR0);
-        addr[0] = le32toh(addr[0]);
-        addr[1] =  CSR_READ_4(pDev, RTG_IDR1);
-        addr[1] = le32toh(addr[1]);
-        bcopy ((char *)addr, (char *)pDrvCtrl->rtgAddr, ETHER_ADDR_LEN);
+        pDrvCtrl->rtgRxCopybreak = (UINT32)val.int32Val;
+        if (pDrvCtrl->rtgRxCopybreak > RTG_COPYBREAK_MAX)
+            pDrvCtrl->rtgRxCopybreak = RTG_COPYBREAK_MAX;
         }
-    else
-    rtgEepromRead (pDev, pDrvCtrl->rtgAddr, RTG_EE_EADDR, 3);
 
-    pDrvCtrl->rtgDevSem = semMCreate (SEM_Q_PRIORITY|
-        SEM_DELETE_SAFE|SEM_INVERSION_SAFE);
+    /*
+     * paramDesc {
+     * The rxBatch parameter selects how received frames
+     * are passed to the MUX: 0 for one call per frame as
+     * it is reaped, 1 for one call per frame after each RX
+     * pass, and 2 for a single call per RX pass with the
+     * frames linked through m_nextpkt. Mode 2 must only be
+     * used if the stack accepts packet chains. The default
+     * is 0. }
+     */
+    pDrvCtrl->rtgRxBatch = RTG_RXBATCH_OFF;
+    if (vxbInstParamByNameGet (pDev, "rxBatch",
+        VXB_PARAM_INT32, &val) == OK &&
+        (val.int32Val == RTG_RXBATCH_LIST ||
+         val.int32Val == RTG_RXBATCH_CHAIN))
+        pDrvCtrl->rtgRxBatch = val.int32Val;
 
-    /* Create our MII bus. */
+    /*
+     * paramDesc {
+     * The cachedRings parameter specifies whether the
+     * descriptor rings should be allocated from cached
+     * memory. The default is false. }
+     */
+    pDrvCtrl->rtgDescCached = FALSE;
+    if (vxbInstParamByNameGet (pDev, "cachedRings",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val != 0)
+        pDrvCtrl->rtgDescCached = TRUE;
+    pDrvCtrl->rtgRxLineArm = FALSE;
+    if (pDrvCtrl->rtgDescCached == TRUE && RTG_DESC_COHERENT == FALSE)
+        pDrvCtrl->rtgRxLineArm = TRUE;
 
-    miiBusCreate (pDev, &pDrvCtrl->rtgMiiBus);
-    miiBusMediaListGet (pDrvCtrl->rtgMiiBus, &pDrvCtrl->rtgMediaList);
-    miiBusModeSet (pDrvCtrl->rtgMiiBus,
-         pDrvCtrl->rtgMediaList->endMediaListDefault);
+    /*
+     * paramDesc {
+     * The fastProbe parameter specifies whether the
+     * station address should be taken from the ID
+     * registers, which the chip loads from the EEPROM
+     * itself, rather than read from the EEPROM. The
+     * default is true. }
+     */
+    pDrvCtrl->rtgFastProbe = TRUE;
+    if (vxbInstParamByNameGet (pDev, "fastProbe",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val == 0)
+        pDrvCtrl->rtgFastProbe = FALSE;
+
+    /*
+     * paramDesc {
+     * The tapSlots parameter specifies how many frames
+     * the capture tap can hold in each direction. It must
+     * be a power of two. The default is 1024. }
+     */
+    pDrvCtrl->rtgTapSlots = RTG_TAP_SLOTS;
+    if (vxbInstParamByNameGet (pDev, "tapSlots",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val > 0 &&
+        (val.int32Val & (val.int32Val - 1)) == 0)
+        pDrvCtrl->rtgTapSlots = val.int32Val;
+
+    /*
+     * paramDesc {
+     * The latHist parameter specifies whether the RX
+     * pipeline latency histograms should be kept. The
+     * default is false. }
+     */
+    pDrvCtrl->rtgHistOn = FALSE;
+    if (vxbInstParamByNameGet (pDev, "latHist",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val != 0)
+        pDrvCtrl->rtgHistOn = TRUE;
+
+    pDrvCtrl->rtgRssCnt = 1;
+    for (i = 0; i < RTG_RSS_MAX; i++)
+        SPIN_LOCK_ISR_INIT (&pDrvCtrl->rtgRss[i].rtgRssLock, 0);
 
     /* Get a reference to our parent tag. */
 
@@ -719,8 +1234,9 @@ LOCAL void rtgInstInit2
      * descriptor layout model. Descriptors are 16 bytes
      * in size, which is not a common cache line size.
      * Consequently, we allocate the descriptor rings from
-     * uncached memory. The RealTek also requires that the
-     * DMA rings be allocated at a 256-byte aligned address.
+     * uncached memory, unless cachedRings is set. The RealTek
+     * also requires that the DMA rings be allocated at a
+     * 256-byte aligned address.
      */
 
     /* Create tag for RX descriptor ring. */
@@ -736,6 +1252,7 @@ LOCAL void rtgInstInit2
 	sizeof(RTG_DESC) * pDrvCtrl->rtgRxDescCnt,	/* max size */
 	1,				/* nSegments */
         sizeof(RTG_DESC) * pDrvCtrl->rtgRxDescCnt,	/* max seg size */
+        pDrvCtrl->rtgDescCached == TRUE ? VXB_DMABUF_ALLOCNOW :
         VXB_DMABUF_ALLOCNOW|VXB_DMABUF_NOCACHE,		/* flags */
 	NULL,				/* lockfunc */
 	NULL,				/* lockarg */
@@ -757,6 +1274,8 @@ LOCAL void rtgInstInit2
 	sizeof(RTG_DESC) * pDrvCtrl->rtgTxDescCnt,	/* max size */
 	1,				/* nSegments */
         sizeof(RTG_DESC) * pDrvCtrl->rtgTxDescCnt,	/* max seg size */
+        pDrvCtrl->rtgDescCached == TRUE && RTG_DESC_COHERENT == TRUE ?
+        VXB_DMABUF_ALLOCNOW :
         VXB_DMABUF_ALLOCNOW|VXB_DMABUF_NOCACHE,		/* flags */
 	NULL,				/* lockfunc */
 	NULL,				/* lockarg */
@@ -765,6 +1284,138 @@ LOCAL void rtgInstInit2
     pDrvCtrl->rtgTxDescMem = vxbDmaBufMemAlloc (pDev,
         pDrvCtrl->rtgTxDescTag, NULL, 0, &pDrvCtrl->rtgTxDescMap);
 
+    /*
+     * paramDesc {
+     * The hwStats parameter specifies whether the chip's
+     * tally counters should be used for the RX packet and
+     * error statistics, rather than counting every frame in
+     * software. The default is false. }
+     */
+    pDrvCtrl->rtgHwStats = FALSE;
+    if (vxbInstParamByNameGet (pDev, "hwStats",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val != 0)
+        pDrvCtrl->rtgHwStats = TRUE;
+
+    /*
+     * paramDesc {
+     * The intCpu parameter specifies the CPU to which the
+     * interrupt is routed and, when rxQueue00 gives the
+     * instance a job queue, on which that queue's task runs.
+     * The default of -1 leaves both where the system puts
+     * them. }
+     */
+    pDrvCtrl->rtgIntCpu = -1;
+    if (vxbInstParamByNameGet (pDev, "intCpu",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val >= 0)
+        {
+        if (val.int32Val < (int)vxCpuConfiguredGet ())
+            pDrvCtrl->rtgIntCpu = val.int32Val;
+        else
+            RTG_LOGMSG("%s%d: intCpu %d is not a configured CPU\n",
+                RTG_NAME, pDev->unitNumber, val.int32Val, 0, 0, 0);
+        }
+
+    /*
+     * paramDesc {
+     * The pollZeroCopy parameter specifies whether polled
+     * mode receive should hand over the ring's cluster
+     * instead of copying the frame, when the caller's
+     * cluster allows it. The default is false. }
+     */
+    pDrvCtrl->rtgPollZcopy = FALSE;
+    if (vxbInstParamByNameGet (pDev, "pollZeroCopy",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val != 0)
+        pDrvCtrl->rtgPollZcopy = TRUE;
+
+    /*
+     * paramDesc {
+     * The busyPoll parameter specifies whether RX frames
+     * should be picked up by a busy-polling task rather
+     * than by the RX job. The default is false. }
+     */
+    pDrvCtrl->rtgBusyPoll = FALSE;
+    if (vxbInstParamByNameGet (pDev, "busyPoll",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val != 0)
+        pDrvCtrl->rtgBusyPoll = TRUE;
+
+    /*
+     * paramDesc {
+     * The busyPollCpu parameter specifies the CPU the
+     * busy-poll task is bound to. The default of -1 leaves
+     * it unbound. }
+     */
+    pDrvCtrl->rtgBusyCpu = -1;
+    if (vxbInstParamByNameGet (pDev, "busyPollCpu",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val >= 0 &&
+        val.int32Val < (int)vxCpuConfiguredGet ())
+        pDrvCtrl->rtgBusyCpu = val.int32Val;
+
+    /*
+     * paramDesc {
+     * The busyPollPri parameter specifies the priority of
+     * the busy-poll task. The default is 10. }
+     */
+    pDrvCtrl->rtgBusyPri = RTG_BUSY_PRI;
+    if (vxbInstParamByNameGet (pDev, "busyPollPri",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val >= 0 &&
+        val.int32Val <= 255)
+        pDrvCtrl->rtgBusyPri = val.int32Val;
+
+    /*
+     * paramDesc {
+     * The busyPollIdle parameter specifies how many
+     * microseconds the busy-poll task keeps polling after
+     * the last frame before unmasking the RX interrupts.
+     * The default is 1000. }
+     */
+    pDrvCtrl->rtgBusyIdle = RTG_BUSY_IDLE;
+    if (vxbInstParamByNameGet (pDev, "busyPollIdle",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val > 0)
+        pDrvCtrl->rtgBusyIdle = val.int32Val;
+
+    if (pDrvCtrl->rtgBusyPoll == TRUE)
+        {
+        pDrvCtrl->rtgBusySem = semBCreate (SEM_Q_FIFO, SEM_EMPTY);
+        pDrvCtrl->rtgBusyDone = semBCreate (SEM_Q_FIFO, SEM_EMPTY);
+        }
+
+    /*
+     * Create tag for the tally counter block. Like the rings,
+     * it lives in uncached memory, and is mapped once here.
+     */
+
+    if (pDrvCtrl->rtgHwStats == TRUE)
+        {
+        pDrvCtrl->rtgTallyTag = vxbDmaBufTagCreate (pDev,
+            pDrvCtrl->rtgParentTag,	/* parent */
+            RTG_STATS_DMA_ALIGN,	/* alignment */
+            0,				/* boundary */
+            lowAddr,			/* lowaddr */
+            VXB_SPACE_MAXADDR,		/* highaddr */
+            NULL,			/* filter */
+            NULL,			/* filterarg */
+            sizeof(RTG_STATS),		/* max size */
+            1,				/* nSegments */
+            sizeof(RTG_STATS),		/* max seg size */
+            VXB_DMABUF_ALLOCNOW|VXB_DMABUF_NOCACHE,	/* flags */
+            NULL,			/* lockfunc */
+            NULL,			/* lockarg */
+            NULL);			/* ppDmaTag */
+
+        pDrvCtrl->rtgTallyMem = vxbDmaBufMemAlloc (pDev,
+            pDrvCtrl->rtgTallyTag, NULL, 0, &pDrvCtrl->rtgTallyMap);
+
+        if (pDrvCtrl->rtgTallyMem == NULL ||
+            vxbDmaBufMapLoad (pDev, pDrvCtrl->rtgTallyTag,
+            pDrvCtrl->rtgTallyMap, pDrvCtrl->rtgTallyMem,
+            sizeof(RTG_STATS), 0) != OK)
+            {
+            RTG_LOGMSG("%s%d: tally counters unavailable\n", RTG_NAME,
+                pDev->unitNumber, 0, 0, 0, 0);
+            pDrvCtrl->rtgHwStats = FALSE;
+            }
+        }
+
     /*
      * See if the user wants jumbo frame support for this
      * interface. If the "jumboEnable" option isn't specified,
@@ -773,7 +1424,14 @@ LOCAL void rtgInstInit2
      *
      * Note: the 8139C+, 8100E and 8101E parts don't support
      * jumbo frames, as they're 10/100 only. The original 8169
-     * part doesn't seem support them either.
+     * part doesn't seem support them either, at least not
+     * with large RX buffers.
+     *
+     * With scatter RX, the RX ring keeps standard size buffers
+     * and a jumbo frame is received into several descriptors,
+     * which are chained together. This avoids the need for a
+     * jumbo cluster in every ring slot, and lets the original
+     * 8169 do jumbo frames too.
      */
 
     /*
@@ -784,25 +1442,146 @@ LOCAL void rtgInstInit2
      */
     i = vxbInstParamByNameGet (pDev, "jumboEnable", VXB_PARAM_INT32, &val);
 
+    pDrvCtrl->rtgRxScatter = FALSE;
     if (i != OK || val.int32Val == 0 ||
         pDrvCtrl->rtgHwRev == RTG_HWREV_8139CPLUS ||
         pDrvCtrl->rtgHwRev == RTG_HWREV_8100E ||
         pDrvCtrl->rtgHwRev == RTG_HWREV_8101E ||
         pDrvCtrl->rtgHwRev == RTG_HWREV_8102E ||
         pDrvCtrl->rtgHwRev == RTG_HWREV_8102EL ||
-        pDrvCtrl->rtgHwRev == RTG_HWREV_8103EL ||
-        pDrvCtrl->rtgHwRev == RTG_HWREV_8169)
+        pDrvCtrl->rtgHwRev == RTG_HWREV_8103EL)
         {
         i = RTG_CLSIZE;
         pDrvCtrl->rtgMaxMtu = RTG_MTU;
         }
     else
         {
-        i = END_JUMBO_CLSIZE;
+        /*
+         * paramDesc {
+         * The rxScatter parameter specifies whether jumbo
+         * frames are received into chains of standard size
+         * buffers rather than into jumbo clusters. It is
+         * always used on the original 8169. The default
+         * is false. }
+         */
+        if ((vxbInstParamByNameGet (pDev, "rxScatter",
+            VXB_PARAM_INT32, &val) == OK && val.int32Val != 0) ||
+            pDrvCtrl->rtgHwRev == RTG_HWREV_8169)
+            {
+            i = RTG_CLSIZE;
+            pDrvCtrl->rtgRxScatter = TRUE;
+            }
+        else
+            i = END_JUMBO_CLSIZE;
         pDrvCtrl->rtgMaxMtu = RTG_JUMBO_MTU;
         }
 
-    /* Create tag for mBlk mappings */
+    /*
+     * paramDesc {
+     * The intrModMode parameter selects the interrupt
+     * moderation policy: 0 for none, 1 for a static
+     * holdoff and 2 for adaptive moderation. The
+     * default is 0. }
+     */
+    pDrvCtrl->rtgIntrModMode = RTG_INTRMOD_OFF;
+    if (vxbInstParamByNameGet (pDev, "intrModMode",
+        VXB_PARAM_INT32, &val) == OK)
+        pDrvCtrl->rtgIntrModMode = val.int32Val;
+
+    /*
+     * paramDesc {
+     * The intrModUsecs parameter specifies the interrupt
+     * holdoff time in microseconds. In adaptive mode, this
+     * is the largest holdoff that will be used. }
+     */
+    pDrvCtrl->rtgIntrModUsecs = RTG_INTRMOD_USECS;
+    if (vxbInstParamByNameGet (pDev, "intrModUsecs",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val > 0)
+        pDrvCtrl->rtgIntrModUsecs = (UINT32)val.int32Val;
+
+    /*
+     * paramDesc {
+     * The intrModFrames parameter specifies how many frames
+     * an interrupt must find before moderation is engaged.
+     * In adaptive mode, this is the target number of frames
+     * to be serviced per interrupt. }
+     */
+    pDrvCtrl->rtgIntrModFrames = RTG_INTRMOD_FRAMES;
+    if (vxbInstParamByNameGet (pDev, "intrModFrames",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val > 0)
+        pDrvCtrl->rtgIntrModFrames = (UINT32)val.int32Val;
+
+    if (pDrvCtrl->rtgIntrModMode != RTG_INTRMOD_STATIC &&
+        pDrvCtrl->rtgIntrModMode != RTG_INTRMOD_ADAPTIVE)
+        pDrvCtrl->rtgIntrModMode = RTG_INTRMOD_OFF;
+
+    /*
+     * paramDesc {
+     * The rxBudget parameter specifies the maximum number
+     * of frames the RX handler will process in one pass
+     * before rescheduling itself. The default is 16. }
+     */
+    pDrvCtrl->rtgRxBudget = RTG_MAX_RX;
+    if (vxbInstParamByNameGet (pDev, "rxBudget",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val > 0)
+        pDrvCtrl->rtgRxBudget = val.int32Val;
+
+    /*
+     * paramDesc {
+     * The rxFairness parameter specifies whether this
+     * instance should share RX processing with other rtg
+     * instances on the same job queue in weighted round-robin
+     * order. The default is false. }
+     */
+    if (vxbInstParamByNameGet (pDev, "rxFairness",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val != 0)
+        pDrvCtrl->rtgRxFair = TRUE;
+
+    /* A busy-poll port services its own ring. */
+
+    if (pDrvCtrl->rtgBusyPoll == TRUE)
+        pDrvCtrl->rtgRxFair = FALSE;
+
+    /*
+     * paramDesc {
+     * The rxWeight parameter specifies this instance's
+     * round-robin weight when rxFairness is enabled. The
+     * default is 1. }
+     */
+    pDrvCtrl->rtgRxWeight = 1;
+    if (vxbInstParamByNameGet (pDev, "rxWeight",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val > 0)
+        pDrvCtrl->rtgRxWeight = val.int32Val;
+
+    /*
+     * paramDesc {
+     * The tsoMode parameter selects TCP segmentation offload:
+     * 0 for none, 1 to use the chip's large send support and
+     * 2 to advertise TSO to the stack but segment in the
+     * driver. Mode 1 falls back to mode 2 when jumbo frames
+     * are enabled. The default is 0. }
+     */
+    pDrvCtrl->rtgTsoMode = RTG_TSO_OFF;
+    if (vxbInstParamByNameGet (pDev, "tsoMode",
+        VXB_PARAM_INT32, &val) == OK &&
+        (val.int32Val == RTG_TSO_HW || val.int32Val == RTG_TSO_SW))
+        pDrvCtrl->rtgTsoMode = val.int32Val;
+
+    if (pDrvCtrl->rtgTsoMode == RTG_TSO_HW &&
+        pDrvCtrl->rtgMaxMtu == RTG_JUMBO_MTU)
+        pDrvCtrl->rtgTsoMode = RTG_TSO_SW;
+
+    /*
+     * Create tag for mBlk mappings. With TSO, outbound
+     * packets can be up to 64K long, so the tag must allow
+     * for larger maps with more segments. With scatter RX,
+     * the RX ring uses standard clusters, but the stack can
+     * still hand us jumbo frames to send.
+     */
+
+    mapSize = (bus_size_t)i;
+    if (pDrvCtrl->rtgRxScatter == TRUE)
+        mapSize = END_JUMBO_CLSIZE;
 
     pDrvCtrl->rtgMblkTag = vxbDmaBufTagCreate (pDev,
         pDrvCtrl->rtgParentTag,         /* parent */
@@ -812,9 +1591,11 @@ LOCAL void rtgInstInit2
         VXB_SPACE_MAXADDR,              /* highaddr */
         NULL,                           /* filter */
         NULL,                           /* filterarg */
-        (bus_size_t)i,                  /* max size */
-        RTG_MAXFRAG,                    /* nSegments */
-        (bus_size_t)i,                  /* max seg size */
+        pDrvCtrl->rtgTsoMode == RTG_TSO_HW ?
+        RTG_TSO_MAXLEN : mapSize,       /* max size */
+        pDrvCtrl->rtgTsoMode == RTG_TSO_HW ?
+        RTG_TSO_MAXFRAG : RTG_MAXFRAG,  /* nSegments */
+        mapSize,                        /* max seg size */
         VXB_DMABUF_ALLOCNOW,            /* flags */
         NULL,                           /* lockfunc */
         NULL,                           /* lockarg */
@@ -827,6 +1608,13 @@ LOCAL void rtgInstInit2
     pDrvCtrl->rtgRxMblkMap = malloc(sizeof(VXB_DMA_MAP_ID) *
         pDrvCtrl->rtgRxDescCnt);
     pDrvCtrl->rtgTxMblk = malloc(sizeof(M_BLK_ID) * pDrvCtrl->rtgTxDescCnt);
+    pDrvCtrl->rtgTxBnc = malloc(sizeof(BOOL) * pDrvCtrl->rtgTxDescCnt);
+    if (pDrvCtrl->rtgTxBnc == NULL)
+        logMsg("rtg %d: could not allocate TX bounce flags\n",
+            pDev->unitNumber, 0,0,0,0,0);
+    else
+        bzero ((char *)pDrvCtrl->rtgTxBnc,
+            sizeof(BOOL) * pDrvCtrl->rtgTxDescCnt);
     pDrvCtrl->rtgRxMblk = malloc(sizeof(M_BLK_ID) * pDrvCtrl->rtgRxDescCnt);
 
     for (i = 0; i < pDrvCtrl->rtgTxDescCnt; i++)
@@ -842,15 +1630,254 @@ LOCAL void rtgInstInit2
             &pDrvCtrl->rtgRxMblkMap[i]) == NULL)
             RTG_LOGMSG("create Rx map %d failed\n", i, 0,0,0,0,0);
         }
+
+    /*
+     * paramDesc {
+     * The txReclaim parameter specifies whether TX completion
+     * interrupts should be masked, with completed descriptors
+     * reclaimed by the send path and a backstop timer instead.
+     * The default is false. }
+     */
+    pDrvCtrl->rtgIntrMask = RTG_INTRS;
+    if (vxbInstParamByNameGet (pDev, "txReclaim",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val != 0)
+        pDrvCtrl->rtgTxReclaimWd = wdCreate ();
+
+    if (pDrvCtrl->rtgTxReclaimWd != NULL)
+        {
+        pDrvCtrl->rtgTxReclaim = TRUE;
+        pDrvCtrl->rtgIntrMask &= ~RTG_TXRECLAIM_INTRS;
+        }
+
+    /*
+     * paramDesc {
+     * The txReclaimThresh parameter specifies the number of
+     * free TX descriptors below which the send path reclaims
+     * completed descriptors when txReclaim is set. The default
+     * of 0 selects a quarter of the TX ring. }
+     */
+    pDrvCtrl->rtgTxReclaimThresh = pDrvCtrl->rtgTxDescCnt / 4;
+    if (vxbInstParamByNameGet (pDev, "txReclaimThresh",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val > 0 &&
+        val.int32Val <= pDrvCtrl->rtgTxDescCnt)
+        pDrvCtrl->rtgTxReclaimThresh = val.int32Val;
+
+    /*
+     * paramDesc {
+     * The txReclaimMs parameter specifies the period in
+     * milliseconds of the TX reclaim backstop timer. The
+     * default is 10. }
+     */
+    pDrvCtrl->rtgTxReclaimMs = RTG_TXRECLAIM_MS;
+    if (vxbInstParamByNameGet (pDev, "txReclaimMs",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val > 0)
+        pDrvCtrl->rtgTxReclaimMs = val.int32Val;
+
+    pDrvCtrl->rtgRxBuf = malloc(sizeof(RTG_RX_BUF *) * pDrvCtrl->rtgRxDescCnt);
+    if (pDrvCtrl->rtgRxBuf == NULL)
+        logMsg("rtg %d: could not allocate RX buffer slots\n",
+            pDev->unitNumber, 0,0,0,0,0);
+    else
+        bzero ((char *)pDrvCtrl->rtgRxBuf,
+            sizeof(RTG_RX_BUF *) * pDrvCtrl->rtgRxDescCnt);
+
+    pDrvCtrl->rtgStats = memalign (RTG_STATS_ALIGN, sizeof(RTG_SW_STATS));
+    if (pDrvCtrl->rtgStats == NULL)
+        logMsg("rtg %d: could not allocate statistics memory\n",
+            pDev->unitNumber, 0,0,0,0,0);
+    else
+        bzero ((char *)pDrvCtrl->rtgStats, sizeof(RTG_SW_STATS));
+
+    /*
+     * paramDesc {
+     * The rxRecycleCnt parameter specifies the number of
+     * RX buffers which are DMA mapped once and recycled
+     * back into the RX ring when the stack frees them. When
+     * none are available, the driver falls back to the
+     * netpool. The default of 0 disables recycling. }
+     */
+    if (vxbInstParamByNameGet (pDev, "rxRecycleCnt",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val > 0)
+        rtgRbPoolCreate (pDrvCtrl, val.int32Val);
+
+    /*
+     * paramDesc {
+     * The txBounceCnt parameter specifies the number of
+     * permanently DMA mapped TX buffers into which frames
+     * that must be coalesced are copied. When none are
+     * free, the driver falls back to the netpool. The
+     * default is 32; 0 disables the bounce ring. }
+     */
+    if (vxbInstParamByNameGet (pDev, "txBounceCnt",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val > 0)
+        rtgBncRingCreate (pDrvCtrl, val.int32Val);
+
+    /*
+     * paramDesc {
+     * The txHpDescCnt parameter specifies the number of
+     * descriptors in the high priority TX ring, which the
+     * chip serves ahead of the normal one. The default of 0
+     * disables the high priority ring. }
+     */
+    if (vxbInstParamByNameGet (pDev, "txHpDescCnt",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val > 0)
+        rtgHpRingCreate (pDrvCtrl,
+            rtgDescCntGet (pDev, "txHpDescCnt", 0, RTG_TX_HP_MAX), lowAddr);
+
+    /*
+     * paramDesc {
+     * The txHpPcp parameter specifies the lowest VLAN
+     * priority of the frames sent on the high priority TX
+     * ring. The default is 6; -1 ignores the priority. }
+     */
+    pDrvCtrl->rtgHpPcp = RTG_TX_HP_PCP;
+    if (vxbInstParamByNameGet (pDev, "txHpPcp",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val <= 7)
+        pDrvCtrl->rtgHpPcp = val.int32Val;
+
+    /*
+     * paramDesc {
+     * The txHpDscp parameter specifies the lowest DSCP of
+     * the IP frames sent on the high priority TX ring. The
+     * default is 48 (CS6); -1 ignores the DSCP. }
+     */
+    pDrvCtrl->rtgHpDscp = RTG_TX_HP_DSCP;
+    if (vxbInstParamByNameGet (pDev, "txHpDscp",
+        VXB_PARAM_INT32, &val) == OK && val.int32Val <= 63)
+        pDrvCtrl->rtgHpDscp = val.int32Val;
+
     return;
     }
 
-LOCAL void SaveRtgVxbDeviceId
+/*****************************************************************************
+*
+* rtgDescCntGet - get the size of a DMA descriptor ring
+*
+* This routine looks up the ring size parameter <pName> for this instance.
+* If it is not set, <defCnt> is used. The result is clamped to the range
+* RTG_DESC_MIN to <maxCnt> and rounded down to a power of two, since the
+* ring index arithmetic in RTG_INC_DESC() relies on it.
+*
+* RETURNS: the number of descriptors to use
+*
+* ERRNO: N/A
+*/
+
+LOCAL int rtgDescCntGet
+    (
+    VXB_DEVICE_ID pDev,
+    char * pName,
+    int defCnt,
+    int maxCnt
+    )
+    {
+    VXB_INST_PARAM_VALUE val;
+    int cnt = defCnt;
+    int pow2;
+
+    if (vxbInstParamByNameGet (pDev, pName, VXB_PARAM_INT32, &val) == OK &&
+        val.int32Val > 0)
+        cnt = val.int32Val;
+
+    if (cnt > maxCnt)
+        cnt = maxCnt;
+    if (cnt < RTG_DESC_MIN)
+        cnt = RTG_DESC_MIN;
+
+    for (pow2 = RTG_DESC_MIN; (pow2 << 1) <= cnt; pow2 <<= 1)
+        ;
+
+    if (pow2 != cnt)
+        RTG_LOGMSG("%s%d: %s %d is not a power of two, using %d\n",
+            RTG_NAME, pDev->unitNumber, pName, cnt, pow2, 0);
+
+    return (pow2);
+    }
+
+/*****************************************************************************
+*
+* rtgInstAdd - add an instance to the registry
+*
+* This routine records an attached rtg instance so that sysRtgEndInit()
+* can bring it up later. The registry starts out with RTG_INST_MIN
+* slots and doubles in size whenever it fills up.
+*
+* RETURNS: OK, or ERROR if the registry could not be grown
+*
+* ERRNO: N/A
+*/
+
+LOCAL STATUS rtgInstAdd
+    (
+    VXB_DEVICE_ID pDev
+    )
+    {
+    VXB_DEVICE_ID * pNew;
+    int newMax;
+
+    semTake (rtgInstSem, WAIT_FOREVER);
+
+    if (rtgInstCnt == rtgInstMax)
+        {
+        newMax = rtgInstMax ? rtgInstMax * 2 : RTG_INST_MIN;
+        pNew = malloc (newMax * sizeof(VXB_DEVICE_ID));
+        if (pNew == NULL)
+            {
+            semGive (rtgInstSem);
+            return (ERROR);
+            }
+        if (rtgInsts != NULL)
+            {
+            bcopy ((char *)rtgInsts, (char *)pNew,
+                rtgInstCnt * sizeof(VXB_DEVICE_ID));
+            free (rtgInsts);
+            }
+        rtgInsts = pNew;
+        rtgInstMax = newMax;
+        }
+
+    rtgInsts[rtgInstCnt++] = pDev;
+
+    semGive (rtgInstSem);
+
+    return (OK);
+    }
+
+/*****************************************************************************
+*
+* rtgInstRemove - remove an instance from the registry
+*
+* This routine drops an rtg instance from the registry when it is
+* unlinked. The remaining entries are moved down to fill the gap.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgInstRemove
     (
-    VXB_DEVICE_ID pTemp
+    VXB_DEVICE_ID pDev
     )
     {
-    pDevTemp[CurrentRtgNum++] = pTemp;
+    int i;
+
+    semTake (rtgInstSem, WAIT_FOREVER);
+
+    for (i = 0; i < rtgInstCnt; i++)
+        {
+        if (rtgInsts[i] == pDev)
+            {
+            rtgInstCnt--;
+            for (; i < rtgInstCnt; i++)
+                rtgInsts[i] = rtgInsts[i + 1];
+            break;
+            }
+        }
+
+    semGive (rtgInstSem);
+
+    return;
     }
 
 /*****************************************************************************
@@ -870,7 +1897,10 @@ LOCAL void rtgInstConnect
     VXB_DEVICE_ID pDev
     )
     {
-	SaveRtgVxbDeviceId(pDev);
+    if (rtgInstAdd (pDev) != OK)
+        RTG_LOGMSG("%s%d: can't grow the instance registry, "
+            "port won't be brought up by sysRtgEndInit()\n",
+            RTG_NAME, pDev->unitNumber, 0, 0, 0, 0);
     return;
     }
 
@@ -923,6 +1953,8 @@ LOCAL STATUS rtgInstUnlink
             return (ERROR);
         }
 
+    rtgInstRemove (pDev);
+
     /*
      * If this is an RTL8168DP, we must notify the management
      * processor that the driver is releasing control of the MAC.
@@ -949,13 +1981,32 @@ LOCAL STATUS rtgInstUnlink
     for (i = 0; i < pDrvCtrl->rtgTxDescCnt; i++)
         vxbDmaBufMapDestroy (pDrvCtrl->rtgMblkTag, pDrvCtrl->rtgTxMblkMap[i]);
 
+    rtgRbPoolDestroy (pDrvCtrl);
+    rtgBncRingDestroy (pDrvCtrl);
+    rtgHpRingDestroy (pDrvCtrl);
+
+    if (pDrvCtrl->rtgTxReclaimWd != NULL)
+        wdDelete (pDrvCtrl->rtgTxReclaimWd);
+
     free (pDrvCtrl->rtgRxMblk);
     free (pDrvCtrl->rtgTxMblk);
+    free (pDrvCtrl->rtgTxBnc);
+    free (pDrvCtrl->rtgRxBuf);
+    free (pDrvCtrl->rtgStats);
     free (pDrvCtrl->rtgRxMblkMap);
     free (pDrvCtrl->rtgTxMblkMap);
 
     /* Destroy the tags. */
 
+    if (pDrvCtrl->rtgTallyMem != NULL)
+        {
+        vxbDmaBufMapUnload (pDrvCtrl->rtgTallyTag, pDrvCtrl->rtgTallyMap);
+        vxbDmaBufMemFree (pDrvCtrl->rtgTallyTag, pDrvCtrl->rtgTallyMem,
+            pDrvCtrl->rtgTallyMap);
+        }
+    if (pDrvCtrl->rtgTallyTag != NULL)
+        vxbDmaBufTagDestroy (pDrvCtrl->rtgTallyTag);
+
     vxbDmaBufTagDestroy (pDrvCtrl->rtgRxDescTag);
     vxbDmaBufTagDestroy (pDrvCtrl->rtgTxDescTag);
     vxbDmaBufTagDestroy (pDrvCtrl->rtgMblkTag);
@@ -966,14 +2017,39 @@ LOCAL STATUS rtgInstUnlink
 
     /* Destroy our MII bus and child PHYs. */
 
-    miiBusDelete (pDrvCtrl->rtgMiiBus);
+    if (pDrvCtrl->rtgMiiBus != NULL)
+        miiBusDelete (pDrvCtrl->rtgMiiBus);
 
     semDelete (pDrvCtrl->rtgDevSem);
 
-    /* Destroy the adapter context. */
-    free (pDrvCtrl);
+    if (pDrvCtrl->rtgBusySem != NULL)
+        semDelete (pDrvCtrl->rtgBusySem);
+    if (pDrvCtrl->rtgBusyDone != NULL)
+        semDelete (pDrvCtrl->rtgBusyDone);
+
+    if (pDrvCtrl->rtgTapMem != NULL)
+        rtgTapFree (pDrvCtrl->rtgTapMem);
+
+    /*
+     * Destroy the adapter context. If the stack still holds some
+     * recycled RX buffers, the last of them to be freed does this,
+     * since rtgRbFree() needs the free list and its lock.
+     */
+
     pDev->pDrvCtrl = NULL;
 
+    if (pDrvCtrl->rtgRbPool != NULL)
+        {
+        SPIN_LOCK_ISR_TAKE (&pDrvCtrl->rtgRbLock);
+        pDrvCtrl->rtgRbDying = TRUE;
+        i = pDrvCtrl->rtgRbOut;
+        SPIN_LOCK_ISR_GIVE (&pDrvCtrl->rtgRbLock);
+        if (i != 0)
+            return (OK);
+        }
+
+    rtgRbRelease (&pDrvCtrl->rtgRbJob);
+
     /* Goodbye cruel world. */
 
     return (OK);
@@ -1376,8 +2452,10 @@ LOCAL STATUS rtgLinkUpdate
 * manually or (more likely) by the bootstrap code. Most VxBus
 * initialization occurs before the MUX has been fully initialized,
 * so the usual muxDevLoad()/muxDevStart() sequence must be defered
-* until the networking subsystem is ready. This routine will ultimately
-* trigger a call to rtgEndLoad() to create the END interface instance.
+* until the networking subsystem is ready. The station address and
+* MII bus are set up first by rtgPortAttach(), if that hasn't been
+* done yet. This routine will ultimately trigger a call to rtgEndLoad()
+* to create the END interface instance.
 *
 * RETURNS: N/A
 *
@@ -1392,15 +2470,37 @@ LOCAL void rtgMuxConnect
     {
     RTG_DRV_CTRL *pDrvCtrl;
  
+    pDrvCtrl = pDev->pDrvCtrl;
+
     /*
      * Attach our ISR. For PCI, the index value is always
      * 0, since the PCI bus controller dynamically sets
-     * up interrupts for us.
+     * up interrupts for us. If this instance is listed as
+     * a dynamic input of the interrupt controller and the
+     * device has an MSI capability, the vector will be an
+     * MSI; otherwise it's the legacy INTx line.
      */
 
     vxbIntConnect (pDev, 0, rtgEndInt, pDev->pDrvCtrl);
 
-    pDrvCtrl = pDev->pDrvCtrl;
+    pDrvCtrl->rtgMsi = FALSE;
+    if (pDev->pIntrInfo != NULL &&
+        VXB_IS_MSI_INT(pDev->pIntrInfo->intrFlag) == TRUE)
+        pDrvCtrl->rtgMsi = TRUE;
+
+    if (pDrvCtrl->rtgIntCpu != -1)
+        {
+        cpuset_t cpus;
+
+        CPUSET_ZERO(cpus);
+        CPUSET_SET(cpus, pDrvCtrl->rtgIntCpu);
+        if (vxbIntReroute (pDev, 0, cpus) != OK)
+            RTG_LOGMSG("%s%d: can't route interrupt to CPU %d\n",
+                RTG_NAME, pDev->unitNumber, pDrvCtrl->rtgIntCpu, 0, 0, 0);
+        }
+
+    if (pDrvCtrl->rtgMiiBus == NULL)
+        rtgPortAttach (pDev);
 
     /* Save the cookie. */
 
@@ -1416,6 +2516,130 @@ LOCAL void rtgMuxConnect
     return;
     }
 
+/*****************************************************************************
+*
+* rtgPortAttach - read the station address and attach the PHY
+*
+* This routine does the slow part of bringing up a port: it gets the
+* station address, then creates our child
+* miiBus instance, which probes for the PHY, and selects the default
+* media, which starts autonegotiation. The station address is taken
+* from the ID registers when the fastProbe parameter is set and they
+* hold a valid unicast address; otherwise the EEPROM is sized and the
+* address read from it. The time this took is kept in rtgProbeUsecs.
+* It is called from rtgMuxConnect(),
+* so when sysRtgEndInit() brings ports up in parallel, each port does
+* this in its own task.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgPortAttach
+    (
+    VXB_DEVICE_ID pDev
+    )
+    {
+    RTG_DRV_CTRL *pDrvCtrl;
+    UINT16 devId;
+    UINT64 start;
+    UINT64 now;
+
+    pDrvCtrl = pDev->pDrvCtrl;
+
+    RTG_TS_GET(start);
+
+    if (pDrvCtrl->rtgFastProbe == TRUE &&
+        rtgIdrAddrGet (pDev, pDrvCtrl->rtgAddr) == TRUE)
+        goto probed;
+
+    /*
+     * Determine EEPROM size. The signature only needs to be
+     * read again if the first attempt didn't find it.
+     */
+
+    pDrvCtrl->rtgEeWidth = 6;
+    rtgEepromRead (pDev, (UINT8 *)&devId, 0, 1);
+    if (devId != htole16(RTG_EE_SIGNATURE))
+        {
+        pDrvCtrl->rtgEeWidth = 8;
+        rtgEepromRead (pDev, (UINT8 *)&devId, 0, 1);
+        }
+
+    /*
+     * If this is an RTL8168DP, then there is no attached
+     * EEPROM: the MAC is directly programmed into the MAC
+     * by setting fuse bits. If reading the EEPROM fails
+     * completely, then just recover the MAC address from
+     * the RX filter registers.
+     */
+
+    if (devId != htole16(RTG_EE_SIGNATURE))
+        (void) rtgIdrAddrGet (pDev, pDrvCtrl->rtgAddr);
+    else
+        rtgEepromRead (pDev, pDrvCtrl->rtgAddr, RTG_EE_EADDR, 3);
+
+probed:
+
+    RTG_TS_GET(now);
+    pDrvCtrl->rtgProbeUsecs = (UINT32)rtgTsToUsecs (now - start);
+
+    RTG_LOGMSG("%s%d: station address read in %d us\n", RTG_NAME,
+        pDev->unitNumber, pDrvCtrl->rtgProbeUsecs, 0, 0, 0);
+
+    /* Create our MII bus. */
+
+    miiBusCreate (pDev, &pDrvCtrl->rtgMiiBus);
+    miiBusMediaListGet (pDrvCtrl->rtgMiiBus, &pDrvCtrl->rtgMediaList);
+    miiBusModeSet (pDrvCtrl->rtgMiiBus,
+         pDrvCtrl->rtgMediaList->endMediaListDefault);
+
+    return;
+    }
+
+/*****************************************************************************
+*
+* rtgIdrAddrGet - get the station address from the ID registers
+*
+* After a reset the chip loads the station address from the EEPROM
+* into the IDR0 to IDR5 registers by itself, and on parts without an
+* EEPROM it is set from fuses. This routine copies it from there into
+* <pAddr>, which avoids clocking the address out of the EEPROM a bit
+* at a time, and checks that it is a usable unicast address.
+*
+* RETURNS: TRUE if the address is valid, otherwise FALSE
+*
+* ERRNO: N/A
+*/
+
+LOCAL BOOL rtgIdrAddrGet
+    (
+    VXB_DEVICE_ID pDev,
+    UINT8 * pAddr
+    )
+    {
+    UINT32 addr[2];
+    int i;
+
+    addr[0] = le32toh(CSR_READ_4(pDev, RTG_IDR0));
+    addr[1] = le32toh(CSR_READ_4(pDev, RTG_IDR1));
+    bcopy ((char *)addr, (char *)pAddr, ETHER_ADDR_LEN);
+
+    /* Reject group addresses and the all-zeroes address. */
+
+    if (pAddr[0] & 0x01)
+        return (FALSE);
+
+    for (i = 0; i < ETHER_ADDR_LEN; i++)
+        {
+        if (pAddr[i] != 0)
+            return (TRUE);
+        }
+
+    return (FALSE);
+    }
+
 /*****************************************************************************
 *
 * rtgEeAddrSet - select a word in the EEPROM
@@ -1454,11 +2678,11 @@ LOCAL void rtgEeAddrSet
             CSR_SETBIT_1(pDev, RTG_EECMD, RTG_EECMD_DATAIN);
         else
             CSR_CLRBIT_1(pDev, RTG_EECMD, RTG_EECMD_DATAIN);
-        rtgDelay (100);
+        rtgDelay (RTG_EE_DELAY);
         CSR_SETBIT_1(pDev, RTG_EECMD, RTG_EECMD_CLK);
-        rtgDelay (100);
+        rtgDelay (RTG_EE_DELAY);
         CSR_CLRBIT_1(pDev, RTG_EECMD, RTG_EECMD_CLK);
-        rtgDelay (100);
+        rtgDelay (RTG_EE_DELAY);
         }
 
     return;
@@ -1493,11 +2717,11 @@ LOCAL void rtgEeWordGet
     for (i = 0x8000; i; i >>= 1)
         {
         CSR_SETBIT_1(pDev, RTG_EECMD, RTG_EECMD_CLK);
-        rtgDelay (100);
+        rtgDelay (RTG_EE_DELAY);
         if (CSR_READ_1(pDev, RTG_EECMD) & RTG_EECMD_DATAOUT)
             word |= (UINT16)i;
         CSR_CLRBIT_1(pDev, RTG_EECMD, RTG_EECMD_CLK);
-        rtgDelay (100);
+        rtgDelay (RTG_EE_DELAY);
         }
 
     *dest = word;
@@ -1532,12 +2756,12 @@ LOCAL void rtgEepromRead
 
     CSR_SETBIT_1(pDev, RTG_EECMD, RTG_EEMODE_PROGRAM);
 
-    rtgDelay(100);
+    rtgDelay(RTG_EE_DELAY);
 
     for (i = 0; i < cnt; i++)
         {
         CSR_SETBIT_1(pDev, RTG_EECMD, RTG_EECMD_SEL);
-        rtgDelay(100);
+        rtgDelay(RTG_EE_DELAY);
         rtgEeWordGet (pDev, off + i, &word);
         CSR_CLRBIT_1(pDev, RTG_EECMD, RTG_EECMD_SEL);
         ptr = (UINT16 *)(dest + (i * 2));
@@ -1637,6 +2861,7 @@ LOCAL END_OBJ * rtgEndLoad
     RTG_DRV_CTRL *pDrvCtrl;
     VXB_DEVICE_ID pDev;
     int r;
+    int nTuples;
 
     /* Make the MUX happy. */
 
@@ -1652,6 +2877,12 @@ LOCAL END_OBJ * rtgEndLoad
     pDev = pArg;
     pDrvCtrl = pDev->pDrvCtrl;
 
+    /* Don't load an instance which couldn't be set up. */
+
+    if (pDrvCtrl->rtgStats == NULL || pDrvCtrl->rtgTxBnc == NULL ||
+        pDrvCtrl->rtgRxBuf == NULL)
+        return (NULL);
+
     if (END_OBJ_INIT (&pDrvCtrl->rtgEndObj, NULL, pDev->pName,
         pDev->unitNumber, &rtgNetFuncs, "RealTek 10/100/1000 Driver") == ERROR)
         {
@@ -1664,12 +2895,15 @@ LOCAL END_OBJ * rtgEndLoad
         pDrvCtrl->rtgAddr, ETHER_ADDR_LEN, ETHERMTU, 100000000,
         IFF_NOTRAILERS | IFF_SIMPLEX | IFF_MULTICAST | IFF_BROADCAST);
 
-    /* Allocate a buffer pool */
+    /* Allocate a buffer pool, sized to keep both rings stocked */
 
-    if (pDrvCtrl->rtgMaxMtu == RTG_JUMBO_MTU)
-        r = endPoolJumboCreate (512, &pDrvCtrl->rtgEndObj.pNetPool);
+    nTuples = RTG_POOL_SIZE(pDrvCtrl->rtgRxDescCnt, pDrvCtrl->rtgTxDescCnt);
+
+    if (pDrvCtrl->rtgMaxMtu == RTG_JUMBO_MTU &&
+        pDrvCtrl->rtgRxScatter == FALSE)
+        r = endPoolJumboCreate (nTuples, &pDrvCtrl->rtgEndObj.pNetPool);
     else
-        r = endPoolCreate (512, &pDrvCtrl->rtgEndObj.pNetPool);
+        r = endPoolCreate (nTuples, &pDrvCtrl->rtgEndObj.pNetPool);
 
     if (r == ERROR)
         {
@@ -1680,6 +2914,18 @@ LOCAL END_OBJ * rtgEndLoad
 
     pDrvCtrl->rtgPollBuf = endPoolTupleGet (pDrvCtrl->rtgEndObj.pNetPool);
 
+    /*
+     * Allocate the copybreak pool. If this fails, we just run
+     * without copybreak.
+     */
+
+    if (pDrvCtrl->rtgRxCopybreak != 0 && rtgCbPoolCreate (pDrvCtrl) != OK)
+        {
+        RTG_LOGMSG("%s%d: copybreak pool creation failed\n", RTG_NAME,
+            pDev->unitNumber, 0, 0, 0, 0);
+        pDrvCtrl->rtgRxCopybreak = 0;
+        }
+
     /* Set up polling stats. */
 
     pDrvCtrl->rtgEndStatsConf.ifPollInterval = sysClkRateGet();
@@ -1711,6 +2957,26 @@ LOCAL END_OBJ * rtgEndLoad
         pDrvCtrl->rtgCaps.cap_enabled |= IFCAP_JUMBO_MTU;
         }
 
+    /*
+     * The V2 descriptor chips can also offload TCP and UDP
+     * checksums for IPv6.
+     */
+
+    if (pDrvCtrl->rtgDescV2 == TRUE)
+        {
+        pDrvCtrl->rtgCaps.csum_flags_tx |= CSUM_TCPv6|CSUM_UDPv6;
+        pDrvCtrl->rtgCaps.csum_flags_rx |= CSUM_TCPv6|CSUM_UDPv6;
+        pDrvCtrl->rtgCaps.cap_available |= IFCAP_IPV6CSUM;
+        pDrvCtrl->rtgCaps.cap_enabled |= IFCAP_IPV6CSUM;
+        }
+
+    if (pDrvCtrl->rtgTsoMode != RTG_TSO_OFF)
+        {
+        pDrvCtrl->rtgCaps.csum_flags_tx |= CSUM_TSO;
+        pDrvCtrl->rtgCaps.cap_available |= IFCAP_TSO4;
+        pDrvCtrl->rtgCaps.cap_enabled |= IFCAP_TSO4;
+        }
+
     return (&pDrvCtrl->rtgEndObj);
     }
 
@@ -1749,6 +3015,7 @@ LOCAL STATUS rtgEndUnload
 
     /* Relase our buffer pool */
     endPoolDestroy (pDrvCtrl->rtgEndObj.pNetPool);
+    rtgCbPoolDestroy (pDrvCtrl);
 
     /* terminate stats polling */
     wdDelete (pDrvCtrl->rtgEndStatsConf.ifWatchdog);
@@ -1762,63 +3029,37 @@ LOCAL STATUS rtgEndUnload
 
 /*****************************************************************************
 *
-* rtgEndHashTblPopulate - populate the multicast hash filter
+* rtgEndHashTblWrite - write the multicast hash filter registers
 *
-* This function programs the RealTek controller's multicast hash
-* filter to receive frames sent to the multicast groups specified
-* in the multicast address list attached to the END object. If
-* the interface is in IFF_ALLMULTI mode, the filter will be
-* programmed to receive all multicast packets by setting all the
-* bits in the hash table to one.
+* This function loads the MAR0/MAR1 registers from the hash bits kept
+* in the driver control structure. If the interface is in IFF_ALLMULTI
+* mode, all the bits in the filter are set instead.
 *
 * RETURNS: N/A
 *
 * ERRNO: N/A
 */
 
-LOCAL void rtgEndHashTblPopulate
+LOCAL void rtgEndHashTblWrite
     (
     RTG_DRV_CTRL * pDrvCtrl
     )
     {
-    UINT32 crcVal;
-    UINT32 hashes[2] = { 0, 0 };
-    ETHER_MULTI * mCastNode = NULL;
-
-    CSR_SETBIT_4(pDrvCtrl->rtgDev, RTG_RXCFG, RTG_RXCFG_RX_MULTI);
+    UINT32 hashes[2];
 
     if (pDrvCtrl->rtgEndObj.flags & IFF_ALLMULTI)
         {
-        CSR_WRITE_4(pDrvCtrl->rtgDev, RTG_MAR0, 0xFFFFFFFF);
-        CSR_WRITE_4(pDrvCtrl->rtgDev, RTG_MAR1, 0xFFFFFFFF);
-        return;
+        hashes[0] = 0xFFFFFFFF;
+        hashes[1] = 0xFFFFFFFF;
         }
-
-    /* First, clear out the original filter. */
-
-    CSR_WRITE_4(pDrvCtrl->rtgDev, RTG_MAR0, 0);
-    CSR_WRITE_4(pDrvCtrl->rtgDev, RTG_MAR1, 0);
-
-    /* Now repopulate it. */
-
-    for (mCastNode =
-        (ETHER_MULTI *) lstFirst (&pDrvCtrl->rtgEndObj.multiList);
-         mCastNode != NULL;
-         mCastNode = (ETHER_MULTI *) lstNext (&mCastNode->node))
+    else
         {
-        /* get the CRC for the current address in the list */
-
-        crcVal = endEtherCrc32BeGet ((const UINT8 *) mCastNode->addr,
-            ETHER_ADDR_LEN) >> 26;
-
-        /* get the value to be written to the proper hash register */
-
-        if (crcVal < 32)
-            hashes[0] |= (1 << crcVal);
-        else
-            hashes[1] |= (1 << (crcVal - 32));
+        hashes[0] = pDrvCtrl->rtgMcastHash[0];
+        hashes[1] = pDrvCtrl->rtgMcastHash[1];
         }
 
+    pDrvCtrl->rtgMcastWrites++;
+
     /*
      * For some unfathomable reason, RealTek decided to reverse
      * the order of the multicast hash registers in the PCI Express
@@ -1854,12 +3095,105 @@ LOCAL void rtgEndHashTblPopulate
     return;
     }
 
+/*****************************************************************************
+*
+* rtgEndHashTblPopulate - populate the multicast hash filter
+*
+* This function rebuilds the multicast hash bucket reference counts
+* from the multicast address list attached to the END object, and
+* then programs the RealTek controller's multicast hash filter to
+* match. It is used when the receive filter is (re)initialized; joins
+* and leaves in between are handled by rtgEndHashTblUpdate().
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgEndHashTblPopulate
+    (
+    RTG_DRV_CTRL * pDrvCtrl
+    )
+    {
+    UINT32 crcVal;
+    ETHER_MULTI * mCastNode = NULL;
+
+    CSR_SETBIT_4(pDrvCtrl->rtgDev, RTG_RXCFG, RTG_RXCFG_RX_MULTI);
+
+    bzero ((char *)pDrvCtrl->rtgMcastRef, sizeof(pDrvCtrl->rtgMcastRef));
+    pDrvCtrl->rtgMcastHash[0] = 0;
+    pDrvCtrl->rtgMcastHash[1] = 0;
+
+    for (mCastNode =
+        (ETHER_MULTI *) lstFirst (&pDrvCtrl->rtgEndObj.multiList);
+         mCastNode != NULL;
+         mCastNode = (ETHER_MULTI *) lstNext (&mCastNode->node))
+        {
+        crcVal = RTG_MCAST_BUCKET(mCastNode->addr);
+        pDrvCtrl->rtgMcastRef[crcVal]++;
+        pDrvCtrl->rtgMcastHash[crcVal >> 5] |= (1 << (crcVal & 31));
+        }
+
+    rtgEndHashTblWrite (pDrvCtrl);
+
+    return;
+    }
+
+/*****************************************************************************
+*
+* rtgEndHashTblUpdate - account for one multicast join or leave
+*
+* This function adjusts the reference count of the hash bucket that
+* <pAddr> falls into. The MAR registers are only rewritten when the
+* bucket goes from unused to used or back, so joining or leaving a
+* group that shares a bucket with another one costs no register
+* accesses at all. While the interface is in IFF_ALLMULTI mode the
+* counts are still maintained but the filter is left wide open.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgEndHashTblUpdate
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    char * pAddr,
+    BOOL add
+    )
+    {
+    UINT32 crcVal;
+    UINT32 bit;
+
+    crcVal = RTG_MCAST_BUCKET(pAddr);
+    bit = 1 << (crcVal & 31);
+
+    if (add == TRUE)
+        {
+        if (pDrvCtrl->rtgMcastRef[crcVal]++ != 0)
+            return;
+        pDrvCtrl->rtgMcastHash[crcVal >> 5] |= bit;
+        }
+    else
+        {
+        if (pDrvCtrl->rtgMcastRef[crcVal] == 0 ||
+            --pDrvCtrl->rtgMcastRef[crcVal] != 0)
+            return;
+        pDrvCtrl->rtgMcastHash[crcVal >> 5] &= ~bit;
+        }
+
+    if (!(pDrvCtrl->rtgEndObj.flags & IFF_ALLMULTI))
+        rtgEndHashTblWrite (pDrvCtrl);
+
+    return;
+    }
+
 /*****************************************************************************
 *
 * rtgEndMCastAddrAdd - add a multicast address for the device
 *
 * This routine adds a multicast address to whatever the driver
-* is already listening for.  It then resets the address filter.
+* is already listening for.  It then updates the address filter.
 *
 * RETURNS: OK or ERROR.
 *
@@ -1890,7 +3224,7 @@ LOCAL STATUS rtgEndMCastAddrAdd
     if (retVal == ENETRESET)
         {
         pEnd->nMulti++;
-        rtgEndHashTblPopulate ((RTG_DRV_CTRL *)pEnd);
+        rtgEndHashTblUpdate (pDrvCtrl, pAddr, TRUE);
         }
 
     semGive (pDrvCtrl->rtgDevSem);
@@ -1902,7 +3236,7 @@ LOCAL STATUS rtgEndMCastAddrAdd
 * rtgEndMCastAddrDel - delete a multicast address for the device
 *
 * This routine removes a multicast address from whatever the driver
-* is listening for.  It then resets the address filter.
+* is listening for.  It then updates the address filter.
 *
 * RETURNS: OK or ERROR.
 *
@@ -1933,7 +3267,7 @@ LOCAL STATUS rtgEndMCastAddrDel
     if (retVal == ENETRESET)
         {
         pEnd->nMulti--;
-        rtgEndHashTblPopulate ((RTG_DRV_CTRL *)pEnd);
+        rtgEndHashTblUpdate (pDrvCtrl, pAddr, FALSE);
         }
 
     semGive (pDrvCtrl->rtgDevSem);
@@ -2003,99 +3337,288 @@ LOCAL STATUS rtgEndStatsDump
     )
     {
     END_IFCOUNTERS *    pEndStatsCounters;
+    RTG_STATS64 stats;
+    RTG_COUNTERS * pRx, * pRxLast;
+    RTG_COUNTERS * pTx, * pTxLast;
+    RTG_TALLY64 * pTally, * pTallyLast;
 
     pEndStatsCounters = &pDrvCtrl->rtgEndStatsCounters;
 
-    pEndStatsCounters->ifInOctets = pDrvCtrl->rtgInOctets;
-    pDrvCtrl->rtgInOctets = 0;
-
-    pEndStatsCounters->ifInUcastPkts = pDrvCtrl->rtgInUcasts;
-    pDrvCtrl->rtgInUcasts = 0;
-
-    pEndStatsCounters->ifInMulticastPkts = pDrvCtrl->rtgInMcasts;
-    pDrvCtrl->rtgInMcasts = 0;
-
-    pEndStatsCounters->ifInBroadcastPkts = pDrvCtrl->rtgInBcasts;
-    pDrvCtrl->rtgInBcasts = 0;
-
-    pEndStatsCounters->ifInErrors = pDrvCtrl->rtgInErrors;
-    pDrvCtrl->rtgInErrors = 0;
-
-    pEndStatsCounters->ifInDiscards = pDrvCtrl->rtgInDiscards;
-    pDrvCtrl->rtgInDiscards = 0;
-
-    pEndStatsCounters->ifOutOctets = pDrvCtrl->rtgOutOctets;
-    pDrvCtrl->rtgOutOctets = 0;
-
-    pEndStatsCounters->ifOutUcastPkts = pDrvCtrl->rtgOutUcasts;
-    pDrvCtrl->rtgOutUcasts = 0;
+    /*
+     * The counters are never reset; report what has been
+     * counted since the last poll.
+     */
 
-    pEndStatsCounters->ifOutMulticastPkts = pDrvCtrl->rtgOutMcasts;
-    pDrvCtrl->rtgOutMcasts = 0;
+    rtgEndStatsRead (pDrvCtrl, &stats);
+
+    pRx = &stats.rtgStatsRx;
+    pTx = &stats.rtgStatsTx;
+    pRxLast = &pDrvCtrl->rtgStatsLast.rtgStatsRx;
+    pTxLast = &pDrvCtrl->rtgStatsLast.rtgStatsTx;
+
+    pEndStatsCounters->ifInOctets = pRx->rtgCntOctets - pRxLast->rtgCntOctets;
+    pEndStatsCounters->ifInUcastPkts =
+        pRx->rtgCntUcasts - pRxLast->rtgCntUcasts;
+    pEndStatsCounters->ifInMulticastPkts =
+        pRx->rtgCntMcasts - pRxLast->rtgCntMcasts;
+    pEndStatsCounters->ifInBroadcastPkts =
+        pRx->rtgCntBcasts - pRxLast->rtgCntBcasts;
+    pEndStatsCounters->ifInErrors = pRx->rtgCntErrors - pRxLast->rtgCntErrors;
+    pEndStatsCounters->ifInDiscards =
+        pRx->rtgCntDiscards - pRxLast->rtgCntDiscards;
+
+    pEndStatsCounters->ifOutOctets = pTx->rtgCntOctets - pTxLast->rtgCntOctets;
+    pEndStatsCounters->ifOutUcastPkts =
+        pTx->rtgCntUcasts - pTxLast->rtgCntUcasts;
+    pEndStatsCounters->ifOutMulticastPkts =
+        pTx->rtgCntMcasts - pTxLast->rtgCntMcasts;
+    pEndStatsCounters->ifOutBroadcastPkts =
+        pTx->rtgCntBcasts - pTxLast->rtgCntBcasts;
+    pEndStatsCounters->ifOutErrors = pTx->rtgCntErrors - pTxLast->rtgCntErrors;
+
+    pDrvCtrl->rtgStatsLast = stats;
 
-    pEndStatsCounters->ifOutBroadcastPkts = pDrvCtrl->rtgOutBcasts;
-    pDrvCtrl->rtgOutBcasts = 0;
+    /*
+     * With hardware statistics, the RX packet counts come from
+     * the tally counters, and the chip's error and miss counts
+     * are added to those counted in software.
+     */
 
-    pEndStatsCounters->ifOutErrors = pDrvCtrl->rtgOutErrors;
-    pDrvCtrl->rtgOutErrors = 0;
+    if (pDrvCtrl->rtgHwStats == TRUE)
+        {
+        rtgTallyCollect (pDrvCtrl);
+
+        pTally = &pDrvCtrl->rtgTally;
+        pTallyLast = &pDrvCtrl->rtgTallyLast;
+
+        pEndStatsCounters->ifInUcastPkts =
+            pTally->rtgTlyRxUcasts - pTallyLast->rtgTlyRxUcasts;
+        pEndStatsCounters->ifInMulticastPkts =
+            pTally->rtgTlyRxMcasts - pTallyLast->rtgTlyRxMcasts;
+        pEndStatsCounters->ifInBroadcastPkts =
+            pTally->rtgTlyRxBcasts - pTallyLast->rtgTlyRxBcasts;
+        pEndStatsCounters->ifInErrors +=
+            (pTally->rtgTlyRxErrs - pTallyLast->rtgTlyRxErrs) +
+            (pTally->rtgTlyAlignErrs - pTallyLast->rtgTlyAlignErrs);
+        pEndStatsCounters->ifInDiscards +=
+            (pTally->rtgTlyMissed - pTallyLast->rtgTlyMissed) +
+            (pTally->rtgTlyRxFifoOflows - pTallyLast->rtgTlyRxFifoOflows);
+        pEndStatsCounters->ifOutErrors +=
+            pTally->rtgTlyTxErrs - pTallyLast->rtgTlyTxErrs;
+
+        pDrvCtrl->rtgTallyLast = *pTally;
+        }
 
     return (OK);
     }
 
 /*****************************************************************************
 *
-* rtgEndIoctl - the driver I/O control routine
+* rtgTallyCollect - collect the hardware tally counters
 *
-* This function processes ioctl requests supplied via the muxIoctl()
-* routine. In addition to the normal boilerplate END ioctls, this
-* driver supports the IFMEDIA ioctls, END capabilities ioctls, and
-* polled stats ioctls.
+* This routine is called on each stats poll. If a tally dump started by
+* the previous call has completed, the chip's counters are read from the
+* DMA buffer and the amount each has advanced since the dump before that
+* is added to the 64-bit totals, which takes care of the narrower
+* counters wrapping. A new dump is then started, so the poll never has
+* to wait for the chip. The first dump after the chip is started only
+* records the baseline values.
 *
-* RETURNS: A command specific response, usually OK or ERROR.
+* RETURNS: N/A
 *
 * ERRNO: N/A
 */
 
-LOCAL int rtgEndIoctl
+LOCAL void rtgTallyCollect
     (
-    END_OBJ * pEnd,
-    int cmd,
-    caddr_t data
+    RTG_DRV_CTRL * pDrvCtrl
     )
     {
-    RTG_DRV_CTRL * pDrvCtrl;
-    END_MEDIALIST * mediaList;
-    END_CAPABILITIES * hwCaps;
-    END_MEDIA * pMedia;
-    END_RCVJOBQ_INFO * qinfo;
-    UINT32 nQs;
     VXB_DEVICE_ID pDev;
-    INT32 value;
-    int error = OK;
+    RTG_STATS * pNew;
+    RTG_STATS * pOld;
+    RTG_TALLY64 * pTally;
+    UINT64 cur, prev;
 
-    pDrvCtrl = (RTG_DRV_CTRL *)pEnd;
     pDev = pDrvCtrl->rtgDev;
 
-    if (cmd != EIOCPOLLSTART && cmd != EIOCPOLLSTOP)
-        semTake (pDrvCtrl->rtgDevSem, WAIT_FOREVER);
+    if (pDrvCtrl->rtgHwStats == FALSE ||
+        !(pDrvCtrl->rtgEndObj.flags & IFF_UP))
+        return;
 
-    switch (cmd)
+    if (pDrvCtrl->rtgTallyBusy == TRUE)
         {
-        case EIOCSADDR:
-            if (data == NULL)
-                error = EINVAL;
-            else
-                {
-                bcopy ((char *)data, (char *)pDrvCtrl->rtgAddr,
-                    ETHER_ADDR_LEN);
-                bcopy ((char *)data,
-                    (char *)pEnd->mib2Tbl.ifPhysAddress.phyAddress,
-                    ETHER_ADDR_LEN);
-                if (pEnd->pMib2Tbl != NULL)
-                    bcopy ((char *)data,
-                        (char *)pEnd->pMib2Tbl->m2Data.mibIfTbl.ifPhysAddress.phyAddress,
-                        ETHER_ADDR_LEN);
-                }
+        if (CSR_READ_4(pDev, RTG_DUMPSTATS_LO) & RTG_DUMPSTATSLO_DUMP)
+            return;
+
+        pNew = pDrvCtrl->rtgTallyMem;
+        pOld = &pDrvCtrl->rtgTallyRaw;
+        pTally = &pDrvCtrl->rtgTally;
+
+        pTally->rtgTlyRxFifoOflows = pDrvCtrl->rtgRxFifoOflows;
+
+        if (pDrvCtrl->rtgTallyPrimed == TRUE)
+            {
+#define RTG_TALLY_64(total, lo, hi)					\
+            cur = ((UINT64)le32toh(pNew->hi) << 32) | le32toh(pNew->lo);	\
+            prev = ((UINT64)le32toh(pOld->hi) << 32) | le32toh(pOld->lo);	\
+            pTally->total += (cur >= prev) ? cur - prev : cur
+#define RTG_TALLY_32(total, f)						\
+            pTally->total += (UINT32)(le32toh(pNew->f) - le32toh(pOld->f))
+#define RTG_TALLY_16(total, f)						\
+            pTally->total += (UINT16)(le16toh(pNew->f) - le16toh(pOld->f))
+
+            RTG_TALLY_64(rtgTlyTxPkts, rtg_tx_pkts_lo, rtg_tx_pkts_hi);
+            RTG_TALLY_64(rtgTlyRxPkts, rtg_rx_pkts_lo, rtg_rx_pkts_hi);
+            RTG_TALLY_64(rtgTlyTxErrs, rtg_tx_errs_lo, rtg_tx_errs_hi);
+            RTG_TALLY_32(rtgTlyRxErrs, rtg_rx_errs);
+            RTG_TALLY_16(rtgTlyMissed, rtg_missed_pkts);
+            RTG_TALLY_16(rtgTlyAlignErrs, rtg_rx_framealign_errs);
+            RTG_TALLY_32(rtgTlyTxOneColl, rtg_tx_onecoll);
+            RTG_TALLY_32(rtgTlyTxMultiColl, rtg_tx_multicolls);
+            RTG_TALLY_64(rtgTlyRxUcasts, rtg_rx_ucasts_lo, rtg_rx_ucasts_hi);
+            RTG_TALLY_64(rtgTlyRxBcasts, rtg_rx_bcasts_lo, rtg_rx_bcasts_hi);
+            RTG_TALLY_32(rtgTlyRxMcasts, rtg_rx_mcasts);
+            RTG_TALLY_16(rtgTlyTxAborts, rtg_tx_aborts);
+            RTG_TALLY_16(rtgTlyTxUnderruns, rtg_tx_underruns);
+
+#undef RTG_TALLY_64
+#undef RTG_TALLY_32
+#undef RTG_TALLY_16
+            }
+
+        bcopy ((char *)pNew, (char *)pOld, sizeof(RTG_STATS));
+        pDrvCtrl->rtgTallyPrimed = TRUE;
+        pDrvCtrl->rtgTallyBusy = FALSE;
+        }
+
+    /* Start the next dump. */
+
+    CSR_WRITE_4(pDev, RTG_DUMPSTSTS_HI,
+        RTG_ADDR_HI(pDrvCtrl->rtgTallyMap->fragList[0].frag));
+    CSR_WRITE_4(pDev, RTG_DUMPSTATS_LO,
+        RTG_ADDR_LO(pDrvCtrl->rtgTallyMap->fragList[0].frag) |
+        RTG_DUMPSTATSLO_DUMP);
+    pDrvCtrl->rtgTallyBusy = TRUE;
+
+    return;
+    }
+
+/*****************************************************************************
+*
+* rtgEndStatsRead - read the software statistics
+*
+* This routine copies the RX and TX counters into <pStats>. Each set is
+* copied under its sequence number, and the copy is retried if an update
+* was in progress or completed meanwhile. The counters themselves are
+* left untouched.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgEndStatsRead
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    RTG_STATS64 * pStats
+    )
+    {
+    RTG_COUNTERS * pCnt, * pSum;
+    UINT32 seq;
+    int dir;
+
+    for (dir = 0; dir < 2; dir++)
+        {
+        if (dir == 0)
+            {
+            pCnt = RTG_RX_COUNTERS(pDrvCtrl);
+            pSum = &pStats->rtgStatsRx;
+            }
+        else
+            {
+            pCnt = RTG_TX_COUNTERS(pDrvCtrl);
+            pSum = &pStats->rtgStatsTx;
+            }
+
+        do
+            {
+            seq = pCnt->rtgCntSeq;
+            VX_MEM_BARRIER_R();
+            *pSum = *pCnt;
+            VX_MEM_BARRIER_R();
+            } while ((seq & 1) || seq != pCnt->rtgCntSeq);
+
+        pSum->rtgCntSeq = 0;
+        }
+
+    return;
+    }
+
+/*****************************************************************************
+*
+* rtgEndIoctl - the driver I/O control routine
+*
+* This function processes ioctl requests supplied via the muxIoctl()
+* routine. In addition to the normal boilerplate END ioctls, this
+* driver supports the IFMEDIA ioctls, END capabilities ioctls,
+* polled stats ioctls, and the driver private EIOCGRTGINTRMOD,
+* EIOCSRTGRXBUDGET, EIOCGRTGRXSTATS, EIOCGRTGTXSTATS, EIOCGRTGSTATS64,
+* EIOCGRTGTALLY, EIOCGRTGLATENCY, EIOCSRTGTAP, EIOCGRTGTAP,
+* EIOCGRTGTAPREAD and EIOCGRTGLATHIST ioctls.
+*
+* RETURNS: A command specific response, usually OK or ERROR.
+*
+* ERRNO: N/A
+*/
+
+LOCAL int rtgEndIoctl
+    (
+    END_OBJ * pEnd,
+    int cmd,
+    caddr_t data
+    )
+    {
+    RTG_DRV_CTRL * pDrvCtrl;
+    END_MEDIALIST * mediaList;
+    END_CAPABILITIES * hwCaps;
+    END_MEDIA * pMedia;
+    END_RCVJOBQ_INFO * qinfo;
+    RTG_INTRMOD_INFO * pModInfo;
+    RTG_RXPASS_STATS * pRxStats;
+    RTG_TX_STATS * pTxStats;
+    RTG_LATENCY * pLat;
+    RTG_TAP_INFO * pTapInfo;
+    RTG_TAP_READ * pTapRead;
+    RTG_TAP * pTap;
+    UINT32 nQs;
+    VXB_DEVICE_ID pDev;
+    INT32 value;
+    int error = OK;
+
+    pDrvCtrl = (RTG_DRV_CTRL *)pEnd;
+    pDev = pDrvCtrl->rtgDev;
+
+    if (cmd != EIOCPOLLSTART && cmd != EIOCPOLLSTOP)
+        semTake (pDrvCtrl->rtgDevSem, WAIT_FOREVER);
+
+    switch (cmd)
+        {
+        case EIOCSADDR:
+            if (data == NULL)
+                error = EINVAL;
+            else
+                {
+                bcopy ((char *)data, (char *)pDrvCtrl->rtgAddr,
+                    ETHER_ADDR_LEN);
+                bcopy ((char *)data,
+                    (char *)pEnd->mib2Tbl.ifPhysAddress.phyAddress,
+                    ETHER_ADDR_LEN);
+                if (pEnd->pMib2Tbl != NULL)
+                    bcopy ((char *)data,
+                        (char *)pEnd->pMib2Tbl->m2Data.mibIfTbl.ifPhysAddress.phyAddress,
+                        ETHER_ADDR_LEN);
+                }
             rtgEndRxConfig (pDrvCtrl);
             break;
 
@@ -2144,10 +3667,34 @@ LOCAL int rtgEndIoctl
 
         case EIOCPOLLSTART:
             pDrvCtrl->rtgIntMask = CSR_READ_2(pDev, RTG_IMR);
+
+            /*
+             * The busy-poll task stops polling in polled mode,
+             * so it must be woken by interrupts afterwards.
+             */
+
+            if (pDrvCtrl->rtgBusyPoll == TRUE)
+                pDrvCtrl->rtgIntMask |= pDrvCtrl->rtgIntrMask & RTG_RXINTRS;
             CSR_WRITE_2(pDev, RTG_IMR, 0);
             CSR_WRITE_2(pDev, RTG_ISR, RTG_INTRS);
             pDrvCtrl->rtgPolling = TRUE;
 
+            /*
+             * Wait for the busy-poll task to leave the RX ring, so
+             * that it can't race with rtgEndPollReceive(). At
+             * interrupt level (system mode debugging) no task runs
+             * until polled mode ends, so there is nothing to wait
+             * for, and we mustn't block anyway.
+             */
+
+            if (pDrvCtrl->rtgBusyPoll == TRUE &&
+                pEnd->flags & IFF_UP && intContext () == FALSE)
+                {
+                pDrvCtrl->rtgBusyPark = TRUE;
+                semGive (pDrvCtrl->rtgBusySem);
+                semTake (pDrvCtrl->rtgBusyDone, WAIT_FOREVER);
+                }
+
             /*
              * We may have been asked to enter polled mode while
              * there are transmissions pending. This is a problem,
@@ -2182,6 +3729,11 @@ LOCAL int rtgEndIoctl
                     endPoolTupleFree (pMblk);
                     pDrvCtrl->rtgTxMblk[pDrvCtrl->rtgTxCons] = NULL;
                     }
+                else if (pDrvCtrl->rtgTxBnc[pDrvCtrl->rtgTxCons] == TRUE)
+                    {
+                    pDrvCtrl->rtgTxBnc[pDrvCtrl->rtgTxCons] = FALSE;
+                    pDrvCtrl->rtgBncFree++;
+                    }
 
                 pDesc->rtg_cmdsts &= htole32(RTG_TDESC_CMD_EOR);
                 pDesc->rtg_vlanctl = 0;
@@ -2286,7 +3838,26 @@ LOCAL int rtgEndIoctl
                 error = EINVAL;
                 break;
                 }
-            pDrvCtrl->rtgCaps.cap_enabled = hwCaps->cap_enabled;
+            pDrvCtrl->rtgCaps.cap_enabled = hwCaps->cap_enabled &
+                pDrvCtrl->rtgCaps.cap_available;
+
+            /* Only offer large sends to the stack while TSO is on. */
+
+            if (pDrvCtrl->rtgCaps.cap_enabled & IFCAP_TSO4)
+                pDrvCtrl->rtgCaps.csum_flags_tx |= CSUM_TSO;
+            else
+                pDrvCtrl->rtgCaps.csum_flags_tx &= ~CSUM_TSO;
+
+            if (pDrvCtrl->rtgCaps.cap_enabled & IFCAP_IPV6CSUM)
+                {
+                pDrvCtrl->rtgCaps.csum_flags_tx |= CSUM_TCPv6|CSUM_UDPv6;
+                pDrvCtrl->rtgCaps.csum_flags_rx |= CSUM_TCPv6|CSUM_UDPv6;
+                }
+            else
+                {
+                pDrvCtrl->rtgCaps.csum_flags_tx &= ~(CSUM_TCPv6|CSUM_UDPv6);
+                pDrvCtrl->rtgCaps.csum_flags_rx &= ~(CSUM_TCPv6|CSUM_UDPv6);
+                }
             break;
 
         case EIOCGIFMTU:
@@ -2317,13 +3888,212 @@ LOCAL int rtgEndIoctl
 
 	    qinfo = (END_RCVJOBQ_INFO *)data;
 	    nQs = qinfo->numRcvJobQs;
-	    qinfo->numRcvJobQs = 1;
-	    if (nQs < 1)
+	    qinfo->numRcvJobQs = pDrvCtrl->rtgRssCnt;
+	    if (nQs < (UINT32)pDrvCtrl->rtgRssCnt)
 		error = ENOSPC;
 	    else
+		{
 		qinfo->qIds[0] = pDrvCtrl->rtgJobQueue;
+		for (value = 1; value < pDrvCtrl->rtgRssCnt; value++)
+		    qinfo->qIds[value] = pDrvCtrl->rtgRss[value].rtgRssQueue;
+		}
 	    break;
 
+        case EIOCGRTGINTRMOD:
+            if (data == NULL)
+                {
+                error = EINVAL;
+                break;
+                }
+
+            pModInfo = (RTG_INTRMOD_INFO *)data;
+            pModInfo->rtgModMode = pDrvCtrl->rtgIntrModMode;
+            pModInfo->rtgModUsecs = pDrvCtrl->rtgIntrModUsecs;
+            pModInfo->rtgModFrames = pDrvCtrl->rtgIntrModFrames;
+            pModInfo->rtgModCurUsecs = pDrvCtrl->rtgIntrModCur;
+            pModInfo->rtgModPpi = pDrvCtrl->rtgIntrModPpi;
+            pModInfo->rtgModIntrs = pDrvCtrl->rtgIntrModIntrs;
+            pModInfo->rtgModTimerIntrs = pDrvCtrl->rtgIntrModTimerIntrs;
+            break;
+
+        case EIOCSRTGRXBUDGET:
+            value = (INT32)((ULONG)data & 0xffffffff);
+            if (value <= 0)
+                error = EINVAL;
+            else
+                pDrvCtrl->rtgRxBudget = value;
+            break;
+
+        case EIOCGRTGRXSTATS:
+            if (data == NULL)
+                {
+                error = EINVAL;
+                break;
+                }
+
+            pRxStats = (RTG_RXPASS_STATS *)data;
+            pRxStats->rtgRxBudget = pDrvCtrl->rtgRxBudget;
+            pRxStats->rtgRxWeight = pDrvCtrl->rtgRxWeight;
+            pRxStats->rtgRxFair = (pDrvCtrl->rtgRxGroup != NULL);
+            pRxStats->rtgRxPasses = pDrvCtrl->rtgRxPasses;
+            pRxStats->rtgRxPassFrames = pDrvCtrl->rtgRxPassFrames;
+            pRxStats->rtgRxBudgetHits = pDrvCtrl->rtgRxBudgetHits;
+            pRxStats->rtgRxPassMax = pDrvCtrl->rtgRxPassMax;
+            pRxStats->rtgRxCopybreak = pDrvCtrl->rtgRxCopybreak;
+            pRxStats->rtgRxCopies = pDrvCtrl->rtgRxCopies;
+            pRxStats->rtgRxRecycleCnt = pDrvCtrl->rtgRbCnt;
+            pRxStats->rtgRxRecycleHits = pDrvCtrl->rtgRbHits;
+            pRxStats->rtgRxRecycleMisses = pDrvCtrl->rtgRbMisses;
+            pRxStats->rtgRxBatch = pDrvCtrl->rtgRxBatch;
+            pRxStats->rtgRxUpcalls = pDrvCtrl->rtgRxUpcalls;
+            pRxStats->rtgRxScatter = pDrvCtrl->rtgRxScatter;
+            pRxStats->rtgRxChains = pDrvCtrl->rtgRxChains;
+            pRxStats->rtgRxChainErrs = pDrvCtrl->rtgRxChainErrs;
+            pRxStats->rtgRxMcastWrites = pDrvCtrl->rtgMcastWrites;
+            pRxStats->rtgRxRssQueues = pDrvCtrl->rtgRssCnt;
+            for (value = 0; value < RTG_RSS_MAX; value++)
+                pRxStats->rtgRxRssFrames[value] =
+                    pDrvCtrl->rtgRss[value].rtgRssFrames;
+            break;
+
+        case EIOCGRTGTXSTATS:
+            if (data == NULL)
+                {
+                error = EINVAL;
+                break;
+                }
+
+            pTxStats = (RTG_TX_STATS *)data;
+            pTxStats->rtgTxPkts = pDrvCtrl->rtgTxPkts;
+            pTxStats->rtgTxDoorbells = pDrvCtrl->rtgTxDoorbells;
+            pTxStats->rtgTxBatches = pDrvCtrl->rtgTxBatches;
+            pTxStats->rtgTxBatchMax = pDrvCtrl->rtgTxBatchMax;
+            pTxStats->rtgTxReclaim = pDrvCtrl->rtgTxReclaim;
+            pTxStats->rtgTxReclaimThresh = pDrvCtrl->rtgTxReclaimThresh;
+            pTxStats->rtgTxReclaims = pDrvCtrl->rtgTxReclaims;
+            pTxStats->rtgTxReclaimTimers = pDrvCtrl->rtgTxReclaimTimers;
+            pTxStats->rtgTsoMode = pDrvCtrl->rtgTsoMode;
+            pTxStats->rtgTxTsoHw = pDrvCtrl->rtgTxTsoHw;
+            pTxStats->rtgTxTsoSw = pDrvCtrl->rtgTxTsoSw;
+            pTxStats->rtgTxTsoSegs = pDrvCtrl->rtgTxTsoSegs;
+            pTxStats->rtgTxCoalesce = pDrvCtrl->rtgTxCoalesce;
+            pTxStats->rtgTxBounced = pDrvCtrl->rtgTxBounced;
+            pTxStats->rtgTxBncMisses = pDrvCtrl->rtgTxBncMisses;
+            pTxStats->rtgTxBncCnt = pDrvCtrl->rtgBncCnt;
+            pTxStats->rtgTxHpCnt = pDrvCtrl->rtgHpDescCnt;
+            pTxStats->rtgTxHpPkts = pDrvCtrl->rtgTxHpPkts;
+            pTxStats->rtgTxHpMisses = pDrvCtrl->rtgTxHpMisses;
+            break;
+
+        case EIOCGRTGSTATS64:
+            if (data == NULL)
+                {
+                error = EINVAL;
+                break;
+                }
+
+            rtgEndStatsRead (pDrvCtrl, (RTG_STATS64 *)data);
+            break;
+
+        case EIOCGRTGTALLY:
+            if (data == NULL || pDrvCtrl->rtgHwStats == FALSE)
+                {
+                error = EINVAL;
+                break;
+                }
+
+            bcopy ((char *)&pDrvCtrl->rtgTally, (char *)data,
+                sizeof(RTG_TALLY64));
+            break;
+
+        case EIOCGRTGLATENCY:
+            if (data == NULL)
+                {
+                error = EINVAL;
+                break;
+                }
+
+            pLat = (RTG_LATENCY *)data;
+            pLat->rtgLatBusyPoll = pDrvCtrl->rtgBusyPoll;
+            pLat->rtgLatIntrCnt = pDrvCtrl->rtgLatIntrCnt;
+            pLat->rtgLatIntrUsecs = rtgTsToUsecs (pDrvCtrl->rtgLatIntrSum);
+            pLat->rtgLatIntrMax = rtgTsToUsecs (pDrvCtrl->rtgLatIntrMax);
+            pLat->rtgLatPollCnt = pDrvCtrl->rtgLatPollCnt;
+            pLat->rtgLatPollUsecs = rtgTsToUsecs (pDrvCtrl->rtgLatPollSum);
+            pLat->rtgLatPollMax = rtgTsToUsecs (pDrvCtrl->rtgLatPollMax);
+            pLat->rtgLatWakeups = pDrvCtrl->rtgBusyWakeups;
+            break;
+
+        case EIOCSRTGTAP:
+            if (data == NULL)
+                {
+                error = EINVAL;
+                break;
+                }
+
+            error = rtgTapConfig (pDrvCtrl, (RTG_TAP_CONF *)data);
+            break;
+
+        case EIOCGRTGTAP:
+            if (data == NULL)
+                {
+                error = EINVAL;
+                break;
+                }
+
+            pTapInfo = (RTG_TAP_INFO *)data;
+            bzero ((char *)pTapInfo, sizeof(RTG_TAP_INFO));
+            pTapInfo->rtgTapEnabled = (pDrvCtrl->rtgTap != NULL);
+            pTapInfo->rtgTapSlots = pDrvCtrl->rtgTapSlots;
+            pTap = pDrvCtrl->rtgTapMem;
+            if (pTap == NULL)
+                break;
+            for (value = RTG_TAP_RX; value <= RTG_TAP_TX; value++)
+                {
+                pTapInfo->rtgTapCaptured[value] =
+                    pTap->rtgTapRing[value].rtgTapCaptured;
+                pTapInfo->rtgTapFiltered[value] =
+                    pTap->rtgTapRing[value].rtgTapFiltered;
+                pTapInfo->rtgTapDrops[value] =
+                    pTap->rtgTapRing[value].rtgTapDrops;
+                }
+            break;
+
+        case EIOCGRTGTAPREAD:
+            pTapRead = (RTG_TAP_READ *)data;
+            pTap = pDrvCtrl->rtgTapMem;
+            if (pTapRead == NULL || pTapRead->rtgTapBuf == NULL ||
+                pTap == NULL)
+                {
+                error = EINVAL;
+                break;
+                }
+
+            semTake (pTap->rtgTapSem, WAIT_FOREVER);
+            for (pTapRead->rtgTapCnt = 0;
+                pTapRead->rtgTapCnt < pTapRead->rtgTapMax;
+                pTapRead->rtgTapCnt++)
+                {
+                if (rtgTapNext (pTap, &pTapRead->rtgTapBuf[
+                    pTapRead->rtgTapCnt]) == FALSE)
+                    break;
+                }
+            semGive (pTap->rtgTapSem);
+            break;
+
+        case EIOCGRTGLATHIST:
+            if (data == NULL)
+                {
+                error = EINVAL;
+                break;
+                }
+
+            bcopy ((char *)&pDrvCtrl->rtgHist, (char *)data,
+                sizeof(RTG_LAT_HIST));
+            ((RTG_LAT_HIST *)data)->rtgHistEnabled = pDrvCtrl->rtgHistOn;
+            ((RTG_LAT_HIST *)data)->rtgHistTsFreq = RTG_TS_FREQ();
+            break;
+
         default:
             error = EINVAL;
             break;
@@ -2412,7 +4182,9 @@ LOCAL void rtgEndRxConfig
 * to divert its work to an alternate processing task, such as may be
 * done with TIPC. This means that the jobQueue can be changed while
 * the system is running, but the device must be stopped and restarted
-* for the change to take effect.
+* for the change to take effect. If the intCpu parameter is set and the
+* job queue was given this way, the task servicing it is bound to that
+* CPU here as well.
 *
 * RETURNS: ERROR if device initialization failed, otherwise OK
 *
@@ -2428,9 +4200,11 @@ LOCAL STATUS rtgEndStart
     VXB_DEVICE_ID pDev;
     VXB_INST_PARAM_VALUE val;
     HEND_RX_QUEUE_PARAM * pRxQueue;
+    RTG_RSS_QUEUE * pRss;
     M_BLK_ID pMblk;
     RTG_DESC * pDesc;
     VXB_DMA_MAP_ID pMap;
+    char name[16];
     int i;
 
     pDrvCtrl = (RTG_DRV_CTRL *)pEnd;
@@ -2471,6 +4245,33 @@ LOCAL STATUS rtgEndStart
             pDrvCtrl->rtgJobQueue = pRxQueue->jobQueId;
         }
 
+    /*
+     * paramDesc {
+     * The rxQueue01 to rxQueue07 parameters specify
+     * further HEND_RX_QUEUE_PARAM structures. Received
+     * frames are spread by flow over the job queues
+     * they name, as well as the instance's own one.
+     * The first one not set ends the list. }
+     */
+    pDrvCtrl->rtgRssCnt = 1;
+    for (i = 1; i < RTG_RSS_MAX; i++)
+        {
+        sprintf (name, "rxQueue%02d", i);
+        if (vxbInstParamByNameGet (pDev, name,
+            VXB_PARAM_POINTER, &val) != OK)
+            break;
+        pRxQueue = (HEND_RX_QUEUE_PARAM *) val.pValue;
+        if (pRxQueue == NULL || pRxQueue->jobQueId == NULL)
+            break;
+
+        pRss = &pDrvCtrl->rtgRss[i];
+        pRss->rtgRssQueue = pRxQueue->jobQueId;
+        pRss->rtgRssDrvCtrl = pDrvCtrl;
+        QJOB_SET_PRI(&pRss->rtgRssJob, NET_TASK_QJOB_PRI);
+        pRss->rtgRssJob.func = rtgRssHandle;
+        pDrvCtrl->rtgRssCnt++;
+        }
+
     QJOB_SET_PRI(&pDrvCtrl->rtgTxJob, NET_TASK_QJOB_PRI);
     pDrvCtrl->rtgTxJob.func = rtgEndTxHandle;
     QJOB_SET_PRI(&pDrvCtrl->rtgRxJob, NET_TASK_QJOB_PRI);
@@ -2488,26 +4289,37 @@ LOCAL STATUS rtgEndStart
         sizeof(RTG_DESC) * pDrvCtrl->rtgTxDescCnt);
     bzero ((char *)pDrvCtrl->rtgTxMblk,
         sizeof(M_BLK_ID) * pDrvCtrl->rtgTxDescCnt);
+    bzero ((char *)pDrvCtrl->rtgTxBnc,
+        sizeof(BOOL) * pDrvCtrl->rtgTxDescCnt);
+    pDrvCtrl->rtgBncProd = 0;
+    pDrvCtrl->rtgBncFree = pDrvCtrl->rtgBncCnt;
 
     /* Set up the RX ring. */
 
     for (i = 0; i < pDrvCtrl->rtgRxDescCnt; i++)
         {
-        pMblk = endPoolTupleGet (pDrvCtrl->rtgEndObj.pNetPool);
-        if (pMblk == NULL)
+        pMblk = rtgRbGet (pDrvCtrl, &pDrvCtrl->rtgRxBuf[i]);
+        if (pMblk != NULL)
             {
-            END_TX_SEM_GIVE (pEnd);
-            semGive (pDrvCtrl->rtgDevSem);
-            return (ERROR);
+            pDrvCtrl->rtgRxMblk[i] = pMblk;
+            pMap = pDrvCtrl->rtgRxBuf[i]->rtgRbMap;
+            vxbDmaBufSync (pDev, pDrvCtrl->rtgMblkTag,
+                pMap, VXB_DMABUFSYNC_PREREAD);
+            goto armed;
             }
 
+        pMblk = endPoolTupleGet (pDrvCtrl->rtgEndObj.pNetPool);
+        if (pMblk == NULL)
+            goto rxFail;
+
         /*
          * Note: buffer length field in an RX descriptor is only 12
          * bits wide, so the maximum size of a single RX buffer is
          * limited to 8192 bytes.
          */
 
-        if (pDrvCtrl->rtgMaxMtu == RTG_JUMBO_MTU)
+        if (pDrvCtrl->rtgMaxMtu == RTG_JUMBO_MTU &&
+            pDrvCtrl->rtgRxScatter == FALSE)
             pMblk->m_len = pMblk->m_pkthdr.len = END_JUMBO_CLSIZE - 8;
 
         pMblk->m_next = NULL;
@@ -2521,6 +4333,7 @@ LOCAL STATUS rtgEndStart
         (void) vxbDmaBufMapMblkLoad (pDev, pDrvCtrl->rtgMblkTag, pMap, pMblk, 0);
 
         pMap->fragList[0].fragLen -= 8;
+armed:
 
         pDesc = &pDrvCtrl->rtgRxDescMem[i];
         pDesc->rtg_cmdsts = htole32(pMap->fragList[0].fragLen |
@@ -2533,6 +4346,30 @@ LOCAL STATUS rtgEndStart
 
         }
 
+    /* Start can't fail from here on. */
+
+    if (pDrvCtrl->rtgRxFair == TRUE)
+        rtgRxGroupJoin (pDrvCtrl);
+
+    /*
+     * Bind the job queue's task to the interrupt's CPU. Only a job
+     * queue given with rxQueue00 is bound: tNet0 serves the whole
+     * stack, and is left where the system puts it.
+     */
+
+    pDrvCtrl->rtgJobQueuePinned = FALSE;
+    if (pDrvCtrl->rtgIntCpu != -1)
+        {
+        if (pDrvCtrl->rtgJobQueue == netJobQueueId)
+            RTG_LOGMSG("%s%d: intCpu without rxQueue00, "
+                "job queue left unbound\n",
+                RTG_NAME, pDev->unitNumber, 0, 0, 0, 0);
+        else if (jobQueueStdPost (pDrvCtrl->rtgJobQueue, NET_TASK_QJOB_PRI,
+            (VOIDFUNCPTR)rtgJobQueuePin, (void *)(ULONG)pDev->unitNumber,
+            (void *)(ULONG)pDrvCtrl->rtgIntCpu, NULL, NULL, NULL) == OK)
+            pDrvCtrl->rtgJobQueuePinned = TRUE;
+        }
+
     vxbDmaBufMapLoad (pDev, pDrvCtrl->rtgRxDescTag,
         pDrvCtrl->rtgRxDescMap, pDrvCtrl->rtgRxDescMem,
             sizeof(RTG_DESC) * pDrvCtrl->rtgRxDescCnt, 0);
@@ -2541,6 +4378,22 @@ LOCAL STATUS rtgEndStart
         pDrvCtrl->rtgTxDescMap, pDrvCtrl->rtgTxDescMem,
             sizeof(RTG_DESC) * pDrvCtrl->rtgTxDescCnt, 0);
 
+    if (pDrvCtrl->rtgHpDescCnt != 0)
+        {
+        bzero ((char *)pDrvCtrl->rtgHpDescMem,
+            sizeof(RTG_DESC) * pDrvCtrl->rtgHpDescCnt);
+        vxbDmaBufMapLoad (pDev, pDrvCtrl->rtgHpDescTag,
+            pDrvCtrl->rtgHpDescMap, pDrvCtrl->rtgHpDescMem,
+                sizeof(RTG_DESC) * pDrvCtrl->rtgHpDescCnt, 0);
+        pDrvCtrl->rtgHpProd = 0;
+        pDrvCtrl->rtgHpCons = 0;
+        pDrvCtrl->rtgHpFree = pDrvCtrl->rtgHpDescCnt;
+        }
+
+    if (pDrvCtrl->rtgRxLineArm == TRUE)
+        vxbDmaBufSync (pDev, pDrvCtrl->rtgRxDescTag,
+            pDrvCtrl->rtgRxDescMap, VXB_DMABUFSYNC_PREWRITE);
+
     pDrvCtrl->rtgRxIdx = 0;
     pDrvCtrl->rtgTxCur = 0;
     pDrvCtrl->rtgTxLast = 0;
@@ -2583,6 +4436,15 @@ LOCAL STATUS rtgEndStart
     CSR_WRITE_4(pDev, RTG_TXRINGBASE0_LO,
         RTG_ADDR_LO(pDrvCtrl->rtgTxDescMap->fragList[0].frag));
 
+    if (pDrvCtrl->rtgHpDescCnt != 0)
+        {
+        CSR_WRITE_4(pDev, RTG_TXRINGBASE1_HI,
+            RTG_ADDR_HI(pDrvCtrl->rtgHpDescMap->fragList[0].frag));
+
+        CSR_WRITE_4(pDev, RTG_TXRINGBASE1_LO,
+            RTG_ADDR_LO(pDrvCtrl->rtgHpDescMap->fragList[0].frag));
+        }
+
     /* Enable receiver and transmitter. */
     CSR_WRITE_1(pDev, RTG_CMD, RTG_CMD_TX_ENABLE|RTG_CMD_RX_ENABLE);
 
@@ -2596,13 +4458,76 @@ LOCAL STATUS rtgEndStart
     /* Program the RX filter. */
     rtgEndRxConfig (pDrvCtrl);
 
+    /* The reset above may have cleared the tally counters. */
+
+    pDrvCtrl->rtgTallyBusy = FALSE;
+    pDrvCtrl->rtgTallyPrimed = FALSE;
+
+    /* Moderation starts out disengaged. */
+
+    pDrvCtrl->rtgIntrModCur = 0;
+    pDrvCtrl->rtgIntrModPpi = 0;
+    vxAtomic32Set (&pDrvCtrl->rtgIntrModPkts, 0);
+    CSR_WRITE_4(pDev, pDrvCtrl->rtgTimerIntReg, 0);
+
     /* Enable interrupts */
 
     CSR_WRITE_2(pDev, RTG_ISR, 0xFFFF);
-    pDrvCtrl->rtgIntrs = RTG_INTRS;
+    pDrvCtrl->rtgIntrs = pDrvCtrl->rtgIntrMask;
     CSR_WRITE_2(pDev, RTG_IMR, pDrvCtrl->rtgIntrs);
     vxbIntEnable (pDev, 0, rtgEndInt, pDrvCtrl);
 
+    /* Start the TX reclaim backstop timer. */
+
+    if (pDrvCtrl->rtgTxReclaim == TRUE)
+        {
+        pDrvCtrl->rtgTxReclaimTicks =
+            (pDrvCtrl->rtgTxReclaimMs * sysClkRateGet ()) / 1000;
+        if (pDrvCtrl->rtgTxReclaimTicks < 1)
+            pDrvCtrl->rtgTxReclaimTicks = 1;
+        pDrvCtrl->rtgTxReclaimRun = TRUE;
+        wdStart (pDrvCtrl->rtgTxReclaimWd, pDrvCtrl->rtgTxReclaimTicks,
+            (FUNCPTR)rtgEndTxReclaimTimer, (_Vx_usr_arg_t)pDrvCtrl);
+        }
+
+    /* Start the busy-poll task; the first RX interrupt wakes it. */
+
+    if (pDrvCtrl->rtgBusyPoll == TRUE)
+        {
+        char name[16];
+
+        pDrvCtrl->rtgBusyIdleTs = ((UINT64)pDrvCtrl->rtgBusyIdle *
+            RTG_TS_FREQ ()) / 1000000;
+        if (pDrvCtrl->rtgBusyIdleTs == 0)
+            pDrvCtrl->rtgBusyIdleTs = 1;
+        pDrvCtrl->rtgBusyExit = FALSE;
+        pDrvCtrl->rtgBusyPark = FALSE;
+        vxAtomic32Set (&pDrvCtrl->rtgBusyActive, FALSE);
+
+        sprintf (name, "tRtgPoll%d", pDev->unitNumber);
+        pDrvCtrl->rtgBusyTask = taskSpawn (name, pDrvCtrl->rtgBusyPri, 0,
+            RTG_BUSY_STACK, (FUNCPTR)rtgBusyPollTask,
+            (_Vx_usr_arg_t)pDrvCtrl, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+        if (pDrvCtrl->rtgBusyTask == TASK_ID_ERROR)
+            {
+            RTG_LOGMSG("%s%d: can't spawn busy-poll task\n",
+                RTG_NAME, pDev->unitNumber, 0, 0, 0, 0);
+            pDrvCtrl->rtgBusyPoll = FALSE;
+            }
+        else if (pDrvCtrl->rtgBusyCpu != -1)
+            {
+            cpuset_t cpus;
+
+            CPUSET_ZERO(cpus);
+            CPUSET_SET(cpus, pDrvCtrl->rtgBusyCpu);
+            if (taskCpuAffinitySet (pDrvCtrl->rtgBusyTask, cpus) != OK)
+                RTG_LOGMSG("%s%d: can't bind busy-poll task to CPU %d\n",
+                    RTG_NAME, pDev->unitNumber, pDrvCtrl->rtgBusyCpu,
+                    0, 0, 0);
+            }
+        }
+
     /* Set initial link state */
 
     pDrvCtrl->rtgCurMedia = IFM_ETHER|IFM_NONE;
@@ -2617,7 +4542,31 @@ LOCAL STATUS rtgEndStart
     semGive (pDrvCtrl->rtgDevSem);
 
     return (OK);
-    }
+
+rxFail:
+
+    /*
+     * Release the RX buffers set up so far. Freeing a recycled
+     * buffer's mBlk returns it to the free list via rtgRbFree(),
+     * still mapped; the others are unloaded here.
+     */
+
+    while (i-- > 0)
+        {
+        netMblkClChainFree (pDrvCtrl->rtgRxMblk[i]);
+        pDrvCtrl->rtgRxMblk[i] = NULL;
+        if (pDrvCtrl->rtgRxBuf[i] != NULL)
+            pDrvCtrl->rtgRxBuf[i] = NULL;
+        else
+            vxbDmaBufMapUnload (pDrvCtrl->rtgMblkTag,
+                pDrvCtrl->rtgRxMblkMap[i]);
+        }
+
+    END_TX_SEM_GIVE (pEnd);
+    semGive (pDrvCtrl->rtgDevSem);
+
+    return (ERROR);
+    }
 
 /*****************************************************************************
 *
@@ -2626,9 +4575,9 @@ LOCAL STATUS rtgEndStart
 * This function undoes the effects of rtgEndStart(). The device is shut
 * down and all resources are released. Note that the shutdown process
 * pauses to wait for all pending RX, TX and link event jobs that may have
-* been initiated by the interrupt handler to complete. This is done
-* to prevent tNetTask from accessing any data that might be released by
-* this routine.
+* been initiated by the interrupt handler to complete, and for the RSS
+* queue jobs the RX handler has posted. This is done to prevent tNetTask
+* from accessing any data that might be released by this routine.
 *
 * RETURNS: ERROR if device shutdown failed, otherwise OK
 *
@@ -2642,7 +4591,11 @@ LOCAL STATUS rtgEndStop
     {
     RTG_DRV_CTRL * pDrvCtrl;
     VXB_DEVICE_ID pDev;
+    RTG_RSS_QUEUE * pRss;
+    M_BLK_ID pHead;
+    M_BLK_ID pMblk;
     int i;
+    int j;
 
     pDrvCtrl = (RTG_DRV_CTRL *)pEnd;
 
@@ -2655,10 +4608,19 @@ LOCAL STATUS rtgEndStop
 
     pDev = pDrvCtrl->rtgDev;
 
+    /* Stop the TX reclaim backstop timer. */
+
+    if (pDrvCtrl->rtgTxReclaim == TRUE)
+        {
+        pDrvCtrl->rtgTxReclaimRun = FALSE;
+        wdCancel (pDrvCtrl->rtgTxReclaimWd);
+        }
+
     /* Disable interrupts */
     /*vxbIntDisable (pDev, 0, rtgEndInt, pDrvCtrl);*/
     pDrvCtrl->rtgIntrs = RTG_INTRS;
     CSR_WRITE_2(pDev, RTG_IMR, pDrvCtrl->rtgIntrs);
+    CSR_WRITE_4(pDev, pDrvCtrl->rtgTimerIntReg, 0);
     CSR_WRITE_2(pDev, RTG_ISR, 0xFFFF);
 
     /*
@@ -2686,6 +4648,62 @@ LOCAL STATUS rtgEndStop
         RTG_LOGMSG("%s%d: timed out waiting for job to complete\n",
             RTG_NAME, pDev->unitNumber, 0, 0, 0, 0);
 
+    /* Wait for the busy-poll task to leave the RX ring and exit. */
+
+    if (pDrvCtrl->rtgBusyPoll == TRUE)
+        {
+        pDrvCtrl->rtgBusyExit = TRUE;
+        semGive (pDrvCtrl->rtgBusySem);
+        semTake (pDrvCtrl->rtgBusyDone, WAIT_FOREVER);
+        }
+
+    /*
+     * Nothing posts to the RSS queues now. Wait for their jobs to
+     * finish, then free any frames they didn't get to.
+     */
+
+    for (j = 1; j < pDrvCtrl->rtgRssCnt; j++)
+        {
+        pRss = &pDrvCtrl->rtgRss[j];
+
+        for (i = 0; i < RTG_TIMEOUT; i++)
+            {
+            if (vxAtomic32Get (&pRss->rtgRssPending) == FALSE)
+                break;
+            taskDelay(1);
+            }
+
+        if (i == RTG_TIMEOUT)
+            RTG_LOGMSG("%s%d: timed out waiting for RSS queue %d\n",
+                RTG_NAME, pDev->unitNumber, j, 0, 0, 0);
+
+        SPIN_LOCK_ISR_TAKE (&pRss->rtgRssLock);
+        pHead = pRss->rtgRssHead;
+        pRss->rtgRssHead = pRss->rtgRssTail = NULL;
+        SPIN_LOCK_ISR_GIVE (&pRss->rtgRssLock);
+
+        while (pHead != NULL)
+            {
+            pMblk = pHead;
+            pHead = pMblk->m_nextpkt;
+            pMblk->m_nextpkt = NULL;
+            netMblkClChainFree (pMblk);
+            }
+        }
+
+    if (pDrvCtrl->rtgRxGroup != NULL)
+        rtgRxGroupLeave (pDrvCtrl);
+
+    /* Let the job queue's task run anywhere again. */
+
+    if (pDrvCtrl->rtgJobQueuePinned == TRUE)
+        {
+        (void) jobQueueStdPost (pDrvCtrl->rtgJobQueue, NET_TASK_QJOB_PRI,
+            (VOIDFUNCPTR)rtgJobQueuePin, (void *)(ULONG)pDev->unitNumber,
+            (void *)-1, NULL, NULL, NULL);
+        pDrvCtrl->rtgJobQueuePinned = FALSE;
+        }
+
     /* Disable RX and TX. */
     rtgReset (pDev);
     CSR_WRITE_1(pDev, RTG_CMD, 0);
@@ -2698,18 +4716,31 @@ LOCAL STATUS rtgEndStop
 
     vxbDmaBufMapUnload (pDrvCtrl->rtgRxDescTag, pDrvCtrl->rtgRxDescMap);
     vxbDmaBufMapUnload (pDrvCtrl->rtgTxDescTag, pDrvCtrl->rtgTxDescMap);
+    if (pDrvCtrl->rtgHpDescCnt != 0)
+        vxbDmaBufMapUnload (pDrvCtrl->rtgHpDescTag, pDrvCtrl->rtgHpDescMap);
 
     for (i = 0; i < pDrvCtrl->rtgRxDescCnt; i++)
         {
         if (pDrvCtrl->rtgRxMblk[i] != NULL)
             {
+            /* Recycled buffers go back on the free list, still mapped. */
+
             netMblkClChainFree (pDrvCtrl->rtgRxMblk[i]);
             pDrvCtrl->rtgRxMblk[i] = NULL;
-            vxbDmaBufMapUnload (pDrvCtrl->rtgMblkTag,
-                pDrvCtrl->rtgRxMblkMap[i]);
+            if (pDrvCtrl->rtgRxBuf[i] != NULL)
+                pDrvCtrl->rtgRxBuf[i] = NULL;
+            else
+                vxbDmaBufMapUnload (pDrvCtrl->rtgMblkTag,
+                    pDrvCtrl->rtgRxMblkMap[i]);
             }
         }
 
+    if (pDrvCtrl->rtgRxHead != NULL)
+        {
+        netMblkClChainFree (pDrvCtrl->rtgRxHead);
+        pDrvCtrl->rtgRxHead = pDrvCtrl->rtgRxTail = NULL;
+        }
+
     endMcacheFlush ();
 
     for (i = 0; i < pDrvCtrl->rtgTxDescCnt; i++)
@@ -2721,6 +4752,7 @@ LOCAL STATUS rtgEndStop
             vxbDmaBufMapUnload (pDrvCtrl->rtgMblkTag,
                 pDrvCtrl->rtgTxMblkMap[i]);
             }
+        pDrvCtrl->rtgTxBnc[i] = FALSE;
         }
 
     END_TX_SEM_GIVE (pEnd); 
@@ -2740,7 +4772,9 @@ LOCAL STATUS rtgEndStop
 * interrupt, so it invokes all the interrupt service routines that are
 * bound to it. We have to check here if any events are actually pending
 * in the interrupt status register, and that they haven't been masked off
-* in the interrupt mask register, before proceeding.
+* in the interrupt mask register, before proceeding. An MSI is only sent
+* by our device, and only for unmasked events, so these checks are
+* skipped when we have one.
 *
 * Once we know our device really does have an event pending, we mask
 * off all interrupts and schedule the task-level interrupt handler to run.
@@ -2762,8 +4796,6 @@ LOCAL void rtgEndInt
 
     pDev = pDrvCtrl->rtgDev;
 
-    status = CSR_READ_2(pDev, RTG_ISR);
-
     /*
      * Make sure there's really an interrupt event pending for us.
      * Since we're a PCI device, we may be sharing an interrupt line
@@ -2772,15 +4804,21 @@ LOCAL void rtgEndInt
      * which case we really don't have any work to do.
      */
 
-    if (!(status & RTG_INTRS))
-        return;
+    if (pDrvCtrl->rtgMsi == FALSE)
+        {
+        status = CSR_READ_2(pDev, RTG_ISR);
 
-    if (CSR_READ_2(pDev, RTG_IMR) == 0)
-        return;
+        if (!(status & pDrvCtrl->rtgIntrs))
+            return;
+
+        if (CSR_READ_2(pDev, RTG_IMR) == 0)
+            return;
+        }
 
     if (vxAtomic32Cas(&pDrvCtrl->rtgIntPending, FALSE, TRUE))
         {
         CSR_WRITE_2(pDev, RTG_IMR, 0);
+        RTG_TS_GET(pDrvCtrl->rtgIntTs);
         jobQueuePost (pDrvCtrl->rtgJobQueue, &pDrvCtrl->rtgIntJob);
         }
 
@@ -2835,9 +4873,10 @@ LOCAL void rtgRxFixup
 * rtgEndRxHandle - process received frames
 *
 * This function is scheduled by the ISR to run in the context of tNetTask
-* whenever an RX interrupt is received. It processes packets from the
-* RX DMA ring and encapsulates them into mBlk tuples which are handed up
-* to the MUX.
+* whenever an RX interrupt is received. It processes up to rtgRxBudget
+* packets from the RX DMA ring by calling rtgEndRxProcess(). If the
+* budget was used up, there may be more frames waiting, so the job
+* reschedules itself to give other work on the job queue a chance to run.
 *
 * RETURNS: N/A
 *
@@ -2851,20 +4890,149 @@ LOCAL void rtgEndRxHandle
     {
     QJOB *pJob;
     RTG_DRV_CTRL *pDrvCtrl;
+    int budget;
+
+    pJob = pArg;
+    pDrvCtrl = member_to_object (pJob, RTG_DRV_CTRL, rtgRxJob);
+
+    budget = pDrvCtrl->rtgRxBudget;
+
+    if (rtgEndRxProcess (pDrvCtrl, budget) == budget)
+        {
+        jobQueuePost (pDrvCtrl->rtgJobQueue, &pDrvCtrl->rtgRxJob);
+        return;
+        }
+
+    vxAtomic32Set (&pDrvCtrl->rtgRxPending, FALSE);
+
+    return;
+    }
+
+/******************************************************************************
+*
+* rtgEndRxCsum - translate RX checksum status into mBlk flags
+*
+* This routine sets the checksum flags of the received packet <pMblk>
+* from the descriptor status words <rxSts> and <rxVlan>. On the V2
+* descriptor chips, the vlanctl word also tells IPv4 frames from IPv6
+* ones. IPv6 frames have no header checksum, and their TCP and UDP
+* checksums are only reported when IFCAP_IPV6CSUM is enabled.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgEndRxCsum
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    M_BLK_ID pMblk,
+    UINT32 rxSts,
+    UINT32 rxVlan
+    )
+    {
+    if (pDrvCtrl->rtgDescV2 == TRUE && rxVlan & RTG_RDESC_VLANCTL_IPV6)
+        {
+        if (!(pDrvCtrl->rtgCaps.cap_enabled & IFCAP_IPV6CSUM))
+            return;
+        }
+    else
+        {
+        if (!(pDrvCtrl->rtgCaps.cap_enabled & IFCAP_RXCSUM))
+            return;
+        if (rxSts & RTG_RDESC_STAT_PROTOID)
+            pMblk->m_pkthdr.csum_flags |= CSUM_IP_CHECKED;
+        if (!(rxSts & RTG_RDESC_STAT_IPSUMBAD))
+            pMblk->m_pkthdr.csum_flags |= CSUM_IP_VALID;
+        }
+
+    if ((RTG_TCPPKT(rxSts) && !(rxSts & RTG_RDESC_STAT_TCPSUMBAD)) ||
+        (RTG_UDPPKT(rxSts) && !(rxSts & RTG_RDESC_STAT_UDPSUMBAD)))
+        {
+        pMblk->m_pkthdr.csum_flags |= CSUM_DATA_VALID|CSUM_PSEUDO_HDR;
+        pMblk->m_pkthdr.csum_data = 0xffff;
+        }
+
+    return;
+    }
+
+/******************************************************************************
+*
+* rtgEndRxProcess - process received frames
+*
+* This routine processes packets from the RX DMA ring and encapsulates
+* them into mBlk tuples which are handed up to the MUX. At most <budget>
+* descriptors are consumed. It is called from rtgEndRxHandle(), or from
+* rtgRxGroupHandle() when the instance is a member of an RX fairness
+* group. The per-pass statistics reported by EIOCGRTGRXSTATS are
+* updated here.
+*
+* RETURNS: the number of descriptors consumed
+*
+* ERRNO: N/A
+*/
+
+LOCAL int rtgEndRxProcess
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    int budget
+    )
+    {
     VXB_DEVICE_ID pDev;
     M_BLK_ID pMblk;
     M_BLK_ID pNewMblk;
+    M_BLK_ID pHead = NULL;
+    M_BLK_ID pTail = NULL;
+    M_BLK_ID rssHead[RTG_RSS_MAX];
+    M_BLK_ID rssTail[RTG_RSS_MAX];
+    RTG_RX_BUF * pNewBuf;
     UINT32 rxSts;
     UINT32 rxVlan;
+    UINT32 rxFrag;
     UINT16 rxLen;
     volatile RTG_DESC * pDesc;
     VXB_DMA_MAP_ID pMap;
-    int loopCounter = RTG_MAX_RX;
+    RTG_COUNTERS * pCnt;
+    int bufLen;
+    int rssQ;
+    int frames = 0;
+    int loopCounter = budget;
 
-    pJob = pArg;
-    pDrvCtrl = member_to_object (pJob, RTG_DRV_CTRL, rtgRxJob);
     pDev = pDrvCtrl->rtgDev;
 
+    if (pDrvCtrl->rtgRssCnt > 1)
+        bzero ((char *)rssHead, sizeof(rssHead));
+
+    if (pDrvCtrl->rtgHistOn == TRUE)
+        RTG_TS_GET(pDrvCtrl->rtgRxPassTs);
+
+    /* Note how long the RX event waited to be serviced. */
+
+    if (pDrvCtrl->rtgRxEvtTs != 0)
+        {
+        UINT64 now;
+
+        RTG_TS_GET(now);
+        rtgLatRecord (&pDrvCtrl->rtgLatIntrCnt, &pDrvCtrl->rtgLatIntrSum,
+            &pDrvCtrl->rtgLatIntrMax, now - pDrvCtrl->rtgRxEvtTs);
+        if (pDrvCtrl->rtgHistOn == TRUE)
+            rtgHistAdd (pDrvCtrl->rtgHist.rtgHistStage[RTG_HIST_INT_RX],
+                RTG_HIST_BUCKETS, now - pDrvCtrl->rtgRxEvtTs);
+        pDrvCtrl->rtgRxEvtTs = 0;
+        }
+
+    pCnt = RTG_RX_COUNTERS(pDrvCtrl);
+    RTG_STATS_BEGIN(pCnt);
+
+    /*
+     * Only the current line can hold stale copies: later ones are
+     * invalidated by rtgEndRxArm() just before they are read.
+     */
+
+    if (pDrvCtrl->rtgRxLineArm == TRUE)
+        cacheInvalidate (DATA_CACHE,
+            RTG_RX_LINE(pDrvCtrl, pDrvCtrl->rtgRxIdx), RTG_DESC_LINE_SIZE);
+
     pDesc = &pDrvCtrl->rtgRxDescMem[pDrvCtrl->rtgRxIdx];
 
     while (loopCounter && !(pDesc->rtg_cmdsts & htole32(RTG_RDESC_CMD_OWN)))
@@ -2873,13 +5041,16 @@ LOCAL void rtgEndRxHandle
         rxSts = le32toh(pDesc->rtg_cmdsts);
         rxVlan = le32toh(pDesc->rtg_vlanctl);
         rxLen = (UINT16)(rxSts & pDrvCtrl->rtgRxLenMask);
+        rxFrag = rxSts & (RTG_RDESC_STAT_SOF|RTG_RDESC_STAT_EOF);
 
-        if ((rxSts & (RTG_RDESC_STAT_SOF|RTG_RDESC_STAT_EOF)) !=
-            (RTG_RDESC_STAT_SOF|RTG_RDESC_STAT_EOF))
-            goto skip;
+        /*
+         * Frames that span more than one descriptor are only
+         * expected with scatter RX. The error bits are only
+         * valid in the last descriptor of a frame.
+         */
 
-        if ((rxSts & (RTG_RDESC_STAT_SOF|RTG_RDESC_STAT_EOF)) !=
-            (RTG_RDESC_STAT_SOF|RTG_RDESC_STAT_EOF))
+        if (rxFrag != (RTG_RDESC_STAT_SOF|RTG_RDESC_STAT_EOF) &&
+            pDrvCtrl->rtgRxScatter == FALSE)
             goto skip;
 
         /*
@@ -2902,99 +5073,126 @@ LOCAL void rtgEndRxHandle
         if (pDrvCtrl->rtgDevType == RTG_DEVTYPE_8169)
             rxSts >>= 1;
 
-        if (rxSts & RTG_RDESC_STAT_RXERRSUM)
+        if (rxFrag & RTG_RDESC_STAT_EOF && rxSts & RTG_RDESC_STAT_RXERRSUM)
             {
-            pDrvCtrl->rtgInErrors++;
+            pCnt->rtgCntErrors++;
             RTG_LOGMSG("%s%d: bad packet, sts: %x (%p %d)\n", RTG_NAME,
                 pDev->unitNumber, rxSts, pDesc, pDrvCtrl->rtgRxIdx, 0);
             goto skip;
             }
 
-        pNewMblk = endPoolTupleGet (pDrvCtrl->rtgEndObj.pNetPool);
+        /*
+         * Small frames are copied out, so the DMA buffer can stay
+         * in the ring without being unloaded and reloaded.
+         */
+
+        if (rxFrag == (RTG_RDESC_STAT_SOF|RTG_RDESC_STAT_EOF) &&
+            (UINT32)(rxLen - ETHER_CRC_LEN) <= pDrvCtrl->rtgRxCopybreak)
+            {
+            pMblk = rtgEndRxCopy (pDrvCtrl, rxLen - ETHER_CRC_LEN);
+            if (pMblk != NULL)
+                goto copied;
+            }
+
+        pNewMblk = rtgRbGet (pDrvCtrl, &pNewBuf);
+
+        if (pNewMblk == NULL)
+            pNewMblk = endPoolTupleGet (pDrvCtrl->rtgEndObj.pNetPool);
 
         if (pNewMblk == NULL)
             {
-            pDrvCtrl->rtgInDiscards++;
+            pCnt->rtgCntDiscards++;
             RTG_LOGMSG("%s%d: out of mBlks at %d\n", RTG_NAME,
                 pDev->unitNumber, pDrvCtrl->rtgRxIdx,0,0,0);
             pDrvCtrl->rtgLastError.errCode = END_ERR_NO_BUF;
             muxError (&pDrvCtrl->rtgEndObj, &pDrvCtrl->rtgLastError);
 skip:
-            pMap = pDrvCtrl->rtgRxMblkMap[pDrvCtrl->rtgRxIdx];
-            pDesc->rtg_bufaddr_lo =
-                htole32(RTG_ADDR_LO(pMap->fragList[0].frag));
-            pDesc->rtg_bufaddr_hi =
-                htole32(RTG_ADDR_HI(pMap->fragList[0].frag));
-            if (pDrvCtrl->rtgRxIdx == (pDrvCtrl->rtgRxDescCnt - 1))
-               pDesc->rtg_cmdsts = htole32(pMap->fragList[0].fragLen |
-                    RTG_RDESC_CMD_OWN | RTG_RDESC_CMD_EOR);
-            else
-                pDesc->rtg_cmdsts = htole32(pMap->fragList[0].fragLen |
-                    RTG_RDESC_CMD_OWN);
+            /* Any partly received frame is lost too. */
+
+            if (pDrvCtrl->rtgRxHead != NULL)
+                {
+                netMblkClChainFree (pDrvCtrl->rtgRxHead);
+                pDrvCtrl->rtgRxHead = pDrvCtrl->rtgRxTail = NULL;
+                pDrvCtrl->rtgRxChainErrs++;
+                }
+            rtgEndRxArm (pDrvCtrl, pDrvCtrl->rtgRxIdx);
             RTG_INC_DESC(pDrvCtrl->rtgRxIdx, pDrvCtrl->rtgRxDescCnt);
             loopCounter--;
             pDesc = &pDrvCtrl->rtgRxDescMem[pDrvCtrl->rtgRxIdx];
             continue;
             }
 
-        /* Get the map for this mBlk. */
-
-        pMap = pDrvCtrl->rtgRxMblkMap[pDrvCtrl->rtgRxIdx];
+        /*
+         * Sync the packet buffer. A recycled buffer keeps its
+         * mapping; an ordinary mBlk has its map unloaded.
+         */
 
-        /* Sync the packet buffer and unload the map. */
+        pMap = RTG_RX_MAP(pDrvCtrl, pDrvCtrl->rtgRxIdx);
+        bufLen = (int)pMap->fragList[0].fragLen;
 
         vxbDmaBufSync (pDev, pDrvCtrl->rtgMblkTag,
             pMap, VXB_DMABUFSYNC_PREREAD);
-        vxbDmaBufMapUnload (pDrvCtrl->rtgMblkTag, pMap);
+        if (pDrvCtrl->rtgRxBuf[pDrvCtrl->rtgRxIdx] == NULL)
+            vxbDmaBufMapUnload (pDrvCtrl->rtgMblkTag, pMap);
 
         /* Swap the mBlks. */
 
         pMblk = pDrvCtrl->rtgRxMblk[pDrvCtrl->rtgRxIdx];
         pDrvCtrl->rtgRxMblk[pDrvCtrl->rtgRxIdx] = pNewMblk;
-        pNewMblk->m_next = NULL;
-        if (pDrvCtrl->rtgMaxMtu == RTG_JUMBO_MTU)
-            pNewMblk->m_len = pNewMblk->m_pkthdr.len = END_JUMBO_CLSIZE;
-        RTG_ADJ (pNewMblk);
+        pDrvCtrl->rtgRxBuf[pDrvCtrl->rtgRxIdx] = pNewBuf;
 
-        /* don't need return from function call */
+        if (pNewBuf != NULL)
+            {
+            pMap = pNewBuf->rtgRbMap;
+            vxbDmaBufSync (pDev, pDrvCtrl->rtgMblkTag,
+                pMap, VXB_DMABUFSYNC_PREREAD);
+            }
+        else
+            {
+            pMap = pDrvCtrl->rtgRxMblkMap[pDrvCtrl->rtgRxIdx];
+            pNewMblk->m_next = NULL;
+            if (pDrvCtrl->rtgMaxMtu == RTG_JUMBO_MTU &&
+                pDrvCtrl->rtgRxScatter == FALSE)
+                pNewMblk->m_len = pNewMblk->m_pkthdr.len = END_JUMBO_CLSIZE;
+            RTG_ADJ (pNewMblk);
 
-        (void) vxbDmaBufMapMblkLoad (pDev, pDrvCtrl->rtgMblkTag, pMap, pNewMblk, 0);
+            /* don't need return from function call */
 
-        pDesc->rtg_bufaddr_lo = htole32(RTG_ADDR_LO(pMap->fragList[0].frag));
-        pDesc->rtg_bufaddr_hi = htole32(RTG_ADDR_HI(pMap->fragList[0].frag));
+            (void) vxbDmaBufMapMblkLoad (pDev, pDrvCtrl->rtgMblkTag, pMap,
+                pNewMblk, 0);
+            pMap->fragList[0].fragLen -= 8;
+            }
 
-        pMap->fragList[0].fragLen -= 8;
+        /* Give the descriptor back with its new buffer. */
 
-        /* Reset this descriptor's CMD/STS fields. */
+        rtgEndRxArm (pDrvCtrl, pDrvCtrl->rtgRxIdx);
 
-        if (pDrvCtrl->rtgRxIdx == (pDrvCtrl->rtgRxDescCnt - 1))
-            pDesc->rtg_cmdsts = htole32(pMap->fragList[0].fragLen |
-                RTG_RDESC_CMD_OWN | RTG_RDESC_CMD_EOR);
-        else
-            pDesc->rtg_cmdsts = htole32(pMap->fragList[0].fragLen |
-                RTG_RDESC_CMD_OWN);
+        /* Fragments of a scattered frame are chained until the last. */
 
-        pMblk->m_len = pMblk->m_pkthdr.len = rxLen - ETHER_CRC_LEN;
-        pMblk->m_flags = M_PKTHDR|M_EXT;
+        if (rxFrag != (RTG_RDESC_STAT_SOF|RTG_RDESC_STAT_EOF))
+            {
+            pMblk = rtgEndRxChain (pDrvCtrl, pMblk, rxFrag, rxLen, bufLen);
+            if (pMblk == NULL)
+                {
+                RTG_INC_DESC(pDrvCtrl->rtgRxIdx, pDrvCtrl->rtgRxDescCnt);
+                loopCounter--;
+                pDesc = &pDrvCtrl->rtgRxDescMem[pDrvCtrl->rtgRxIdx];
+                continue;
+                }
+            }
+        else
+            {
+            pMblk->m_len = pMblk->m_pkthdr.len = rxLen - ETHER_CRC_LEN;
+            pMblk->m_flags = M_PKTHDR|M_EXT;
+            }
 
 #ifdef RTG_RX_FIXUP
         rtgRxFixup (pMblk);
 #endif
+copied:
         /* Handle checksum offload. */
 
-        if (pDrvCtrl->rtgCaps.cap_enabled & IFCAP_RXCSUM)
-            {
-            if (rxSts & RTG_RDESC_STAT_PROTOID)
-                pMblk->m_pkthdr.csum_flags |= CSUM_IP_CHECKED;
-            if (!(rxSts & RTG_RDESC_STAT_IPSUMBAD))
-                pMblk->m_pkthdr.csum_flags |= CSUM_IP_VALID;
-            if ((RTG_TCPPKT(rxSts) && !(rxSts & RTG_RDESC_STAT_TCPSUMBAD)) ||
-                (RTG_UDPPKT(rxSts) && !(rxSts & RTG_RDESC_STAT_UDPSUMBAD)))
-                {
-                pMblk->m_pkthdr.csum_flags |= CSUM_DATA_VALID|CSUM_PSEUDO_HDR;
-                pMblk->m_pkthdr.csum_data = 0xffff;
-                }
-            }
+        rtgEndRxCsum (pDrvCtrl, pMblk, rxSts, rxVlan);
 
         if (pDrvCtrl->rtgCaps.cap_enabled & IFCAP_VLAN_HWTAGGING)
            {
@@ -3010,759 +5208,4379 @@ skip:
         RTG_INC_DESC(pDrvCtrl->rtgRxIdx, pDrvCtrl->rtgRxDescCnt);
         loopCounter--;
 
-        pDrvCtrl->rtgInOctets += pMblk->m_len;
-        if (rxSts & RTG_RDESC_STAT_UCAST)
-            pDrvCtrl->rtgInUcasts++;
-        if (rxSts & RTG_RDESC_STAT_MCAST)
-            pDrvCtrl->rtgInMcasts++;
-        if (rxSts & RTG_RDESC_STAT_BCAST)
-            pDrvCtrl->rtgInBcasts++;
+        pCnt->rtgCntOctets += pMblk->m_pkthdr.len;
+        if (pDrvCtrl->rtgHwStats == FALSE)
+            {
+            if (rxSts & RTG_RDESC_STAT_UCAST)
+                pCnt->rtgCntUcasts++;
+            if (rxSts & RTG_RDESC_STAT_MCAST)
+                pCnt->rtgCntMcasts++;
+            if (rxSts & RTG_RDESC_STAT_BCAST)
+                pCnt->rtgCntBcasts++;
+            }
+        frames++;
 
-        END_RCV_RTN_CALL (&pDrvCtrl->rtgEndObj, pMblk);
+        if (pDrvCtrl->rtgTap != NULL)
+            rtgTapRecord (pDrvCtrl->rtgTap, pMblk, RTG_TAP_RX);
+
+        /* Frames for the other RSS queues are handed over at the end. */
+
+        rssQ = 0;
+        if (pDrvCtrl->rtgRssCnt > 1)
+            {
+            rssQ = rtgRssHash (pDrvCtrl, pMblk);
+            pDrvCtrl->rtgRss[rssQ].rtgRssFrames++;
+            }
+
+        if (rssQ != 0)
+            {
+            pMblk->m_nextpkt = NULL;
+            if (rssHead[rssQ] == NULL)
+                rssHead[rssQ] = pMblk;
+            else
+                rssTail[rssQ]->m_nextpkt = pMblk;
+            rssTail[rssQ] = pMblk;
+            }
+        else if (pDrvCtrl->rtgRxBatch == RTG_RXBATCH_OFF)
+            {
+            pDrvCtrl->rtgRxUpcalls++;
+            if (pDrvCtrl->rtgHistOn == TRUE)
+                rtgHistStamp (pDrvCtrl, RTG_HIST_RX_MUX,
+                    pDrvCtrl->rtgRxPassTs);
+            END_RCV_RTN_CALL (&pDrvCtrl->rtgEndObj, pMblk);
+            }
+        else
+            {
+            pMblk->m_nextpkt = NULL;
+            if (pHead == NULL)
+                pHead = pMblk;
+            else
+                pTail->m_nextpkt = pMblk;
+            pTail = pMblk;
+            }
 
         pDesc = &pDrvCtrl->rtgRxDescMem[pDrvCtrl->rtgRxIdx];
         }
 
-    if (loopCounter == 0)
-        {
-        jobQueuePost (pDrvCtrl->rtgJobQueue, &pDrvCtrl->rtgRxJob);
-        return;
-        }
+    RTG_STATS_END(pCnt);
 
-    vxAtomic32Set (&pDrvCtrl->rtgRxPending, FALSE);
+    /* The moderation count is shared with TX reclaim: add once. */
 
-    return;
+    if (frames != 0)
+        (void) vxAtomic32Add (&pDrvCtrl->rtgIntrModPkts, frames);
+
+    if (pHead != NULL)
+        rtgEndRxDeliver (pDrvCtrl, pHead);
+
+    if (pDrvCtrl->rtgRssCnt > 1)
+        rtgRssPost (pDrvCtrl, rssHead, rssTail);
+
+    /*
+     * A pass which stopped at a descriptor the chip still owns has
+     * reaped every descriptor that was full, so their number gives
+     * the ring's occupancy. One cut short by the budget doesn't.
+     */
+
+    if (pDrvCtrl->rtgHistOn == TRUE && loopCounter != 0 &&
+        (UINT32)(budget - loopCounter) > pDrvCtrl->rtgHist.rtgHistRxOccMax)
+        pDrvCtrl->rtgHist.rtgHistRxOccMax = budget - loopCounter;
+
+    loopCounter = budget - loopCounter;
+
+    pDrvCtrl->rtgRxPasses++;
+    pDrvCtrl->rtgRxPassFrames += loopCounter;
+    if (loopCounter == budget)
+        pDrvCtrl->rtgRxBudgetHits++;
+    if ((UINT32)loopCounter > pDrvCtrl->rtgRxPassMax)
+        pDrvCtrl->rtgRxPassMax = loopCounter;
+    if (pDrvCtrl->rtgHistOn == TRUE)
+        rtgHistAdd (pDrvCtrl->rtgHist.rtgHistBatch, RTG_HIST_BATCH_BUCKETS,
+            (UINT64)loopCounter);
+
+    return (loopCounter);
     }
 
 /******************************************************************************
 *
-* rtgEndTxHandle - process TX completion events
-*
-* This function is scheduled by the ISR to run in the context of tNetTask
-* whenever an TX interrupt is received. It runs through all of the
-* TX register pairs and checks the TX status to see how many have
-* completed. For each completed transmission, the associated TX mBlk
-* is released, and the outbound packet stats are updated.
-*
-* In the event that a TX underrun error is detected, the TX FIFO
-* threshold is increased. This will continue until the maximum TX
-* FIFO threshold is reached.
+* rtgEndRxDeliver - pass a batch of received frames to the MUX
 *
-* If the transmitter has stalled, this routine will also call muxTxRestart()
-* to drain any packets that may be waiting in the protocol send queues,
+* This routine is called by rtgEndRxProcess() at the end of an RX pass
+* when batched delivery is enabled. <pHead> is a list of frames linked
+* through m_nextpkt. In RTG_RXBATCH_CHAIN mode, the whole list is handed
+* to the MUX in one call. Otherwise, the frames are unlinked and passed
+* up one at a time, which works with any stack.
 *
 * RETURNS: N/A
 *
 * ERRNO: N/A
 */
 
-LOCAL void rtgEndTxHandle
+LOCAL void rtgEndRxDeliver
     (
-    void * pArg
+    RTG_DRV_CTRL * pDrvCtrl,
+    M_BLK_ID pHead
     )
     {
-    QJOB *pJob;
-    RTG_DRV_CTRL *pDrvCtrl;
-    VXB_DEVICE_ID pDev;
-    VXB_DMA_MAP_ID pMap;
-    RTG_DESC * pDesc;
-    UINT32 txSts;
-    BOOL restart = FALSE;
     M_BLK_ID pMblk;
 
-    pJob = pArg;
-    pDrvCtrl = member_to_object (pJob, RTG_DRV_CTRL, rtgTxJob);
-    pDev = pDrvCtrl->rtgDev;
-
-    END_TX_SEM_TAKE (&pDrvCtrl->rtgEndObj, WAIT_FOREVER); 
+    if (pDrvCtrl->rtgHistOn == TRUE)
+        rtgHistStamp (pDrvCtrl, RTG_HIST_RX_MUX, pDrvCtrl->rtgRxPassTs);
 
-    while (pDrvCtrl->rtgTxFree < pDrvCtrl->rtgTxDescCnt)
+    if (pDrvCtrl->rtgRxBatch == RTG_RXBATCH_CHAIN)
         {
-        pDesc = &pDrvCtrl->rtgTxDescMem[pDrvCtrl->rtgTxCons];
-        txSts = le32toh(pDesc->rtg_cmdsts);
+        pDrvCtrl->rtgRxUpcalls++;
+        END_RCV_RTN_CALL (&pDrvCtrl->rtgEndObj, pHead);
+        return;
+        }
 
-        if (txSts & RTG_TDESC_STAT_OWN)
-            break;
+    while (pHead != NULL)
+        {
+        pMblk = pHead;
+        pHead = pMblk->m_nextpkt;
+        pMblk->m_nextpkt = NULL;
+        pDrvCtrl->rtgRxUpcalls++;
+        END_RCV_RTN_CALL (&pDrvCtrl->rtgEndObj, pMblk);
+        }
 
-        pMblk = pDrvCtrl->rtgTxMblk[pDrvCtrl->rtgTxCons];
-        pMap = pDrvCtrl->rtgTxMblkMap[pDrvCtrl->rtgTxCons];
+    return;
+    }
 
-        if (pMblk != NULL)
-            {
-            pDrvCtrl->rtgOutOctets += pMblk->m_pkthdr.len;
-            if ((UINT8)pMblk->m_data[0] == 0xFF)
-                pDrvCtrl->rtgOutBcasts++;
-            else if ((UINT8)pMblk->m_data[0] & 0x1)
-                pDrvCtrl->rtgOutMcasts++;
-            else
-                pDrvCtrl->rtgOutUcasts++;
-            vxbDmaBufMapUnload (pDrvCtrl->rtgMblkTag, pMap);
-            endPoolTupleFree (pMblk);
-            pDrvCtrl->rtgTxMblk[pDrvCtrl->rtgTxCons] = NULL;
-            }
+/******************************************************************************
+*
+* rtgRssHash - pick the RSS queue for a received frame
+*
+* This routine hashes the IPv4 or IPv6 addresses of the frame <pMblk>,
+* and for TCP and UDP its ports, and maps the hash onto one of the
+* instance's RSS queues. Fragments, and IPv6 frames with extension
+* headers, are hashed on their addresses only, so that all the pieces
+* of a datagram land on the same queue. The source and destination
+* addresses are combined symmetrically, so both directions of a
+* connection share a queue too. Non-IP frames, and frames too short to
+* hold the headers, go to queue 0.
+*
+* RETURNS: the RSS queue index
+*
+* ERRNO: N/A
+*/
 
-        pDesc->rtg_cmdsts &= htole32(RTG_TDESC_CMD_EOR);
-        pDesc->rtg_vlanctl = 0;
+LOCAL int rtgRssHash
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    M_BLK_ID pMblk
+    )
+    {
+    UINT8 * pData;
+    UINT8 * pIp;
+    UINT32 hash;
+    UINT32 type;
+    UINT8 proto;
+    int len, off, i;
+
+    pData = (UINT8 *)pMblk->m_data;
+    len = pMblk->m_len;
+    off = ETHER_HDR_LEN;
+
+    if (len < ETHER_HDR_LEN + 4)
+        return (0);
+
+    type = (pData[12] << 8) | pData[13];
+    if (type == RTG_ETHERTYPE_VLAN)
+        {
+        type = (pData[16] << 8) | pData[17];
+        off += 4;
+        }
 
-        pDrvCtrl->rtgTxFree++;
-        RTG_INC_DESC (pDrvCtrl->rtgTxCons, pDrvCtrl->rtgTxDescCnt);
+    pIp = pData + off;
 
-        /*
-         * We released at least one descriptor: if the transmit
-         * channel is stalled, unstall it.
-         */
+    if (type == RTG_ETHERTYPE_IP)
+        {
+        if (len < off + 20 || (pIp[0] & 0x0F) < 5)
+            return (0);
+        hash = RTG_RSS_WORD(pIp + 12) ^ RTG_RSS_WORD(pIp + 16);
+        proto = pIp[9];
 
-        if (pDrvCtrl->rtgTxStall == TRUE)
-            {
-            pDrvCtrl->rtgTxStall = FALSE;
-            restart = TRUE;
-            }
- 
+        /* MF set or a fragment offset: addresses only. */
+
+        if ((pIp[6] & 0x3F) != 0 || pIp[7] != 0)
+            proto = 0;
+        off += (pIp[0] & 0x0F) << 2;
         }
+    else if (type == RTG_ETHERTYPE_IPV6)
+        {
+        if (len < off + 40)
+            return (0);
+        hash = 0;
+        for (i = 8; i < 40; i += 4)
+            hash ^= RTG_RSS_WORD(pIp + i);
+        proto = pIp[6];
+        off += 40;
+        }
+    else
+        return (0);
 
-    END_TX_SEM_GIVE (&pDrvCtrl->rtgEndObj); 
+    if ((proto == RTG_IPPROTO_TCP || proto == RTG_IPPROTO_UDP) &&
+        len >= off + 4)
+        hash ^= (pData[off] << 8 | pData[off + 1]) ^
+            (pData[off + 2] << 8 | pData[off + 3]);
 
-    vxAtomic32Set (&pDrvCtrl->rtgTxPending, FALSE);
+    hash *= 0x9E3779B1;
 
-    /*
-     * Some chips will ignore a second TX request issued while an
-     * existing transmission is in progress. If the transmitter goes
-     * idle but there are still packets waiting to be sent, we need
-     * to restart the channel here to flush them out. This only seems
-     * to be required with the PCIe devices.
-     */
+    return ((int)(((hash >> 16) * (UINT32)pDrvCtrl->rtgRssCnt) >> 16));
+    }
 
-    if (pDrvCtrl->rtgTxFree < pDrvCtrl->rtgTxDescCnt)
-        CSR_WRITE_1(pDrvCtrl->rtgDev, pDrvCtrl->rtgTxStartReg, RTG_TXPP_NPQ);
+/******************************************************************************
+*
+* rtgRssPost - hand received frames over to the RSS queues
+*
+* This routine is called at the end of an RX pass when software RSS is
+* in use. For each RSS queue other than queue 0, the frames gathered
+* for it in <rssHead>/<rssTail> during the pass are appended to the
+* queue's list, and the queue's job is posted unless it is pending
+* already. Since frames are appended in the order they were received,
+* and each queue's list is drained by a single job, the order of the
+* frames within a flow is preserved.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
 
-    if (restart == TRUE)
-        muxTxRestart (pDrvCtrl);
+LOCAL void rtgRssPost
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    M_BLK_ID * rssHead,
+    M_BLK_ID * rssTail
+    )
+    {
+    RTG_RSS_QUEUE * pRss;
+    int i;
+
+    for (i = 1; i < pDrvCtrl->rtgRssCnt; i++)
+        {
+        if (rssHead[i] == NULL)
+            continue;
+
+        pRss = &pDrvCtrl->rtgRss[i];
+
+        SPIN_LOCK_ISR_TAKE (&pRss->rtgRssLock);
+        if (pRss->rtgRssHead == NULL)
+            pRss->rtgRssHead = rssHead[i];
+        else
+            pRss->rtgRssTail->m_nextpkt = rssHead[i];
+        pRss->rtgRssTail = rssTail[i];
+        SPIN_LOCK_ISR_GIVE (&pRss->rtgRssLock);
+
+        if (vxAtomic32Cas (&pRss->rtgRssPending, FALSE, TRUE))
+            jobQueuePost (pRss->rtgRssQueue, &pRss->rtgRssJob);
+        }
 
     return;
     }
 
-/*****************************************************************************
+/******************************************************************************
 *
-* rtgEndIntHandle - task level interrupt handler
+* rtgRssHandle - pass up the frames queued for an RSS queue
 *
-* This routine is scheduled to run in tNetTask by the interrupt service
-* routine whenever a chip interrupt occurs. This function will check
-* what interrupt events are pending and schedule additional jobs to
-* service them. Once there are no more events waiting to be serviced
-* (i.e. the chip has gone idle), interrupts will be unmasked so that
-* the ISR can fire again.
+* This is the job posted to an RSS queue by rtgRssPost(). It takes the
+* queue's whole list of frames and passes them to the MUX, on the CPU
+* that services the queue, honouring the instance's rxBatch setting.
+* The pending flag stays set until the frames have been passed up, so
+* that rtgEndStop() can tell when the job is done with the instance.
+* Frames added while it was set didn't post the job, so the list is
+* checked again once it is cleared, and the job reposted if needed.
 *
 * RETURNS: N/A
 *
 * ERRNO: N/A
 */
 
-LOCAL void rtgEndIntHandle
+LOCAL void rtgRssHandle
     (
     void * pArg
     )
     {
-    QJOB *pJob;
-    RTG_DRV_CTRL *pDrvCtrl;
-    VXB_DEVICE_ID pDev;
-    UINT16 status;
-
-    pJob = pArg;
-    pDrvCtrl = member_to_object (pJob, RTG_DRV_CTRL, rtgIntJob);
-    pDev = pDrvCtrl->rtgDev;
-
-    status = CSR_READ_2(pDev, RTG_ISR);
-    CSR_WRITE_2(pDev, RTG_ISR, status);
+    RTG_RSS_QUEUE * pRss;
+    RTG_DRV_CTRL * pDrvCtrl;
+    M_BLK_ID pHead;
+    M_BLK_ID pMblk;
+    BOOL more;
 
-    if (status & RTG_RXINTRS &&
-        vxAtomic32Set (&pDrvCtrl->rtgRxPending, TRUE) == FALSE)
-        jobQueuePost (pDrvCtrl->rtgJobQueue, &pDrvCtrl->rtgRxJob);
+    pRss = member_to_object ((QJOB *)pArg, RTG_RSS_QUEUE, rtgRssJob);
+    pDrvCtrl = pRss->rtgRssDrvCtrl;
 
-    if (status & RTG_TXINTRS &&
-        vxAtomic32Set (&pDrvCtrl->rtgTxPending, TRUE) == FALSE)
-        jobQueuePost (pDrvCtrl->rtgJobQueue, &pDrvCtrl->rtgTxJob);
+    SPIN_LOCK_ISR_TAKE (&pRss->rtgRssLock);
+    pHead = pRss->rtgRssHead;
+    pRss->rtgRssHead = NULL;
+    SPIN_LOCK_ISR_GIVE (&pRss->rtgRssLock);
 
-    /* May as well just do this one directly. */
-    if (status & (RTG_ISR_LINKCHG|RTG_ISR_CABLE_LEN_CHGD))
-        rtgLinkUpdate (pDev);
+    if (pHead != NULL && pDrvCtrl->rtgRxBatch == RTG_RXBATCH_CHAIN)
+        {
+        END_RCV_RTN_CALL (&pDrvCtrl->rtgEndObj, pHead);
+        pHead = NULL;
+        }
 
-    if (CSR_READ_2(pDev, RTG_ISR) & RTG_INTRS)
+    while (pHead != NULL)
         {
-        jobQueuePost (pDrvCtrl->rtgJobQueue, &pDrvCtrl->rtgIntJob);
-        return;
+        pMblk = pHead;
+        pHead = pMblk->m_nextpkt;
+        pMblk->m_nextpkt = NULL;
+        END_RCV_RTN_CALL (&pDrvCtrl->rtgEndObj, pMblk);
         }
 
-    vxAtomic32Set (&pDrvCtrl->rtgIntPending, FALSE);
-    CSR_WRITE_2(pDev, RTG_IMR, pDrvCtrl->rtgIntrs);
+    vxAtomic32Set (&pRss->rtgRssPending, FALSE);
+
+    SPIN_LOCK_ISR_TAKE (&pRss->rtgRssLock);
+    more = (pRss->rtgRssHead != NULL);
+    SPIN_LOCK_ISR_GIVE (&pRss->rtgRssLock);
+
+    if (more && vxAtomic32Cas (&pRss->rtgRssPending, FALSE, TRUE))
+        jobQueuePost (pRss->rtgRssQueue, &pRss->rtgRssJob);
 
     return;
     }
 
 /******************************************************************************
 *
-* rtgEndEncap - encapsulate an outbound packet in the TX DMA ring
-*
-* This function sets up a descriptor for a packet transmit operation.
-* With the RealTek 'cplus' style devices, the TX DMA ring consists of
-* descriptors that each describe a single packet fragment. We consume
-* as many descriptors as there are mBlks in the outgoing packet, unless
-* the chain is too long. The length is limited by the number of DMA
-* segments we want to allow in a given DMA map. If there are too many
-* segments, this routine will fail, and the caller must coalesce the
-* data into fewer buffers and try again.
+* rtgEndRxArm - hand an RX descriptor back to the chip
 *
-* This routine will also fail if there aren't enough free descriptors
-* available in the ring, in which case the caller must defer the
-* transmission until more descriptors are completed by the chip.
+* This routine loads RX descriptor <idx> with the address and size of
+* the buffer currently mapped for it, and sets its OWN bit (and EOR for
+* the last descriptor in the ring). When the RX ring is cached and DMA
+* isn't coherent, descriptors are only handed back a whole cache line
+* at a time: nothing is written until <idx> is the last descriptor in
+* its line, at which point the whole line is filled in and flushed.
+* Since the chip fills descriptors in order, it owns none of that line
+* by then, so the flush can't clobber a status it has written. The next
+* line, which the caller reads next, is then invalidated.
 *
-* RETURNS: ENOSPC if there are too many fragments in the packet, EAGAIN
-* if the DMA ring is full, otherwise OK.
+* RETURNS: N/A
 *
 * ERRNO: N/A
 */
 
-LOCAL int rtgEndEncap
+LOCAL void rtgEndRxArm
     (
     RTG_DRV_CTRL * pDrvCtrl,
-    M_BLK_ID pMblk
+    UINT32 idx
     )
     {
-    VXB_DEVICE_ID pDev;
+    volatile RTG_DESC * pDesc;
     VXB_DMA_MAP_ID pMap;
-    RTG_DESC * pDesc, * pFirst;
-    UINT32 firstIdx, lastIdx = 0;
-    UINT32 cmdSts = 0;
-    int i;
-
-    pDev = pDrvCtrl->rtgDev;
-    firstIdx = pDrvCtrl->rtgTxProd;
-    pMap = pDrvCtrl->rtgTxMblkMap[pDrvCtrl->rtgTxProd];
-
-    if (pDrvCtrl->rtgTxMblk[pDrvCtrl->rtgTxProd] != NULL)
-        return (EAGAIN);
-
-    /*
-     * Load the DMA map to build the segment list.
-     * This will fail if there are too many segments.
-     */
+    UINT32 first;
+    UINT32 i;
 
-    if (vxbDmaBufMapMblkLoad (pDev, pDrvCtrl->rtgMblkTag,
-        pMap, pMblk, 0) != OK || (pMap->nFrags > pDrvCtrl->rtgTxFree))
+    first = idx;
+    if (pDrvCtrl->rtgRxLineArm == TRUE)
         {
-        vxbDmaBufMapUnload (pDrvCtrl->rtgMblkTag, pMap);
-        return (ENOSPC);
+        if ((idx & (RTG_DESC_PER_LINE - 1)) != RTG_DESC_PER_LINE - 1)
+            return;
+        first = idx & ~(RTG_DESC_PER_LINE - 1);
         }
 
-    pFirst = &pDrvCtrl->rtgTxDescMem[pDrvCtrl->rtgTxProd];
-
-    for (i = 0; i < pMap->nFrags; i++)
+    for (i = first; i <= idx; i++)
         {
-        pDesc = &pDrvCtrl->rtgTxDescMem[pDrvCtrl->rtgTxProd];
-        pDesc->rtg_bufaddr_lo = htole32(RTG_ADDR_LO(pMap->fragList[i].frag));
-        pDesc->rtg_bufaddr_hi = htole32(RTG_ADDR_HI(pMap->fragList[i].frag));
-
-        cmdSts = (UINT32)(pMap->fragList[i].fragLen & RTG_TDESC_CMD_FRAGLEN);
-
-        if (i == 0)
-            cmdSts |= RTG_TDESC_CMD_SOF;
+        pDesc = &pDrvCtrl->rtgRxDescMem[i];
+        pMap = RTG_RX_MAP(pDrvCtrl, i);
+        pDesc->rtg_bufaddr_lo = htole32(RTG_ADDR_LO(pMap->fragList[0].frag));
+        pDesc->rtg_bufaddr_hi = htole32(RTG_ADDR_HI(pMap->fragList[0].frag));
+        if (i == (pDrvCtrl->rtgRxDescCnt - 1))
+            pDesc->rtg_cmdsts = htole32(pMap->fragList[0].fragLen |
+                RTG_RDESC_CMD_OWN | RTG_RDESC_CMD_EOR);
         else
-            cmdSts |= RTG_TDESC_CMD_OWN;
-
-        if (i == (pMap->nFrags - 1))
-            cmdSts |= RTG_TDESC_CMD_EOF;
-        if (pDrvCtrl->rtgTxProd == (pDrvCtrl->rtgTxDescCnt - 1))
-            cmdSts |= RTG_TDESC_CMD_EOR;
-
-        /*
-         * Checksum offload bits must be set in all descriptors
-         * for a given packet where we want checksum offloading
-         * to be performed.
-         */
-
-        if (pDrvCtrl->rtgDescV2 == FALSE &&
-            pDrvCtrl->rtgCaps.cap_enabled & IFCAP_TXCSUM)
-            {
-	    /*
-	     * Even when the stack wants only the transport checksum offloaded,
-	     * the device needs to be asked to do the IP checksum also,
-	     * or it doesn't do the transport checksum.
-	     * The IP checksum offload is not adversely affected by the fact
-	     * that the IP header already has the checksum stored in the
-	     * checksum field; the device apparently skips this field when
-	     * calculating the IP header checksum.
-	     */
-            if (pMblk->m_pkthdr.csum_flags & CSUM_TCP)
-                cmdSts |= (RTG_TDESC_CMD_TCPCSUM | RTG_TDESC_CMD_IPCSUM);
-            else if (pMblk->m_pkthdr.csum_flags & CSUM_UDP)
-                cmdSts |= (RTG_TDESC_CMD_UDPCSUM | RTG_TDESC_CMD_IPCSUM);
-            else if (pMblk->m_pkthdr.csum_flags & CSUM_IP)
-                cmdSts |= RTG_TDESC_CMD_IPCSUM;
-            }
+            pDesc->rtg_cmdsts = htole32(pMap->fragList[0].fragLen |
+                RTG_RDESC_CMD_OWN);
+        }
 
-        pDesc->rtg_cmdsts = htole32(cmdSts);
-        pDrvCtrl->rtgTxFree--;
-        lastIdx = pDrvCtrl->rtgTxProd;
-        RTG_INC_DESC(pDrvCtrl->rtgTxProd, pDrvCtrl->rtgTxDescCnt);
+    if (pDrvCtrl->rtgRxLineArm == TRUE)
+        {
+        cacheFlush (DATA_CACHE, RTG_RX_LINE(pDrvCtrl, first),
+            RTG_DESC_LINE_SIZE);
+        RTG_INC_DESC(idx, pDrvCtrl->rtgRxDescCnt);
+        cacheInvalidate (DATA_CACHE, RTG_RX_LINE(pDrvCtrl, idx),
+            RTG_DESC_LINE_SIZE);
         }
 
-    /* Save the mBlk for later. */
-    pDrvCtrl->rtgTxMblk[lastIdx] = pMblk;
+    return;
+    }
 
-    /*
-     * Insure that the map for this transmission
-     * is placed at the array index of the last descriptor
-     * in this chain.  (Swap last and first dmamaps.)
-     */
+/******************************************************************************
+*
+* rtgEndRxCopy - copy a small received frame out of the RX ring
+*
+* This routine implements RX copybreak. The frame of <len> bytes in the
+* current RX descriptor's buffer is copied into a tuple from the
+* instance's small-cluster pool, and the descriptor is handed back to
+* the chip with its original buffer, which stays DMA-mapped. On
+* architectures that need RX fixup, the copy is placed so that the IP
+* header is longword aligned. The caller must have checked that <len>
+* does not exceed the copybreak threshold.
+*
+* RETURNS: a tuple holding the frame, or NULL if the small-cluster
+* pool is exhausted, in which case the descriptor is left untouched.
+*
+* ERRNO: N/A
+*/
 
-    pDrvCtrl->rtgTxMblkMap[firstIdx] = pDrvCtrl->rtgTxMblkMap[lastIdx];
+LOCAL M_BLK_ID rtgEndRxCopy
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    int len
+    )
+    {
+    M_BLK_ID pMblk;
+    VXB_DMA_MAP_ID pMap;
 
-    pDrvCtrl->rtgTxMblkMap[lastIdx] = pMap;
+    pMblk = netTupleGet (pDrvCtrl->rtgCbPool, RTG_CB_CLSIZE,
+        M_DONTWAIT, MT_DATA, TRUE);
 
-    /* VLAN tags go in the first descriptor only */
+    if (pMblk == NULL)
+        return (NULL);
 
-    if (pDrvCtrl->rtgCaps.cap_enabled & IFCAP_VLAN_HWTAGGING)
-        {
-        if (pMblk->m_pkthdr.csum_flags & CSUM_VLAN)
-            pFirst->rtg_vlanctl = htole32(htons(pMblk->m_pkthdr.vlan) |
-                RTG_TDESC_VLANCTL_TAG);
-        /*
-         * For the RTL8168C, RTL8168CP, RTL8168D and RTL8102E devices,
-         * the checksum offload bits have been moved to the vlanctl
-         * control word.
-         */
+    pMap = RTG_RX_MAP(pDrvCtrl, pDrvCtrl->rtgRxIdx);
 
-        if (pDrvCtrl->rtgDescV2 == TRUE)
-            {
-            if (pMblk->m_pkthdr.csum_flags & CSUM_TCP)
-                pFirst->rtg_vlanctl |=
-                    htole32(RTG_TDESC_VLANCTL_TCPCSUM|RTG_TDESC_VLANCTL_IPCSUM);
-            else if (pMblk->m_pkthdr.csum_flags & CSUM_UDP)
-                pFirst->rtg_vlanctl |=
-                    htole32(RTG_TDESC_VLANCTL_UDPCSUM|RTG_TDESC_VLANCTL_IPCSUM);
-            else if (pMblk->m_pkthdr.csum_flags & CSUM_IP)
-                pFirst->rtg_vlanctl |= htole32(RTG_TDESC_VLANCTL_IPCSUM);
-            }
-        }
+    vxbDmaBufSync (pDrvCtrl->rtgDev, pDrvCtrl->rtgMblkTag,
+        pMap, VXB_DMABUFSYNC_POSTREAD);
 
-    /* Sync the buffer. */
+#ifdef RTG_RX_FIXUP
+    pMblk->m_data += sizeof(UINT16);
+#endif
+    bcopy (mtod(pDrvCtrl->rtgRxMblk[pDrvCtrl->rtgRxIdx], char *),
+        mtod(pMblk, char *), len);
 
-    vxbDmaBufSync (pDev, pDrvCtrl->rtgMblkTag, pMap, VXB_DMABUFSYNC_POSTWRITE);
+    pMblk->m_len = pMblk->m_pkthdr.len = len;
+    pMblk->m_flags = M_PKTHDR|M_EXT;
 
-    /* Transfer descriptors to the chip. */
+    /* Give the original buffer back to the chip. */
 
-    pFirst->rtg_cmdsts |= htole32(RTG_TDESC_CMD_OWN);
+    rtgEndRxArm (pDrvCtrl, pDrvCtrl->rtgRxIdx);
 
-    return (OK);
-    }
+    pDrvCtrl->rtgRxCopies++;
 
+    return (pMblk);
+    }
 
 /******************************************************************************
 *
-* rtgEndSend - transmit a packet
+* rtgEndRxChain - add a fragment of a scattered frame to the RX chain
 *
-* This function transmits the packet specified in <pMblk>. The RealTek
-* 8139C+/8169 controllers implement true descriptor based DMA (unlike
-* the earlier 8139 devices). Each descriptor describes a single frame
-* fragment, and transfers are done in-place (zero copy). Frames will be
-* coalesced into a single buffer if not enough descriptors are available
-* to handle all the fragments. The transmitter performs automatic short
-* frame padding.
+* This routine is used with scatter RX, when a jumbo frame spans several
+* RX descriptors. <pMblk> holds the buffer taken from the current
+* descriptor, <rxFrag> its SOF and EOF status bits and <bufLen> the size
+* of the buffer. The first and middle fragments fill their buffers
+* completely, and are linked onto the partial frame kept in the driver
+* control structure. In the last descriptor, <rxLen> gives the length of
+* the whole frame, so the last fragment's length is whatever is left
+* over. The CRC is then trimmed, which may mean shortening the previous
+* fragment when the last one holds nothing but CRC bytes.
 *
-* RETURNS: OK, ERROR, or END_ERR_BLOCK.
+* A fragment without a frame to add to, or a new frame starting before
+* the last one ended, means the chain is broken; the pieces are dropped.
+*
+* RETURNS: the complete frame, or NULL if more fragments are expected or
+* the frame was dropped
 *
 * ERRNO: N/A
 */
 
-LOCAL int rtgEndSend
+LOCAL M_BLK_ID rtgEndRxChain
     (
-    END_OBJ * pEnd,
-    M_BLK_ID pMblk
+    RTG_DRV_CTRL * pDrvCtrl,
+    M_BLK_ID pMblk,
+    UINT32 rxFrag,
+    int rxLen,
+    int bufLen
     )
     {
-    RTG_DRV_CTRL * pDrvCtrl;
-    VXB_DEVICE_ID pDev;
-    M_BLK_ID pTmp;
-    int rval, len;
+    M_BLK_ID pHead;
+    int len;
 
-    pDrvCtrl = (RTG_DRV_CTRL *)pEnd;
+    pMblk->m_next = NULL;
 
-    if (pDrvCtrl->rtgPolling == TRUE)
+    if (rxFrag & RTG_RDESC_STAT_SOF)
         {
-        netMblkClChainFree (pMblk);
-        return (ERROR);
+        if (pDrvCtrl->rtgRxHead != NULL)
+            {
+            netMblkClChainFree (pDrvCtrl->rtgRxHead);
+            pDrvCtrl->rtgRxChainErrs++;
+            }
+        pMblk->m_flags = M_PKTHDR|M_EXT;
+        pMblk->m_len = pMblk->m_pkthdr.len = bufLen;
+        pDrvCtrl->rtgRxHead = pDrvCtrl->rtgRxTail = pMblk;
+        return (NULL);
         }
 
-    pDev = pDrvCtrl->rtgDev;
+    pHead = pDrvCtrl->rtgRxHead;
 
-    END_TX_SEM_TAKE (pEnd, WAIT_FOREVER); 
+    if (pHead == NULL)
+        {
+        netMblkClChainFree (pMblk);
+        pDrvCtrl->rtgRxChainErrs++;
+        return (NULL);
+        }
 
-    if (!pDrvCtrl->rtgTxFree || !(pDrvCtrl->rtgCurStatus & IFM_ACTIVE))
+    pMblk->m_flags = M_EXT;
+
+    if (!(rxFrag & RTG_RDESC_STAT_EOF))
+        {
+        pMblk->m_len = bufLen;
+        pHead->m_pkthdr.len += bufLen;
+        pDrvCtrl->rtgRxTail->m_next = pMblk;
+        pDrvCtrl->rtgRxTail = pMblk;
+        return (NULL);
+        }
+
+    pDrvCtrl->rtgRxHead = NULL;
+
+    len = rxLen - pHead->m_pkthdr.len;
+    if (len <= 0 || len > bufLen || rxLen <= ETHER_CRC_LEN + ETHER_HDR_LEN)
+        {
+        netMblkClChainFree (pMblk);
+        netMblkClChainFree (pHead);
+        pDrvCtrl->rtgRxChainErrs++;
+        return (NULL);
+        }
+
+    if (len <= ETHER_CRC_LEN)
+        {
+        pDrvCtrl->rtgRxTail->m_len -= ETHER_CRC_LEN - len;
+        netMblkClChainFree (pMblk);
+        }
+    else
+        {
+        pMblk->m_len = len - ETHER_CRC_LEN;
+        pDrvCtrl->rtgRxTail->m_next = pMblk;
+        }
+
+    pHead->m_pkthdr.len = rxLen - ETHER_CRC_LEN;
+    pDrvCtrl->rtgRxChains++;
+
+    return (pHead);
+    }
+
+/******************************************************************************
+*
+* rtgCbPoolCreate - create the RX copybreak cluster pool
+*
+* This routine creates a private netBufLib pool of RTG_CB_CLSIZE byte
+* clusters for RX copybreak, with RTG_CB_RATIO clusters per RX
+* descriptor so that copied frames queued in the stack don't starve
+* the RX handler. It is called from rtgEndLoad() when the rxCopybreak
+* parameter is set.
+*
+* RETURNS: OK, or ERROR if memory could not be allocated or the pool
+* could not be initialized
+*
+* ERRNO: N/A
+*/
+
+LOCAL STATUS rtgCbPoolCreate
+    (
+    RTG_DRV_CTRL * pDrvCtrl
+    )
+    {
+    M_CL_CONFIG mClConfig;
+    CL_DESC clDesc;
+    int nClusters;
+
+    nClusters = pDrvCtrl->rtgRxDescCnt * RTG_CB_RATIO;
+
+    bzero ((char *)&mClConfig, sizeof(mClConfig));
+    bzero ((char *)&clDesc, sizeof(clDesc));
+
+    mClConfig.mBlkNum = nClusters;
+    mClConfig.clBlkNum = nClusters;
+    mClConfig.memSize = (nClusters * (M_BLK_SZ + sizeof(long))) +
+        (nClusters * CL_BLK_SZ);
+
+    clDesc.clSize = RTG_CB_CLSIZE;
+    clDesc.clNum = nClusters;
+    clDesc.memSize = nClusters * (RTG_CB_CLSIZE + sizeof(long));
+
+    pDrvCtrl->rtgCbPool = malloc (sizeof(NET_POOL));
+    pDrvCtrl->rtgCbMblkMem = memalign (_CACHE_ALIGN_SIZE, mClConfig.memSize);
+    pDrvCtrl->rtgCbClMem = memalign (_CACHE_ALIGN_SIZE, clDesc.memSize);
+
+    if (pDrvCtrl->rtgCbPool == NULL || pDrvCtrl->rtgCbMblkMem == NULL ||
+        pDrvCtrl->rtgCbClMem == NULL)
+        goto fail;
+
+    bzero ((char *)pDrvCtrl->rtgCbPool, sizeof(NET_POOL));
+    mClConfig.memArea = pDrvCtrl->rtgCbMblkMem;
+    clDesc.memArea = pDrvCtrl->rtgCbClMem;
+
+    if (netPoolInit (pDrvCtrl->rtgCbPool, &mClConfig, &clDesc, 1,
+        NULL) == OK)
+        return (OK);
+
+fail:
+    free (pDrvCtrl->rtgCbPool);
+    free (pDrvCtrl->rtgCbMblkMem);
+    free (pDrvCtrl->rtgCbClMem);
+    pDrvCtrl->rtgCbPool = NULL;
+    pDrvCtrl->rtgCbMblkMem = NULL;
+    pDrvCtrl->rtgCbClMem = NULL;
+
+    return (ERROR);
+    }
+
+/******************************************************************************
+*
+* rtgCbPoolDestroy - release the RX copybreak cluster pool
+*
+* This routine is called from rtgEndUnload() to tear down the pool
+* created by rtgCbPoolCreate(). It does nothing if copybreak is not
+* in use.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgCbPoolDestroy
+    (
+    RTG_DRV_CTRL * pDrvCtrl
+    )
+    {
+    if (pDrvCtrl->rtgCbPool == NULL)
+        return;
+
+    netPoolDelete (pDrvCtrl->rtgCbPool);
+    free (pDrvCtrl->rtgCbPool);
+    free (pDrvCtrl->rtgCbMblkMem);
+    free (pDrvCtrl->rtgCbClMem);
+    pDrvCtrl->rtgCbPool = NULL;
+    pDrvCtrl->rtgCbMblkMem = NULL;
+    pDrvCtrl->rtgCbClMem = NULL;
+
+    return;
+    }
+
+/******************************************************************************
+*
+* rtgRbPoolCreate - create the recycled RX buffer pool
+*
+* This routine is called from rtgInstInit2() when the rxRecycleCnt
+* parameter is set. It allocates <count> RX buffers, each large enough
+* for a full frame plus RTG_RB_HEADROOM bytes, creates a DMA map for each
+* one and loads it. The maps are never unloaded until the pool is
+* destroyed, so a recycled buffer can be put back into the RX ring
+* without any further vxbDmaBuf work. If any allocation fails, the
+* instance simply runs without recycling.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgRbPoolCreate
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    int count
+    )
+    {
+    VXB_DEVICE_ID pDev;
+    RTG_RX_BUF * pRb;
+    int bufSize;
+    int i;
+
+    pDev = pDrvCtrl->rtgDev;
+
+    if (pDrvCtrl->rtgMaxMtu == RTG_JUMBO_MTU &&
+        pDrvCtrl->rtgRxScatter == FALSE)
+        pDrvCtrl->rtgRbSize = END_JUMBO_CLSIZE;
+    else
+        pDrvCtrl->rtgRbSize = RTG_CLSIZE;
+
+    bufSize = ROUND_UP(pDrvCtrl->rtgRbSize + RTG_RB_HEADROOM,
+        _CACHE_ALIGN_SIZE);
+
+    pDrvCtrl->rtgRbPool = malloc (sizeof(RTG_RX_BUF) * count);
+    pDrvCtrl->rtgRbMem = memalign (_CACHE_ALIGN_SIZE, bufSize * count);
+
+    if (pDrvCtrl->rtgRbPool == NULL || pDrvCtrl->rtgRbMem == NULL)
+        {
+        RTG_LOGMSG("%s%d: RX recycle pool allocation failed\n", RTG_NAME,
+            pDev->unitNumber, 0, 0, 0, 0);
+        free (pDrvCtrl->rtgRbPool);
+        free (pDrvCtrl->rtgRbMem);
+        pDrvCtrl->rtgRbPool = NULL;
+        pDrvCtrl->rtgRbMem = NULL;
+        return;
+        }
+
+    SPIN_LOCK_ISR_INIT (&pDrvCtrl->rtgRbLock, 0);
+    pDrvCtrl->rtgRbFree = NULL;
+
+    for (i = 0; i < count; i++)
+        {
+        pRb = &pDrvCtrl->rtgRbPool[i];
+        pRb->rtgRbBuf = pDrvCtrl->rtgRbMem + (i * bufSize);
+
+        if (vxbDmaBufMapCreate (pDev, pDrvCtrl->rtgMblkTag, 0,
+            &pRb->rtgRbMap) == NULL)
+            break;
+
+        if (vxbDmaBufMapLoad (pDev, pDrvCtrl->rtgMblkTag, pRb->rtgRbMap,
+            pRb->rtgRbBuf + RTG_RB_HEADROOM, pDrvCtrl->rtgRbSize, 0) != OK)
+            {
+            vxbDmaBufMapDestroy (pDrvCtrl->rtgMblkTag, pRb->rtgRbMap);
+            break;
+            }
+
+        pRb->rtgRbMap->fragList[0].fragLen -= 8;
+
+        pRb->rtgRbNext = pDrvCtrl->rtgRbFree;
+        pDrvCtrl->rtgRbFree = pRb;
+        }
+
+    pDrvCtrl->rtgRbCnt = i;
+
+    if (i < count)
+        RTG_LOGMSG("%s%d: only %d of %d RX recycle buffers mapped\n",
+            RTG_NAME, pDev->unitNumber, i, count, 0, 0);
+
+    return;
+    }
+
+/******************************************************************************
+*
+* rtgRbPoolDestroy - release the recycled RX buffer pool
+*
+* This routine is called from rtgInstUnlink() to unload and destroy the
+* DMA maps of the recycled RX buffers. It does nothing if recycling is not
+* in use. The buffers themselves are not freed here, since the stack may
+* still hold some of them: see rtgRbRelease().
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgRbPoolDestroy
+    (
+    RTG_DRV_CTRL * pDrvCtrl
+    )
+    {
+    RTG_RX_BUF * pRb;
+    int i;
+
+    if (pDrvCtrl->rtgRbPool == NULL)
+        return;
+
+    for (i = 0; i < pDrvCtrl->rtgRbCnt; i++)
+        {
+        pRb = &pDrvCtrl->rtgRbPool[i];
+        vxbDmaBufMapUnload (pDrvCtrl->rtgMblkTag, pRb->rtgRbMap);
+        vxbDmaBufMapDestroy (pDrvCtrl->rtgMblkTag, pRb->rtgRbMap);
+        }
+
+    return;
+    }
+
+/******************************************************************************
+*
+* rtgRbRelease - free the recycled RX buffers and the instance
+*
+* This routine frees the recycled RX buffer pool, if there is one, and
+* the instance's RTG_DRV_CTRL structure, which rtgRbFree() uses to find
+* the free list. rtgInstUnlink() calls it directly when none of the
+* buffers is out. Otherwise, rtgRbFree() posts it as a job on
+* netJobQueueId when the stack frees the last outstanding buffer.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgRbRelease
+    (
+    void * pArg
+    )
+    {
+    RTG_DRV_CTRL * pDrvCtrl;
+
+    pDrvCtrl = member_to_object (pArg, RTG_DRV_CTRL, rtgRbJob);
+
+    free (pDrvCtrl->rtgRbPool);
+    free (pDrvCtrl->rtgRbMem);
+    free (pDrvCtrl);
+
+    return;
+    }
+
+/******************************************************************************
+*
+* rtgBncRingCreate - create the TX bounce ring
+*
+* This routine is called from rtgInstInit2() when the txBounceCnt
+* parameter is non-zero. It allocates <count> cache aligned buffers, each
+* large enough for a full frame, creates a DMA map for each one and loads
+* it. The maps stay loaded until the ring is destroyed, so coalescing a
+* frame into a bounce buffer costs one copy and a cache flush, with no
+* mBlk allocation and no map setup. If any allocation fails, the instance
+* runs with fewer buffers, or with none at all.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgBncRingCreate
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    int count
+    )
+    {
+    VXB_DEVICE_ID pDev;
+    int bufSize;
+    int i;
+
+    pDev = pDrvCtrl->rtgDev;
+
+    /* Leave room for a VLAN tag inserted in the frame by the stack. */
+
+    bufSize = ROUND_UP(pDrvCtrl->rtgMaxMtu + ETHER_HDR_LEN + 4,
+        _CACHE_ALIGN_SIZE);
+
+    pDrvCtrl->rtgBncMap = malloc (sizeof(VXB_DMA_MAP_ID) * count);
+    pDrvCtrl->rtgBncMem = memalign (_CACHE_ALIGN_SIZE, bufSize * count);
+
+    if (pDrvCtrl->rtgBncMap == NULL || pDrvCtrl->rtgBncMem == NULL)
+        {
+        RTG_LOGMSG("%s%d: TX bounce ring allocation failed\n", RTG_NAME,
+            pDev->unitNumber, 0, 0, 0, 0);
+        free (pDrvCtrl->rtgBncMap);
+        free (pDrvCtrl->rtgBncMem);
+        pDrvCtrl->rtgBncMap = NULL;
+        pDrvCtrl->rtgBncMem = NULL;
+        return;
+        }
+
+    /*
+     * Each buffer must map to a single segment, since rtgEndEncap()
+     * only ever uses the first one.
+     */
+
+    for (i = 0; i < count; i++)
+        {
+        if (vxbDmaBufMapCreate (pDev, pDrvCtrl->rtgMblkTag, 0,
+            &pDrvCtrl->rtgBncMap[i]) == NULL)
+            break;
+
+        if (vxbDmaBufMapLoad (pDev, pDrvCtrl->rtgMblkTag,
+            pDrvCtrl->rtgBncMap[i], pDrvCtrl->rtgBncMem + (i * bufSize),
+            bufSize, 0) != OK)
+            {
+            vxbDmaBufMapDestroy (pDrvCtrl->rtgMblkTag,
+                pDrvCtrl->rtgBncMap[i]);
+            break;
+            }
+
+        if (pDrvCtrl->rtgBncMap[i]->nFrags != 1)
+            {
+            vxbDmaBufMapUnload (pDrvCtrl->rtgMblkTag, pDrvCtrl->rtgBncMap[i]);
+            vxbDmaBufMapDestroy (pDrvCtrl->rtgMblkTag,
+                pDrvCtrl->rtgBncMap[i]);
+            break;
+            }
+        }
+
+    pDrvCtrl->rtgBncCnt = i;
+    pDrvCtrl->rtgBncSize = bufSize;
+    pDrvCtrl->rtgBncProd = 0;
+    pDrvCtrl->rtgBncFree = i;
+
+    if (i < count)
+        RTG_LOGMSG("%s%d: only %d of %d TX bounce buffers mapped\n",
+            RTG_NAME, pDev->unitNumber, i, count, 0, 0);
+
+    return;
+    }
+
+/******************************************************************************
+*
+* rtgBncRingDestroy - release the TX bounce ring
+*
+* This routine is called from rtgInstUnlink() to unload and destroy the
+* DMA maps of the TX bounce buffers and free their memory. It does
+* nothing if the bounce ring is not in use.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgBncRingDestroy
+    (
+    RTG_DRV_CTRL * pDrvCtrl
+    )
+    {
+    int i;
+
+    if (pDrvCtrl->rtgBncMap == NULL)
+        return;
+
+    for (i = 0; i < pDrvCtrl->rtgBncCnt; i++)
+        {
+        vxbDmaBufMapUnload (pDrvCtrl->rtgMblkTag, pDrvCtrl->rtgBncMap[i]);
+        vxbDmaBufMapDestroy (pDrvCtrl->rtgMblkTag, pDrvCtrl->rtgBncMap[i]);
+        }
+
+    free (pDrvCtrl->rtgBncMap);
+    free (pDrvCtrl->rtgBncMem);
+    pDrvCtrl->rtgBncMap = NULL;
+    pDrvCtrl->rtgBncMem = NULL;
+    pDrvCtrl->rtgBncCnt = 0;
+    pDrvCtrl->rtgBncFree = 0;
+
+    return;
+    }
+
+/******************************************************************************
+*
+* rtgHpRingCreate - create the high priority TX ring
+*
+* This routine is called from rtgInstInit2() when the txHpDescCnt
+* parameter is set. It allocates a ring of <count> TX descriptors for
+* the chip's high priority queue, and a buffer for each descriptor, big
+* enough for the largest frame the instance sends. The buffers are DMA
+* mapped once, here, and stay mapped until the ring is destroyed. If any
+* allocation fails, the ring is released again and the instance runs
+* without it.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgHpRingCreate
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    int count,
+    ULONG lowAddr
+    )
+    {
+    VXB_DEVICE_ID pDev;
+    int bufSize;
+    int i;
+
+    pDev = pDrvCtrl->rtgDev;
+
+    pDrvCtrl->rtgHpDescTag = vxbDmaBufTagCreate (pDev,
+        pDrvCtrl->rtgParentTag,		/* parent */
+        256,				/* alignment */
+        0,				/* boundary */
+        lowAddr,			/* lowaddr */
+        VXB_SPACE_MAXADDR,		/* highaddr */
+        NULL,				/* filter */
+        NULL,				/* filterarg */
+        sizeof(RTG_DESC) * count,	/* max size */
+        1,				/* nSegments */
+        sizeof(RTG_DESC) * count,	/* max seg size */
+        pDrvCtrl->rtgDescCached == TRUE && RTG_DESC_COHERENT == TRUE ?
+        VXB_DMABUF_ALLOCNOW :
+        VXB_DMABUF_ALLOCNOW|VXB_DMABUF_NOCACHE,	/* flags */
+        NULL,				/* lockfunc */
+        NULL,				/* lockarg */
+        NULL);				/* ppDmaTag */
+
+    if (pDrvCtrl->rtgHpDescTag == NULL)
+        goto fail;
+
+    pDrvCtrl->rtgHpDescMem = vxbDmaBufMemAlloc (pDev,
+        pDrvCtrl->rtgHpDescTag, NULL, 0, &pDrvCtrl->rtgHpDescMap);
+
+    bufSize = ROUND_UP(pDrvCtrl->rtgMaxMtu + ETHER_HDR_LEN + 4,
+        _CACHE_ALIGN_SIZE);
+
+    pDrvCtrl->rtgHpMap = malloc (sizeof(VXB_DMA_MAP_ID) * count);
+    pDrvCtrl->rtgHpMem = memalign (_CACHE_ALIGN_SIZE, bufSize * count);
+
+    if (pDrvCtrl->rtgHpDescMem == NULL || pDrvCtrl->rtgHpMap == NULL ||
+        pDrvCtrl->rtgHpMem == NULL)
+        goto fail;
+
+    for (i = 0; i < count; i++)
+        {
+        if (vxbDmaBufMapCreate (pDev, pDrvCtrl->rtgMblkTag, 0,
+            &pDrvCtrl->rtgHpMap[i]) == NULL)
+            break;
+
+        if (vxbDmaBufMapLoad (pDev, pDrvCtrl->rtgMblkTag,
+            pDrvCtrl->rtgHpMap[i], pDrvCtrl->rtgHpMem + (i * bufSize),
+            bufSize, 0) != OK)
+            {
+            vxbDmaBufMapDestroy (pDrvCtrl->rtgMblkTag, pDrvCtrl->rtgHpMap[i]);
+            break;
+            }
+
+        if (pDrvCtrl->rtgHpMap[i]->nFrags != 1)
+            {
+            vxbDmaBufMapUnload (pDrvCtrl->rtgMblkTag, pDrvCtrl->rtgHpMap[i]);
+            vxbDmaBufMapDestroy (pDrvCtrl->rtgMblkTag, pDrvCtrl->rtgHpMap[i]);
+            break;
+            }
+        }
+
+    pDrvCtrl->rtgHpDescCnt = i;
+    pDrvCtrl->rtgHpSize = bufSize;
+
+    /* Every descriptor needs a buffer: a partial ring is no use. */
+
+    if (i == count)
+        return;
+
+fail:
+    RTG_LOGMSG("%s%d: high priority TX ring allocation failed\n", RTG_NAME,
+        pDev->unitNumber, 0, 0, 0, 0);
+    rtgHpRingDestroy (pDrvCtrl);
+
+    return;
+    }
+
+/******************************************************************************
+*
+* rtgHpRingDestroy - release the high priority TX ring
+*
+* This routine is called from rtgInstUnlink(), and by rtgHpRingCreate()
+* when it fails, to unload and destroy the DMA maps of the high priority
+* TX buffers and free them and the descriptor ring. Afterwards the ring
+* is disabled.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgHpRingDestroy
+    (
+    RTG_DRV_CTRL * pDrvCtrl
+    )
+    {
+    int i;
+
+    for (i = 0; i < pDrvCtrl->rtgHpDescCnt; i++)
+        {
+        vxbDmaBufMapUnload (pDrvCtrl->rtgMblkTag, pDrvCtrl->rtgHpMap[i]);
+        vxbDmaBufMapDestroy (pDrvCtrl->rtgMblkTag, pDrvCtrl->rtgHpMap[i]);
+        }
+
+    if (pDrvCtrl->rtgHpDescMem != NULL)
+        vxbDmaBufMemFree (pDrvCtrl->rtgHpDescTag, pDrvCtrl->rtgHpDescMem,
+            pDrvCtrl->rtgHpDescMap);
+    if (pDrvCtrl->rtgHpDescTag != NULL)
+        vxbDmaBufTagDestroy (pDrvCtrl->rtgHpDescTag);
+
+    free (pDrvCtrl->rtgHpMap);
+    free (pDrvCtrl->rtgHpMem);
+    pDrvCtrl->rtgHpDescTag = NULL;
+    pDrvCtrl->rtgHpDescMem = NULL;
+    pDrvCtrl->rtgHpMap = NULL;
+    pDrvCtrl->rtgHpMem = NULL;
+    pDrvCtrl->rtgHpDescCnt = 0;
+
+    return;
+    }
+
+/******************************************************************************
+*
+* rtgRbGet - get a recycled RX buffer
+*
+* This routine takes a buffer from the recycled RX buffer free list and
+* joins it to an mBlk and clBlk from the instance's netpool, with
+* rtgRbFree() as the cluster free routine. The buffer is returned through
+* <ppRb>, which is set to NULL if no recycled buffer could be used; the
+* caller then falls back to endPoolTupleGet(). The hit and miss counters
+* reported by EIOCGRTGRXSTATS are updated here.
+*
+* RETURNS: an mBlk tuple for the recycled buffer, or NULL
+*
+* ERRNO: N/A
+*/
+
+LOCAL M_BLK_ID rtgRbGet
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    RTG_RX_BUF ** ppRb
+    )
+    {
+    RTG_RX_BUF * pRb;
+    M_BLK_ID pMblk;
+    CL_BLK_ID pClBlk;
+
+    *ppRb = NULL;
+
+    if (pDrvCtrl->rtgRbPool == NULL)
+        return (NULL);
+
+    SPIN_LOCK_ISR_TAKE (&pDrvCtrl->rtgRbLock);
+    pRb = pDrvCtrl->rtgRbFree;
+    if (pRb != NULL)
+        {
+        pDrvCtrl->rtgRbFree = pRb->rtgRbNext;
+        pDrvCtrl->rtgRbOut++;
+        }
+    SPIN_LOCK_ISR_GIVE (&pDrvCtrl->rtgRbLock);
+
+    if (pRb == NULL)
+        {
+        pDrvCtrl->rtgRbMisses++;
+        return (NULL);
+        }
+
+    pMblk = netMblkGet (pDrvCtrl->rtgEndObj.pNetPool, M_DONTWAIT, MT_DATA);
+    pClBlk = netClBlkGet (pDrvCtrl->rtgEndObj.pNetPool, M_DONTWAIT);
+
+    if (pMblk == NULL || pClBlk == NULL)
+        {
+        if (pMblk != NULL)
+            netMblkFree (pDrvCtrl->rtgEndObj.pNetPool, pMblk);
+        if (pClBlk != NULL)
+            netClBlkFree (pDrvCtrl->rtgEndObj.pNetPool, pClBlk);
+        rtgRbFree (pDrvCtrl, pRb);
+        pDrvCtrl->rtgRbMisses++;
+        return (NULL);
+        }
+
+    netClBlkJoin (pClBlk, pRb->rtgRbBuf,
+        pDrvCtrl->rtgRbSize + RTG_RB_HEADROOM, (FUNCPTR)rtgRbFree,
+        (_Vx_usr_arg_t)pDrvCtrl, (_Vx_usr_arg_t)pRb, 0);
+    netMblkClJoin (pMblk, pClBlk);
+
+    pMblk->m_data += RTG_RB_HEADROOM;
+    pMblk->m_len = pMblk->m_pkthdr.len = pDrvCtrl->rtgRbSize;
+    pMblk->m_flags |= M_PKTHDR;
+    pMblk->m_next = NULL;
+
+    pDrvCtrl->rtgRbHits++;
+    *ppRb = pRb;
+
+    return (pMblk);
+    }
+
+/******************************************************************************
+*
+* rtgRbFree - return a recycled RX buffer to the free list
+*
+* This routine is the cluster free routine for recycled RX buffers. It is
+* called by netBufLib when the stack frees an mBlk chain which references
+* one of them, and may run in any context, so the free list is protected
+* with an ISR-callable spinlock. The buffer's DMA mapping is left intact.
+*
+* Once the instance has been unlinked, the last buffer to come back
+* posts rtgRbRelease() to free the pool and the instance.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgRbFree
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    RTG_RX_BUF * pRb
+    )
+    {
+    BOOL last;
+
+    SPIN_LOCK_ISR_TAKE (&pDrvCtrl->rtgRbLock);
+    pRb->rtgRbNext = pDrvCtrl->rtgRbFree;
+    pDrvCtrl->rtgRbFree = pRb;
+    pDrvCtrl->rtgRbOut--;
+    last = (pDrvCtrl->rtgRbDying == TRUE && pDrvCtrl->rtgRbOut == 0);
+    SPIN_LOCK_ISR_GIVE (&pDrvCtrl->rtgRbLock);
+
+    if (last == TRUE)
+        {
+        QJOB_SET_PRI(&pDrvCtrl->rtgRbJob, NET_TASK_QJOB_PRI);
+        pDrvCtrl->rtgRbJob.func = rtgRbRelease;
+        jobQueuePost (netJobQueueId, &pDrvCtrl->rtgRbJob);
+        }
+
+    return;
+    }
+
+/******************************************************************************
+*
+* rtgRxGroupJoin - add an instance to the RX fairness group for its job queue
+*
+* This routine is called from rtgEndStart() for instances that have the
+* rxFairness parameter set. All such instances which use the same job
+* queue share a single RX group. The group has one job which services
+* the member instances in turn, rather than having each instance post
+* its own RX job. The group is created by its first member, and freed
+* by rtgRxGroupLeave() when its last member leaves.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgRxGroupJoin
+    (
+    RTG_DRV_CTRL * pDrvCtrl
+    )
+    {
+    RTG_RX_GROUP * pGrp;
+    int i;
+
+    if (pDrvCtrl->rtgRxGroup != NULL)
+        return;
+
+    semTake (rtgRxGroupSem, WAIT_FOREVER);
+
+    for (pGrp = rtgRxGroups; pGrp != NULL; pGrp = pGrp->rtgGrpNext)
+        {
+        if (pGrp->rtgGrpQueue == pDrvCtrl->rtgJobQueue)
+            break;
+        }
+
+    if (pGrp == NULL)
+        {
+        pGrp = malloc (sizeof(RTG_RX_GROUP));
+        if (pGrp == NULL)
+            {
+            semGive (rtgRxGroupSem);
+            return;
+            }
+        bzero ((char *)pGrp, sizeof(RTG_RX_GROUP));
+        pGrp->rtgGrpQueue = pDrvCtrl->rtgJobQueue;
+        QJOB_SET_PRI(&pGrp->rtgGrpJob, NET_TASK_QJOB_PRI);
+        pGrp->rtgGrpJob.func = rtgRxGroupHandle;
+        vxAtomic32Set (&pGrp->rtgGrpPending, FALSE);
+        pGrp->rtgGrpNext = rtgRxGroups;
+        rtgRxGroups = pGrp;
+        }
+
+    for (i = 0; i < RTG_RX_GROUP_MAX; i++)
+        {
+        if (pGrp->rtgGrpMembers[i] == NULL)
+            {
+            pGrp->rtgGrpMembers[i] = pDrvCtrl;
+            pDrvCtrl->rtgRxGroup = pGrp;
+            break;
+            }
+        }
+
+    semGive (rtgRxGroupSem);
+
+    if (i == RTG_RX_GROUP_MAX)
+        RTG_LOGMSG("%s%d: RX group full, fairness disabled\n", RTG_NAME,
+            pDrvCtrl->rtgDev->unitNumber, 0, 0, 0, 0);
+
+    return;
+    }
+
+/******************************************************************************
+*
+* rtgRxGroupLeave - remove an instance from its RX fairness group
+*
+* This routine is called from rtgEndStop() once all pending jobs for
+* the instance have completed. The group job only services members
+* whose RX pending flag is set, so once the flag has been cleared it
+* is safe to drop the instance from the group. When the last member
+* leaves, the group is unlinked so that no other instance can join it,
+* and freed once its job, which may still be queued, has run.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgRxGroupLeave
+    (
+    RTG_DRV_CTRL * pDrvCtrl
+    )
+    {
+    RTG_RX_GROUP * pGrp;
+    RTG_RX_GROUP ** ppGrp;
+    int members = 0;
+    int i;
+
+    pGrp = pDrvCtrl->rtgRxGroup;
+
+    semTake (rtgRxGroupSem, WAIT_FOREVER);
+
+    for (i = 0; i < RTG_RX_GROUP_MAX; i++)
+        {
+        if (pGrp->rtgGrpMembers[i] == pDrvCtrl)
+            pGrp->rtgGrpMembers[i] = NULL;
+        else if (pGrp->rtgGrpMembers[i] != NULL)
+            members++;
+        }
+
+    pDrvCtrl->rtgRxGroup = NULL;
+
+    if (members == 0)
+        {
+        for (ppGrp = &rtgRxGroups; *ppGrp != NULL;
+            ppGrp = &(*ppGrp)->rtgGrpNext)
+            {
+            if (*ppGrp == pGrp)
+                {
+                *ppGrp = pGrp->rtgGrpNext;
+                break;
+                }
+            }
+        }
+
+    semGive (rtgRxGroupSem);
+
+    if (members != 0)
+        return;
+
+    for (i = 0; i < RTG_TIMEOUT; i++)
+        {
+        if (vxAtomic32Get (&pGrp->rtgGrpPending) == FALSE)
+            break;
+        taskDelay (1);
+        }
+
+    /* Better to leak the group than to free it under a queued job. */
+
+    if (i == RTG_TIMEOUT)
+        RTG_LOGMSG("%s%d: timed out waiting for RX group job\n",
+            RTG_NAME, pDrvCtrl->rtgDev->unitNumber, 0, 0, 0, 0);
+    else
+        free (pGrp);
+
+    return;
+    }
+
+/******************************************************************************
+*
+* rtgRxGroupHandle - service the members of an RX fairness group
+*
+* This job is posted by rtgEndIntHandle() instead of the per-instance RX
+* job when the instance belongs to an RX group. Each invocation makes one
+* round over the group, giving every member with RX work pending a quantum
+* of rtgRxBudget * rtgRxWeight frames. Members that drain their ring have
+* their pending flag cleared. The starting member is rotated on every
+* round so that no instance is always served first. If any member still
+* has work after the round, the job reposts itself to the end of the
+* queue.
+*
+* All members of a group share the same job queue, so this routine is
+* serialized with rtgEndIntHandle() for every member.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgRxGroupHandle
+    (
+    void * pArg
+    )
+    {
+    RTG_RX_GROUP * pGrp;
+    RTG_DRV_CTRL * pDrvCtrl;
+    RTG_DRV_CTRL * members[RTG_RX_GROUP_MAX];
+    BOOL more = FALSE;
+    int quantum;
+    int i, idx;
+
+    pGrp = member_to_object (pArg, RTG_RX_GROUP, rtgGrpJob);
+
+    /*
+     * Take a snapshot of the members once per round. A member only
+     * leaves once its RX pending flag is clear, and it is not freed
+     * until it is unloaded, so a stale entry is simply skipped.
+     */
+
+    semTake (rtgRxGroupSem, WAIT_FOREVER);
+    bcopy ((char *)pGrp->rtgGrpMembers, (char *)members, sizeof(members));
+    semGive (rtgRxGroupSem);
+
+    for (i = 0; i < RTG_RX_GROUP_MAX; i++)
+        {
+        idx = (pGrp->rtgGrpStart + i) % RTG_RX_GROUP_MAX;
+        pDrvCtrl = members[idx];
+
+        if (pDrvCtrl == NULL ||
+            vxAtomic32Get (&pDrvCtrl->rtgRxPending) == FALSE)
+            continue;
+
+        quantum = pDrvCtrl->rtgRxBudget * pDrvCtrl->rtgRxWeight;
+
+        if (rtgEndRxProcess (pDrvCtrl, quantum) == quantum)
+            more = TRUE;
+        else
+            vxAtomic32Set (&pDrvCtrl->rtgRxPending, FALSE);
+        }
+
+    pGrp->rtgGrpStart = (pGrp->rtgGrpStart + 1) % RTG_RX_GROUP_MAX;
+
+    if (more == TRUE)
+        {
+        jobQueuePost (pGrp->rtgGrpQueue, &pGrp->rtgGrpJob);
+        return;
+        }
+
+    vxAtomic32Set (&pGrp->rtgGrpPending, FALSE);
+
+    return;
+    }
+
+/******************************************************************************
+*
+* rtgEndTxHandle - process TX completion events
+*
+* This function is scheduled by the ISR to run in the context of tNetTask
+* whenever an TX interrupt is received. It runs through all of the
+* TX register pairs and checks the TX status to see how many have
+* completed. For each completed transmission, the associated TX mBlk
+* is released, and the outbound packet stats are updated.
+*
+* In the event that a TX underrun error is detected, the TX FIFO
+* threshold is increased. This will continue until the maximum TX
+* FIFO threshold is reached.
+*
+* If the transmitter has stalled, this routine will also call muxTxRestart()
+* to drain any packets that may be waiting in the protocol send queues,
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgEndTxHandle
+    (
+    void * pArg
+    )
+    {
+    QJOB *pJob;
+    RTG_DRV_CTRL *pDrvCtrl;
+    BOOL restart;
+
+    pJob = pArg;
+    pDrvCtrl = member_to_object (pJob, RTG_DRV_CTRL, rtgTxJob);
+
+    END_TX_SEM_TAKE (&pDrvCtrl->rtgEndObj, WAIT_FOREVER); 
+
+    restart = rtgEndTxReclaim (pDrvCtrl);
+    if (pDrvCtrl->rtgTxRestart == TRUE)
+        {
+        pDrvCtrl->rtgTxRestart = FALSE;
+        restart = TRUE;
+        }
+
+    END_TX_SEM_GIVE (&pDrvCtrl->rtgEndObj); 
+
+    vxAtomic32Set (&pDrvCtrl->rtgTxPending, FALSE);
+
+    /* A restart requested since we looked gets a fresh job. */
+
+    if (pDrvCtrl->rtgTxRestart == TRUE &&
+        vxAtomic32Set (&pDrvCtrl->rtgTxPending, TRUE) == FALSE)
+        jobQueuePost (pDrvCtrl->rtgJobQueue, &pDrvCtrl->rtgTxJob);
+
+    /*
+     * Some chips will ignore a second TX request issued while an
+     * existing transmission is in progress. If the transmitter goes
+     * idle but there are still packets waiting to be sent, we need
+     * to restart the channel here to flush them out. This only seems
+     * to be required with the PCIe devices.
+     */
+
+    if (pDrvCtrl->rtgTxFree < pDrvCtrl->rtgTxDescCnt)
+        {
+        CSR_WRITE_1(pDrvCtrl->rtgDev, pDrvCtrl->rtgTxStartReg, RTG_TXPP_NPQ);
+        pDrvCtrl->rtgTxDoorbells++;
+        }
+
+    if (restart == TRUE)
+        muxTxRestart (pDrvCtrl);
+
+    return;
+    }
+
+/******************************************************************************
+*
+* rtgEndTxReclaim - reclaim completed TX descriptors
+*
+* This routine walks the TX DMA ring from the consumer index and releases
+* the mBlks and DMA maps of all transmissions the chip has completed,
+* updating the outbound packet stats as it goes. It is called with the
+* TX semaphore held, either from rtgEndTxHandle() or, when TX completion
+* interrupts are masked, from rtgEndSendBatch(). The high priority ring,
+* if in use, is reclaimed too, since a batch may be blocked on it.
+*
+* RETURNS: TRUE if the transmit channel was stalled and descriptors were
+* released, otherwise FALSE
+*
+* ERRNO: N/A
+*/
+
+LOCAL BOOL rtgEndTxReclaim
+    (
+    RTG_DRV_CTRL * pDrvCtrl
+    )
+    {
+    VXB_DMA_MAP_ID pMap;
+    RTG_DESC * pDesc;
+    UINT32 txSts;
+    BOOL restart = FALSE;
+    M_BLK_ID pMblk;
+    int done = 0;
+
+    while (pDrvCtrl->rtgTxFree < pDrvCtrl->rtgTxDescCnt)
+        {
+        pDesc = &pDrvCtrl->rtgTxDescMem[pDrvCtrl->rtgTxCons];
+        txSts = le32toh(pDesc->rtg_cmdsts);
+
+        if (txSts & RTG_TDESC_STAT_OWN)
+            break;
+
+        pMblk = pDrvCtrl->rtgTxMblk[pDrvCtrl->rtgTxCons];
+        pMap = pDrvCtrl->rtgTxMblkMap[pDrvCtrl->rtgTxCons];
+
+        if (pMblk != NULL)
+            {
+            done++;
+            vxbDmaBufMapUnload (pDrvCtrl->rtgMblkTag, pMap);
+            endPoolTupleFree (pMblk);
+            pDrvCtrl->rtgTxMblk[pDrvCtrl->rtgTxCons] = NULL;
+            }
+        else if (pDrvCtrl->rtgTxBnc[pDrvCtrl->rtgTxCons] == TRUE)
+            {
+            done++;
+            pDrvCtrl->rtgTxBnc[pDrvCtrl->rtgTxCons] = FALSE;
+            pDrvCtrl->rtgBncFree++;
+            }
+
+        pDesc->rtg_cmdsts &= htole32(RTG_TDESC_CMD_EOR);
+        pDesc->rtg_vlanctl = 0;
+
+        pDrvCtrl->rtgTxFree++;
+        RTG_INC_DESC (pDrvCtrl->rtgTxCons, pDrvCtrl->rtgTxDescCnt);
+
+        /*
+         * We released at least one descriptor: if the transmit
+         * channel is stalled, unstall it.
+         */
+
+        if (pDrvCtrl->rtgTxStall == TRUE)
+            {
+            pDrvCtrl->rtgTxStall = FALSE;
+            restart = TRUE;
+            }
+ 
+        }
+
+    if (done != 0)
+        (void) vxAtomic32Add (&pDrvCtrl->rtgIntrModPkts, done);
+
+    if (rtgEndHpReclaim (pDrvCtrl) == TRUE && pDrvCtrl->rtgTxStall == TRUE)
+        {
+        pDrvCtrl->rtgTxStall = FALSE;
+        restart = TRUE;
+        }
+
+    return (restart);
+    }
+
+/******************************************************************************
+*
+* rtgEndTxReclaimTimer - TX reclaim backstop timer
+*
+* This watchdog routine runs every txReclaimMs milliseconds while the
+* interface is up and TX completion interrupts are masked. If any
+* transmissions are outstanding, it schedules rtgEndTxHandle() so that
+* their buffers are released, and the stalled transmit channel is
+* restarted, even if nothing more is sent. It runs at interrupt level.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgEndTxReclaimTimer
+    (
+    RTG_DRV_CTRL * pDrvCtrl
+    )
+    {
+    if (pDrvCtrl->rtgTxReclaimRun == FALSE)
+        return;
+
+    if ((pDrvCtrl->rtgTxFree < pDrvCtrl->rtgTxDescCnt ||
+        pDrvCtrl->rtgHpFree < (UINT32)pDrvCtrl->rtgHpDescCnt) &&
+        vxAtomic32Set (&pDrvCtrl->rtgTxPending, TRUE) == FALSE)
+        {
+        pDrvCtrl->rtgTxReclaimTimers++;
+        jobQueuePost (pDrvCtrl->rtgJobQueue, &pDrvCtrl->rtgTxJob);
+        }
+
+    wdStart (pDrvCtrl->rtgTxReclaimWd, pDrvCtrl->rtgTxReclaimTicks,
+        (FUNCPTR)rtgEndTxReclaimTimer, (_Vx_usr_arg_t)pDrvCtrl);
+
+    return;
+    }
+
+/*****************************************************************************
+*
+* rtgEndIntHandle - task level interrupt handler
+*
+* This routine is scheduled to run in tNetTask by the interrupt service
+* routine whenever a chip interrupt occurs. This function will check
+* what interrupt events are pending and schedule additional jobs to
+* service them. Once there are no more events waiting to be serviced
+* (i.e. the chip has gone idle), interrupts will be unmasked so that
+* the ISR can fire again.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgEndIntHandle
+    (
+    void * pArg
+    )
+    {
+    QJOB *pJob;
+    RTG_DRV_CTRL *pDrvCtrl;
+    VXB_DEVICE_ID pDev;
+    UINT16 status;
+
+    pJob = pArg;
+    pDrvCtrl = member_to_object (pJob, RTG_DRV_CTRL, rtgIntJob);
+    pDev = pDrvCtrl->rtgDev;
+
+    if (pDrvCtrl->rtgHistOn == TRUE && pDrvCtrl->rtgIntTs != 0)
+        rtgHistStamp (pDrvCtrl, RTG_HIST_ISR_INT, pDrvCtrl->rtgIntTs);
+
+    status = CSR_READ_2(pDev, RTG_ISR);
+    CSR_WRITE_2(pDev, RTG_ISR, status);
+
+    /*
+     * When interrupt moderation is engaged, the RX and TX completion
+     * interrupts are masked and the countdown timer tells us when
+     * to service both rings.
+     */
+
+    if (status & RTG_ISR_RX_OFLOW)
+        pDrvCtrl->rtgRxFifoOflows++;
+
+    if (status & RTG_ISR_TIMER_EXPIRED)
+        {
+        pDrvCtrl->rtgIntrModTimerIntrs++;
+        status |= RTG_ISR_RX_OK|RTG_ISR_TX_OK;
+        }
+
+    /*
+     * A busy-poll port's frames are only ever picked up by its
+     * task. If the task isn't polling already, wake it; the RX
+     * interrupts stay masked while it polls.
+     */
+
+    if (status & RTG_RXINTRS && pDrvCtrl->rtgBusyPoll == TRUE)
+        {
+        if (vxAtomic32Set (&pDrvCtrl->rtgBusyActive, TRUE) == FALSE)
+            {
+            pDrvCtrl->rtgRxEvtTs = pDrvCtrl->rtgIntTs;
+            semGive (pDrvCtrl->rtgBusySem);
+            }
+        }
+    else if (status & RTG_RXINTRS &&
+        vxAtomic32Set (&pDrvCtrl->rtgRxPending, TRUE) == FALSE)
+        {
+        pDrvCtrl->rtgRxEvtTs = pDrvCtrl->rtgIntTs;
+        if (pDrvCtrl->rtgRxGroup == NULL)
+            jobQueuePost (pDrvCtrl->rtgJobQueue, &pDrvCtrl->rtgRxJob);
+        else if (vxAtomic32Set (&pDrvCtrl->rtgRxGroup->rtgGrpPending,
+            TRUE) == FALSE)
+            jobQueuePost (pDrvCtrl->rtgJobQueue,
+                &pDrvCtrl->rtgRxGroup->rtgGrpJob);
+        }
+
+    if (status & RTG_TXINTRS &&
+        vxAtomic32Set (&pDrvCtrl->rtgTxPending, TRUE) == FALSE)
+        jobQueuePost (pDrvCtrl->rtgJobQueue, &pDrvCtrl->rtgTxJob);
+
+    /* May as well just do this one directly. */
+    if (status & (RTG_ISR_LINKCHG|RTG_ISR_CABLE_LEN_CHGD))
+        rtgLinkUpdate (pDev);
+
+    if (CSR_READ_2(pDev, RTG_ISR) & pDrvCtrl->rtgIntrs)
+        {
+        /* The reposted job has no interrupt of its own to time. */
+
+        pDrvCtrl->rtgIntTs = 0;
+        jobQueuePost (pDrvCtrl->rtgJobQueue, &pDrvCtrl->rtgIntJob);
+        return;
+        }
+
+    vxAtomic32Set (&pDrvCtrl->rtgIntPending, FALSE);
+    pDrvCtrl->rtgIntrModIntrs++;
+    pDrvCtrl->rtgIntrs = rtgIntrModUpdate (pDrvCtrl) & pDrvCtrl->rtgIntrMask;
+    if (vxAtomic32Get (&pDrvCtrl->rtgBusyActive) == TRUE)
+        pDrvCtrl->rtgIntrs &= ~RTG_RXINTRS;
+    CSR_WRITE_2(pDev, RTG_IMR, pDrvCtrl->rtgIntrs);
+
+    return;
+    }
+
+/*****************************************************************************
+*
+* rtgIntrModUpdate - update the interrupt moderation state
+*
+* This routine is called by rtgEndIntHandle() just before interrupts
+* are unmasked again. It looks at how many frames were serviced since
+* the last call and decides whether the next batch of RX and TX
+* completions should be signalled by per-frame interrupts or by the
+* countdown timer.
+*
+* In static mode, the configured holdoff is used whenever at least
+* intrModFrames frames were serviced. In adaptive mode, an exponentially
+* weighted average of the frames serviced per interrupt is kept (in
+* 1/16ths of a frame), and the holdoff is doubled when this average is
+* above the target and halved when it falls below half the target.
+* Once the holdoff drops below RTG_INTRMOD_MINUSECS, moderation is
+* disengaged so that light traffic sees no added latency.
+*
+* RETURNS: the interrupt mask to program into the IMR register
+*
+* ERRNO: N/A
+*/
+
+LOCAL UINT16 rtgIntrModUpdate
+    (
+    RTG_DRV_CTRL * pDrvCtrl
+    )
+    {
+    VXB_DEVICE_ID pDev;
+    UINT32 pkts;
+    UINT32 cur;
+
+    if (pDrvCtrl->rtgIntrModMode == RTG_INTRMOD_OFF)
+        return (RTG_INTRS);
+
+    pDev = pDrvCtrl->rtgDev;
+    pkts = (UINT32)vxAtomic32Set (&pDrvCtrl->rtgIntrModPkts, 0);
+    cur = pDrvCtrl->rtgIntrModCur;
+
+    if (pDrvCtrl->rtgIntrModMode == RTG_INTRMOD_STATIC)
+        {
+        if (pkts >= pDrvCtrl->rtgIntrModFrames)
+            cur = pDrvCtrl->rtgIntrModUsecs;
+        else
+            cur = 0;
+        }
+    else
+        {
+        pDrvCtrl->rtgIntrModPpi = ((pDrvCtrl->rtgIntrModPpi * 3) +
+            (pkts << 4)) >> 2;
+
+        if (pDrvCtrl->rtgIntrModPpi > (pDrvCtrl->rtgIntrModFrames << 4))
+            {
+            if (cur == 0)
+                cur = RTG_INTRMOD_MINUSECS;
+            else
+                cur <<= 1;
+            if (cur > pDrvCtrl->rtgIntrModUsecs)
+                cur = pDrvCtrl->rtgIntrModUsecs;
+            }
+        else if (pDrvCtrl->rtgIntrModPpi < (pDrvCtrl->rtgIntrModFrames << 3))
+            {
+            cur >>= 1;
+            if (cur < RTG_INTRMOD_MINUSECS)
+                cur = 0;
+            }
+        }
+
+    pDrvCtrl->rtgIntrModCur = cur;
+
+    if (cur == 0)
+        {
+        CSR_WRITE_4(pDev, pDrvCtrl->rtgTimerIntReg, 0);
+        return (RTG_INTRS);
+        }
+
+    /* Restart the count and arm the timer. */
+
+    CSR_WRITE_4(pDev, RTG_TIMER, 0);
+    CSR_WRITE_4(pDev, pDrvCtrl->rtgTimerIntReg, cur * pDrvCtrl->rtgTimerClk);
+
+    return (RTG_INTRMOD_INTRS);
+    }
+
+/******************************************************************************
+*
+* rtgEndTxOffload - work out the offload bits for an outbound packet
+*
+* This routine computes the checksum offload and VLAN tag bits which the
+* descriptors of the packet <pMblk> need, other than the large send bits.
+* The bits for the command word of each descriptor are returned through
+* <pCmdSts>, and those for the vlanctl word of the first descriptor
+* through <pVlanCtl>, both in host order. If <tso> is TRUE, only the VLAN
+* tag is returned, since the chip doesn't use the checksum bits in large
+* send mode.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgEndTxOffload
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    M_BLK_ID pMblk,
+    BOOL tso,
+    UINT32 * pCmdSts,
+    UINT32 * pVlanCtl
+    )
+    {
+    UINT32 cmdSts = 0;
+    UINT32 vlanCtl = 0;
+    UINT8 * pData;
+    int l4Off;
+
+    if (tso == FALSE && pDrvCtrl->rtgDescV2 == FALSE &&
+        pDrvCtrl->rtgCaps.cap_enabled & IFCAP_TXCSUM)
+        {
+        /*
+         * Even when the stack wants only the transport checksum offloaded,
+         * the device needs to be asked to do the IP checksum also,
+         * or it doesn't do the transport checksum.
+         * The IP checksum offload is not adversely affected by the fact
+         * that the IP header already has the checksum stored in the
+         * checksum field; the device apparently skips this field when
+         * calculating the IP header checksum.
+         */
+        if (pMblk->m_pkthdr.csum_flags & CSUM_TCP)
+            cmdSts |= (RTG_TDESC_CMD_TCPCSUM | RTG_TDESC_CMD_IPCSUM);
+        else if (pMblk->m_pkthdr.csum_flags & CSUM_UDP)
+            cmdSts |= (RTG_TDESC_CMD_UDPCSUM | RTG_TDESC_CMD_IPCSUM);
+        else if (pMblk->m_pkthdr.csum_flags & CSUM_IP)
+            cmdSts |= RTG_TDESC_CMD_IPCSUM;
+        }
+
+    /*
+     * For the RTL8168C, RTL8168CP, RTL8168D and RTL8102E devices,
+     * the checksum offload bits have been moved to the vlanctl
+     * control word. They're not used with large sends, and they
+     * don't depend on VLAN tag insertion being enabled. For
+     * IPv6, the chip also needs the offset of the TCP or UDP
+     * header from the start of the frame, which accounts for
+     * any extension headers, and for an 802.1Q tag in the frame
+     * when the chip isn't inserting it.
+     */
+
+    if (tso == FALSE && pDrvCtrl->rtgDescV2 == TRUE)
+        {
+        if (pMblk->m_pkthdr.csum_flags & (CSUM_TCPv6|CSUM_UDPv6))
+            {
+            if (pDrvCtrl->rtgCaps.cap_enabled & IFCAP_IPV6CSUM)
+                {
+                pData = (UINT8 *)pMblk->m_data;
+                l4Off = ETHER_HDR_LEN + CSUM_IP_HDRLEN(pMblk);
+                if (pMblk->m_len >= ETHER_HDR_LEN &&
+                    ((pData[12] << 8) | pData[13]) == RTG_ETHERTYPE_VLAN)
+                    l4Off += 4;
+                vlanCtl |= RTG_TDESC_VLANCTL_IPV6CSUM |
+                    ((l4Off << RTG_TDESC_VLANCTL_TCPHO_SHIFT) &
+                    RTG_TDESC_VLANCTL_TCPHO) |
+                    ((pMblk->m_pkthdr.csum_flags & CSUM_TCPv6) ?
+                    RTG_TDESC_VLANCTL_TCPCSUM : RTG_TDESC_VLANCTL_UDPCSUM);
+                }
+            }
+        else if (pDrvCtrl->rtgCaps.cap_enabled & IFCAP_TXCSUM)
+            {
+            if (pMblk->m_pkthdr.csum_flags & CSUM_TCP)
+                vlanCtl |= RTG_TDESC_VLANCTL_TCPCSUM|RTG_TDESC_VLANCTL_IPCSUM;
+            else if (pMblk->m_pkthdr.csum_flags & CSUM_UDP)
+                vlanCtl |= RTG_TDESC_VLANCTL_UDPCSUM|RTG_TDESC_VLANCTL_IPCSUM;
+            else if (pMblk->m_pkthdr.csum_flags & CSUM_IP)
+                vlanCtl |= RTG_TDESC_VLANCTL_IPCSUM;
+            }
+        }
+
+    if (pDrvCtrl->rtgCaps.cap_enabled & IFCAP_VLAN_HWTAGGING &&
+        pMblk->m_pkthdr.csum_flags & CSUM_VLAN)
+        vlanCtl |= htons(pMblk->m_pkthdr.vlan) | RTG_TDESC_VLANCTL_TAG;
+
+    *pCmdSts = cmdSts;
+    *pVlanCtl = vlanCtl;
+
+    return;
+    }
+
+/******************************************************************************
+*
+* rtgEndTxAccount - count an outbound packet
+*
+* This routine updates the TX octet and cast counters for the packet
+* <pMblk>, and passes it to the capture tap if one is enabled. It is
+* called once the packet has been placed on a TX ring, while its header
+* is still in the cache, rather than when the transmission completes.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgEndTxAccount
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    M_BLK_ID pMblk
+    )
+    {
+    pDrvCtrl->rtgTxCnt->rtgCntOctets += pMblk->m_pkthdr.len;
+    if ((UINT8)pMblk->m_data[0] == 0xFF)
+        pDrvCtrl->rtgTxCnt->rtgCntBcasts++;
+    else if ((UINT8)pMblk->m_data[0] & 0x1)
+        pDrvCtrl->rtgTxCnt->rtgCntMcasts++;
+    else
+        pDrvCtrl->rtgTxCnt->rtgCntUcasts++;
+
+    if (pDrvCtrl->rtgTap != NULL)
+        rtgTapRecord (pDrvCtrl->rtgTap, pMblk, RTG_TAP_TX);
+
+    return;
+    }
+
+/******************************************************************************
+*
+* rtgEndEncap - encapsulate an outbound packet in the TX DMA ring
+*
+* This function sets up a descriptor for a packet transmit operation.
+* With the RealTek 'cplus' style devices, the TX DMA ring consists of
+* descriptors that each describe a single packet fragment. We consume
+* as many descriptors as there are mBlks in the outgoing packet, unless
+* the chain is too long. The length is limited by the number of DMA
+* segments we want to allow in a given DMA map. If there are too many
+* segments, this routine will fail, and the caller must coalesce the
+* data into fewer buffers and try again.
+*
+* This routine will also fail if there aren't enough free descriptors
+* available in the ring, in which case the caller must defer the
+* transmission until more descriptors are completed by the chip.
+*
+* If <pBncMap> is not NULL, the frame has already been copied into the
+* TX bounce buffer it maps, and fragList[0].fragLen holds its length.
+* The frame then takes a single descriptor, and <pMblk> is only used for
+* its offload flags: it is not kept, so the caller can free it as soon
+* as this routine returns OK.
+*
+* The packet is not counted here: the caller passes it to
+* rtgEndTxAccount() once it is queued, so that a large send is counted
+* once whether the chip or rtgEndTsoSoft() cuts it into frames.
+*
+* RETURNS: ENOSPC if there are too many fragments in the packet, EAGAIN
+* if the DMA ring is full, otherwise OK.
+*
+* ERRNO: N/A
+*/
+
+LOCAL int rtgEndEncap
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    M_BLK_ID pMblk,
+    VXB_DMA_MAP_ID pBncMap
+    )
+    {
+    VXB_DEVICE_ID pDev;
+    VXB_DMA_MAP_ID pMap;
+    RTG_DESC * pDesc, * pFirst;
+    UINT32 firstIdx, lastIdx = 0;
+    UINT32 cmdSts = 0;
+    UINT32 tsoSts = 0;
+    UINT32 csumSts, vlanCtl;
+    BOOL tso;
+    int i;
+
+    pDev = pDrvCtrl->rtgDev;
+    firstIdx = pDrvCtrl->rtgTxProd;
+    pMap = pDrvCtrl->rtgTxMblkMap[pDrvCtrl->rtgTxProd];
+
+    if (pDrvCtrl->rtgTxMblk[pDrvCtrl->rtgTxProd] != NULL ||
+        pDrvCtrl->rtgTxBnc[pDrvCtrl->rtgTxProd] == TRUE)
+        return (EAGAIN);
+
+    /*
+     * Load the DMA map to build the segment list.
+     * This will fail if there are too many segments.
+     * A bounce buffer is already loaded.
+     */
+
+    if (pBncMap != NULL)
+        {
+        if (pDrvCtrl->rtgTxFree == 0)
+            return (EAGAIN);
+        pMap = pBncMap;
+        }
+    else
+        {
+        if (vxbDmaBufMapMblkLoad (pDev, pDrvCtrl->rtgMblkTag,
+            pMap, pMblk, 0) != OK)
+            {
+            vxbDmaBufMapUnload (pDrvCtrl->rtgMblkTag, pMap);
+            return (ENOSPC);
+            }
+
+        /* The chain is fine, the ring is just too full for it now. */
+
+        if (pMap->nFrags > pDrvCtrl->rtgTxFree)
+            {
+            vxbDmaBufMapUnload (pDrvCtrl->rtgMblkTag, pMap);
+            return (EAGAIN);
+            }
+        }
+
+    pFirst = &pDrvCtrl->rtgTxDescMem[pDrvCtrl->rtgTxProd];
+
+    /*
+     * For a large send, the LGSEND bit must be set in every
+     * descriptor. On the older chips the MSS goes in the command
+     * word too, replacing the checksum offload bits, which the
+     * chip doesn't need in large send mode. On the V2 chips, the
+     * MSS goes in the vlanctl word of the first descriptor.
+     */
+
+    tso = (pMblk->m_pkthdr.csum_flags & CSUM_TSO) &&
+        pDrvCtrl->rtgTsoMode == RTG_TSO_HW;
+
+    if (tso == TRUE)
+        {
+        tsoSts = RTG_TDESC_CMD_LGSEND;
+        if (pDrvCtrl->rtgDescV2 == FALSE)
+            tsoSts |= (RTG_TSO_MSS(pMblk) << RTG_TDESC_CMD_MSSVAL_SHIFT) &
+                RTG_TDESC_CMD_MSSVAL;
+        pDrvCtrl->rtgTxTsoHw++;
+        }
+
+    rtgEndTxOffload (pDrvCtrl, pMblk, tso, &csumSts, &vlanCtl);
+
+    for (i = 0; i < pMap->nFrags; i++)
+        {
+        pDesc = &pDrvCtrl->rtgTxDescMem[pDrvCtrl->rtgTxProd];
+        pDesc->rtg_bufaddr_lo = htole32(RTG_ADDR_LO(pMap->fragList[i].frag));
+        pDesc->rtg_bufaddr_hi = htole32(RTG_ADDR_HI(pMap->fragList[i].frag));
+
+        cmdSts = (UINT32)(pMap->fragList[i].fragLen & RTG_TDESC_CMD_FRAGLEN);
+
+        if (i == 0)
+            cmdSts |= RTG_TDESC_CMD_SOF;
+        else
+            cmdSts |= RTG_TDESC_CMD_OWN;
+
+        if (i == (pMap->nFrags - 1))
+            cmdSts |= RTG_TDESC_CMD_EOF;
+        if (pDrvCtrl->rtgTxProd == (pDrvCtrl->rtgTxDescCnt - 1))
+            cmdSts |= RTG_TDESC_CMD_EOR;
+
+        /*
+         * Checksum offload bits must be set in all descriptors
+         * for a given packet where we want checksum offloading
+         * to be performed.
+         */
+
+        cmdSts |= (tso == TRUE ? tsoSts : csumSts);
+
+        pDesc->rtg_cmdsts = htole32(cmdSts);
+        pDrvCtrl->rtgTxFree--;
+        lastIdx = pDrvCtrl->rtgTxProd;
+        RTG_INC_DESC(pDrvCtrl->rtgTxProd, pDrvCtrl->rtgTxDescCnt);
+        }
+
+    /*
+     * A bounce buffer is released, in ring order, when its
+     * descriptor completes, and its map is never unloaded.
+     */
+
+    if (pBncMap != NULL)
+        pDrvCtrl->rtgTxBnc[lastIdx] = TRUE;
+    else
+        {
+        /* Save the mBlk for later. */
+        pDrvCtrl->rtgTxMblk[lastIdx] = pMblk;
+
+        /*
+         * Insure that the map for this transmission
+         * is placed at the array index of the last descriptor
+         * in this chain.  (Swap last and first dmamaps.)
+         */
+
+        pDrvCtrl->rtgTxMblkMap[firstIdx] = pDrvCtrl->rtgTxMblkMap[lastIdx];
+
+        pDrvCtrl->rtgTxMblkMap[lastIdx] = pMap;
+        }
+
+    if (tso == TRUE && pDrvCtrl->rtgDescV2 == TRUE)
+        pFirst->rtg_vlanctl = htole32((RTG_TSO_MSS(pMblk) <<
+            RTG_TDESC_VLANCTL_MSSVAL_SHIFT) & RTG_TDESC_VLANCTL_MSSVAL);
+
+    /* VLAN tags go in the first descriptor only */
+
+    pFirst->rtg_vlanctl |= htole32(vlanCtl);
+
+    if (pDrvCtrl->rtgHistOn == TRUE &&
+        pDrvCtrl->rtgTxDescCnt - pDrvCtrl->rtgTxFree >
+        pDrvCtrl->rtgHist.rtgHistTxOccMax)
+        pDrvCtrl->rtgHist.rtgHistTxOccMax =
+            pDrvCtrl->rtgTxDescCnt - pDrvCtrl->rtgTxFree;
+
+    /* Sync the buffer. */
+
+    vxbDmaBufSync (pDev, pDrvCtrl->rtgMblkTag, pMap, VXB_DMABUFSYNC_POSTWRITE);
+
+    /* Transfer descriptors to the chip. */
+
+    pFirst->rtg_cmdsts |= htole32(RTG_TDESC_CMD_OWN);
+
+    return (OK);
+    }
+
+
+/******************************************************************************
+*
+* rtgEndTxQueue - queue one packet on the TX DMA ring
+*
+* This routine places the packet <pMblk> on the TX DMA ring, coalescing it
+* into a single buffer if it has too many fragments, but does not notify
+* the chip. The single buffer is taken from the TX bounce ring when one
+* is free, and from the netpool otherwise. It is called by
+* rtgEndSendBatch() with the TX semaphore held.
+*
+* RETURNS: OK, or EAGAIN if the packet could not be queued
+*
+* ERRNO: N/A
+*/
+
+LOCAL int rtgEndTxQueue
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    M_BLK_ID pMblk
+    )
+    {
+    VXB_DMA_MAP_ID pMap;
+    M_BLK_ID pTmp;
+    char * pBuf;
+    int rval, len;
+
+    /*
+     * First, try to do an in-place transmission, using
+     * gather-write DMA.
+     *
+     * With some of the RealTek chips, using the checksum offload
+     * support in conjunction with the autopadding feature results
+     * in the transmission of corrupt frames. For example, if we
+     * need to send a really small IP fragment that's less than 60
+     * bytes in size, and IP header checksumming is enabled, the
+     * resulting ethernet frame that appears on the wire will
+     * have a garbled payload. To work around this, if we're asked
+     * to transmit a short frame with checksum offload, we manually
+     * pad it out to the minimum ethernet frame size. We do this by
+     * pretending in-place DMA failed, and failing over to the
+     * coalesce case below. This is somewhat inefficient, but these
+     * kinds of runt transmissions occur fairly infrequently so
+     * the overall impact on performance is low.
+     *
+     * Note: the 8111B/8168B and 8101B PCIe devices seem to have
+     * a different checksum problem. The checksum offload support
+     * works correctly in conjunction with the hardware autopadding,
+     * however the chip will calculate incorrect TCP checksums for
+     * short TCP segments that have been manually padded as a result
+     * of the workaround for the IP header checksum botch described
+     * above. To compensate for this, we skip the manual padding of
+     * short frames if the frame contains a TCP segment. The earlier
+     * devices with the IP header checksum bug seem to handle TCP
+     * segments correctly, and this allows the PCIe devices to work
+     * properly too.
+     *
+     * We must also exclude UDP packets here too. Further testing
+     * has shown that on the 8111C chip, if we manually pad a short
+     * UDP frame, the chip will calculate an incorrect payload checksum.
+     * Presumably the device is using the frame length to determine
+     * the length of the UDP payload (it really ought to be using
+     * the length from the UDP header instead).
+     *
+     * Note that the IPNET TCP/IP stack currently never requests
+     * hardware IP header checksum offloading. We still support it
+     * in the driver though, just in case a custom protocol has
+     * need of the feature.
+     *
+     * Large sends are never coalesced: they either go to the chip
+     * as they are, or get cut into MSS sized frames by
+     * rtgEndTsoSoft().
+     */
+
+    if (pMblk->m_pkthdr.csum_flags & CSUM_TSO)
+        {
+        if (pDrvCtrl->rtgTsoMode == RTG_TSO_HW)
+            {
+            rval = rtgEndEncap (pDrvCtrl, pMblk, NULL);
+            if (rval == OK)
+                rtgEndTxAccount (pDrvCtrl, pMblk);
+            if (rval != ENOSPC)
+                return (rval);
+            }
+        return (rtgEndTsoSoft (pDrvCtrl, pMblk, FALSE));
+        }
+
+    if (RTG_TX_NEEDS_PAD(pMblk))
+        rval = ENOSPC;
+    else
+        {
+        rval = rtgEndEncap (pDrvCtrl, pMblk, NULL);
+        if (rval == OK)
+            rtgEndTxAccount (pDrvCtrl, pMblk);
+        }
+
+    /*
+     * If rtgEndEncap() returns ENOSPC, it means it ran out
+     * of TBD entries and couldn't encapsulare the whole
+     * packet fragment chain. In that case, we need to
+     * coalesce everything into a single buffer and try
+     * again. If any other error is returned, then something
+     * went wrong, and we have to abort the transmission
+     * entirely.
+     */
+ 
+    if (rval == ENOSPC)
+        {
+        pDrvCtrl->rtgTxCoalesce++;
+
+        /*
+         * Use the next bounce buffer if there is one. Its map
+         * is already loaded, so all that is left is the copy.
+         */
+
+        if (pDrvCtrl->rtgBncFree > 0 &&
+            pMblk->m_pkthdr.len <= pDrvCtrl->rtgBncSize)
+            {
+            pMap = pDrvCtrl->rtgBncMap[pDrvCtrl->rtgBncProd];
+            pBuf = pDrvCtrl->rtgBncMem +
+                (pDrvCtrl->rtgBncProd * pDrvCtrl->rtgBncSize);
+
+            len = netMblkToBufCopy (pMblk, pBuf, NULL);
+            if (len < ETHERSMALL)
+                {
+                bzero (pBuf + len, ETHERSMALL - len);
+                len = ETHERSMALL;
+                }
+            pMap->fragList[0].fragLen = len;
+
+            rval = rtgEndEncap (pDrvCtrl, pMblk, pMap);
+            if (rval == OK)
+                {
+                rtgEndTxAccount (pDrvCtrl, pMblk);
+                pDrvCtrl->rtgBncProd = (pDrvCtrl->rtgBncProd + 1) %
+                    pDrvCtrl->rtgBncCnt;
+                pDrvCtrl->rtgBncFree--;
+                pDrvCtrl->rtgTxBounced++;
+                netMblkClChainFree (pMblk);
+                }
+            return (rval);
+            }
+
+        pDrvCtrl->rtgTxBncMisses++;
+
+        if ((pTmp = endPoolTupleGet (pDrvCtrl->rtgEndObj.pNetPool)) == NULL)
+            return (EAGAIN);
+
+        /*
+         * With scatter RX, the pool only has standard clusters,
+         * so a badly fragmented jumbo frame can't be coalesced.
+         */
+
+        if (pMblk->m_pkthdr.len > pTmp->m_extSize)
+            {
+            netMblkClChainFree (pTmp);
+            netMblkClChainFree (pMblk);
+            pDrvCtrl->rtgTxCnt->rtgCntErrors++;
+            return (OK);
+            }
+ 
+        len = netMblkToBufCopy (pMblk, mtod(pTmp, char *), NULL);
+
+        /*
+         * Manually pad short frames, and zero the pad space to
+         * avoid leaking data.
+         */
+
+        if (len < ETHERSMALL)
+            {
+            bzero (mtod(pTmp, char *) + len, ETHERSMALL - len);
+            len += ETHERSMALL - len;
+            }
+        pTmp->m_len = pTmp->m_pkthdr.len = len;
+        pTmp->m_flags = pMblk->m_flags;
+        pTmp->m_pkthdr.csum_flags = pMblk->m_pkthdr.csum_flags;
+        pTmp->m_pkthdr.csum_data = pMblk->m_pkthdr.csum_data;
+        pTmp->m_pkthdr.vlan = pMblk->m_pkthdr.vlan;
+        /* Try transmission again, should succeed this time. */
+        rval = rtgEndEncap (pDrvCtrl, pTmp, NULL);
+        if (rval == OK)
+            {
+            rtgEndTxAccount (pDrvCtrl, pTmp);
+            netMblkClChainFree (pMblk);
+            }
+        else
+            netMblkClChainFree (pTmp);
+        }
+ 
+    return (rval);
+    }
+
+/******************************************************************************
+*
+* rtgHpClassify - decide whether a packet goes on the high priority ring
+*
+* This routine is called by rtgEndSendBatch() for each outbound packet
+* when the high priority TX ring is in use. If a classifier has been
+* installed with rtgTxClassifySet(), its verdict is returned. Otherwise
+* the packet is picked if its VLAN priority, taken from the mBlk header
+* or from an 802.1Q tag in the frame, is at least the txHpPcp parameter,
+* or if its IPv4 or IPv6 DSCP is at least the txHpDscp parameter. The
+* headers must lie in the first buffer of the packet.
+*
+* RETURNS: TRUE if the packet should go on the high priority ring
+*
+* ERRNO: N/A
+*/
+
+LOCAL BOOL rtgHpClassify
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    M_BLK_ID pMblk
+    )
+    {
+    RTG_TX_CLASSIFY func;
+    UINT8 * pData;
+    UINT32 type;
+    int len, off;
+    int pcp = -1;
+    int dscp = -1;
+
+    func = pDrvCtrl->rtgHpClassify;
+    if (func != NULL)
+        return (func (pMblk));
+
+    pData = (UINT8 *)pMblk->m_data;
+    len = pMblk->m_len;
+    off = ETHER_HDR_LEN;
+
+    if (len < ETHER_HDR_LEN + 4)
+        return (FALSE);
+
+    type = (pData[12] << 8) | pData[13];
+
+    if (pMblk->m_pkthdr.csum_flags & CSUM_VLAN)
+        pcp = pMblk->m_pkthdr.vlan >> 13;
+    else if (type == RTG_ETHERTYPE_VLAN)
+        {
+        pcp = pData[14] >> 5;
+        type = (pData[16] << 8) | pData[17];
+        off += 4;
+        }
+
+    if (pDrvCtrl->rtgHpPcp >= 0 && pcp >= pDrvCtrl->rtgHpPcp)
+        return (TRUE);
+
+    if (len < off + 2)
+        return (FALSE);
+
+    if (type == RTG_ETHERTYPE_IP)
+        dscp = pData[off + 1] >> 2;
+    else if (type == RTG_ETHERTYPE_IPV6)
+        dscp = ((pData[off] & 0x0F) << 2) | (pData[off + 1] >> 6);
+
+    return (pDrvCtrl->rtgHpDscp >= 0 && dscp >= pDrvCtrl->rtgHpDscp);
+    }
+
+/******************************************************************************
+*
+* rtgEndHpReclaim - reclaim completed high priority TX descriptors
+*
+* This routine walks the high priority TX ring from the consumer index
+* and hands back the descriptors the chip is done with. Their buffers
+* stay mapped, so there is nothing to free. It is called with the TX
+* semaphore held, from rtgEndHpSend() and rtgEndTxReclaim().
+*
+* RETURNS: TRUE if any descriptors were released, otherwise FALSE
+*
+* ERRNO: N/A
+*/
+
+LOCAL BOOL rtgEndHpReclaim
+    (
+    RTG_DRV_CTRL * pDrvCtrl
+    )
+    {
+    RTG_DESC * pDesc;
+    BOOL released = FALSE;
+
+    while (pDrvCtrl->rtgHpFree < (UINT32)pDrvCtrl->rtgHpDescCnt)
+        {
+        pDesc = &pDrvCtrl->rtgHpDescMem[pDrvCtrl->rtgHpCons];
+        if (pDesc->rtg_cmdsts & htole32(RTG_TDESC_STAT_OWN))
+            break;
+        pDesc->rtg_cmdsts &= htole32(RTG_TDESC_CMD_EOR);
+        pDesc->rtg_vlanctl = 0;
+        pDrvCtrl->rtgHpFree++;
+        RTG_INC_DESC (pDrvCtrl->rtgHpCons, pDrvCtrl->rtgHpDescCnt);
+        released = TRUE;
+        }
+
+    return (released);
+    }
+
+/******************************************************************************
+*
+* rtgEndHpSend - queue one packet on the high priority TX ring
+*
+* This routine places the packet <pMblk> on the high priority TX ring,
+* but does not notify the chip. Descriptors the chip is done with are
+* reclaimed first. Large sends are segmented by rtgEndTsoSoft(). Frames
+* too big for the ring's buffers can't be legitimately sent, and are
+* dropped. On success <pMblk> is freed. If the ring is full, the packet
+* is left with the caller, which must wait for the ring to drain rather
+* than send it on the normal ring, so that the frames of a flow stay in
+* order. It is called by rtgEndSendBatch() with the TX semaphore held.
+*
+* RETURNS: OK, or EAGAIN if the packet could not be queued
+*
+* ERRNO: N/A
+*/
+
+LOCAL int rtgEndHpSend
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    M_BLK_ID pMblk
+    )
+    {
+    (void) rtgEndHpReclaim (pDrvCtrl);
+
+    if (pMblk->m_pkthdr.csum_flags & CSUM_TSO)
+        return (rtgEndTsoSoft (pDrvCtrl, pMblk, TRUE));
+
+    if (pMblk->m_pkthdr.len > pDrvCtrl->rtgHpSize)
+        {
+        pDrvCtrl->rtgTxCnt->rtgCntErrors++;
+        netMblkClChainFree (pMblk);
+        return (OK);
+        }
+
+    if (pDrvCtrl->rtgHpFree == 0)
+        {
+        pDrvCtrl->rtgTxHpMisses++;
+        return (EAGAIN);
+        }
+
+    rtgEndHpPut (pDrvCtrl, pMblk);
+    rtgEndTxAccount (pDrvCtrl, pMblk);
+    pDrvCtrl->rtgTxHpPkts++;
+
+    netMblkClChainFree (pMblk);
+
+    return (OK);
+    }
+
+/******************************************************************************
+*
+* rtgEndHpPut - copy one frame onto the high priority TX ring
+*
+* This routine copies the frame <pMblk> into the buffer of the next free
+* high priority TX descriptor and hands the descriptor to the chip. The
+* caller must have checked that a descriptor is free and that the frame
+* fits in its buffer, and keeps ownership of <pMblk>.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgEndHpPut
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    M_BLK_ID pMblk
+    )
+    {
+    VXB_DMA_MAP_ID pMap;
+    RTG_DESC * pDesc;
+    UINT32 cmdSts, vlanCtl;
+    char * pBuf;
+    int len;
+
+    pMap = pDrvCtrl->rtgHpMap[pDrvCtrl->rtgHpProd];
+    pBuf = pDrvCtrl->rtgHpMem + (pDrvCtrl->rtgHpProd * pDrvCtrl->rtgHpSize);
+
+    len = netMblkToBufCopy (pMblk, pBuf, NULL);
+    if (RTG_TX_NEEDS_PAD(pMblk))
+        {
+        bzero (pBuf + len, ETHERSMALL - len);
+        len = ETHERSMALL;
+        }
+
+    rtgEndTxOffload (pDrvCtrl, pMblk, FALSE, &cmdSts, &vlanCtl);
+
+    cmdSts |= (len & RTG_TDESC_CMD_FRAGLEN) |
+        RTG_TDESC_CMD_SOF | RTG_TDESC_CMD_EOF;
+    if (pDrvCtrl->rtgHpProd == (UINT32)(pDrvCtrl->rtgHpDescCnt - 1))
+        cmdSts |= RTG_TDESC_CMD_EOR;
+
+    pDesc = &pDrvCtrl->rtgHpDescMem[pDrvCtrl->rtgHpProd];
+    pDesc->rtg_bufaddr_lo = htole32(RTG_ADDR_LO(pMap->fragList[0].frag));
+    pDesc->rtg_bufaddr_hi = htole32(RTG_ADDR_HI(pMap->fragList[0].frag));
+    pDesc->rtg_vlanctl = htole32(vlanCtl);
+    pDesc->rtg_cmdsts = htole32(cmdSts);
+
+    vxbDmaBufSync (pDrvCtrl->rtgDev, pDrvCtrl->rtgMblkTag, pMap,
+        VXB_DMABUFSYNC_POSTWRITE);
+
+    pDesc->rtg_cmdsts |= htole32(RTG_TDESC_CMD_OWN);
+
+    pDrvCtrl->rtgHpFree--;
+    RTG_INC_DESC (pDrvCtrl->rtgHpProd, pDrvCtrl->rtgHpDescCnt);
+
+    return;
+    }
+
+/******************************************************************************
+*
+* rtgCksumAdd - add a buffer to a running internet checksum
+*
+* This routine adds the 16-bit big-endian words in the buffer <pBuf> of
+* <len> bytes to the partial one's complement sum <sum>. An odd trailing
+* byte is padded with zero, so only the last buffer of a sum may have an
+* odd length.
+*
+* RETURNS: the updated partial sum
+*
+* ERRNO: N/A
+*/
+
+LOCAL UINT32 rtgCksumAdd
+    (
+    UINT32 sum,
+    UINT8 * pBuf,
+    int len
+    )
+    {
+    while (len > 1)
+        {
+        sum += (pBuf[0] << 8) | pBuf[1];
+        pBuf += 2;
+        len -= 2;
+        }
+
+    if (len)
+        sum += pBuf[0] << 8;
+
+    return (sum);
+    }
+
+/******************************************************************************
+*
+* rtgCksumFold - fold a partial sum into an internet checksum
+*
+* This routine folds the carries of the partial sum <sum> back into the
+* low 16 bits and returns the complement.
+*
+* RETURNS: the checksum, in host order
+*
+* ERRNO: N/A
+*/
+
+LOCAL UINT16 rtgCksumFold
+    (
+    UINT32 sum
+    )
+    {
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum += (sum >> 16);
+
+    return ((UINT16)~sum);
+    }
+
+/******************************************************************************
+*
+* rtgEndTsoSoft - segment a large send in software
+*
+* This routine cuts the IPv4 TCP large send <pMblk> into frames carrying
+* at most one MSS of payload each, and places them on the TX DMA ring.
+* Each frame gets a copy of the Ethernet, IP and TCP headers, with the IP
+* length, IP ID, TCP sequence number and flags adjusted: FIN and PSH are
+* only set in the last frame, and CWR only in the first. The IP and TCP
+* checksums are computed here, so this works whether or not checksum
+* offload is enabled. It is used when the chip's large send support is
+* disabled, when a large send has too many fragments for the chip, and,
+* with <hp> set, for large sends on the high priority TX ring, whose
+* buffers only hold one frame. A send needing more descriptors than that
+* whole ring has can never be queued on it, and is dropped.
+*
+* All the mBlk tuples are allocated before anything is queued, so that
+* the packet is either sent in full or left with the caller. Packets
+* that are not IPv4 TCP, or whose headers don't make sense, are dropped.
+*
+* RETURNS: OK, or EAGAIN if the packet could not be queued
+*
+* ERRNO: N/A
+*/
+
+LOCAL int rtgEndTsoSoft
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    M_BLK_ID pMblk,
+    BOOL hp
+    )
+    {
+    UINT8 hdr[RTG_TSO_HDRMAX];
+    UINT8 * pBuf, * pIp, * pTcp;
+    M_BLK_ID pHead = NULL;
+    M_BLK_ID pTmp;
+    UINT32 seq, sum;
+    UINT16 ipId;
+    UINT8 flags;
+    int ethLen, ipLen, tcpLen, hdrLen, payLen, segLen, mss;
+    int nSegs, off, len, i;
+
+    /* Pull up and sanity check the headers */
+
+    len = pMblk->m_pkthdr.len;
+    if (len > RTG_TSO_HDRMAX)
+        len = RTG_TSO_HDRMAX;
+    len = netMblkOffsetToBufCopy (pMblk, 0, (char *)hdr, len, NULL);
+
+    ethLen = ETHER_HDR_LEN;
+    if (len >= ETHER_HDR_LEN + 4 &&
+        ((hdr[12] << 8) | hdr[13]) == RTG_ETHERTYPE_VLAN)
+        ethLen += 4;
+
+    if (len < ethLen + 20 ||
+        ((hdr[ethLen - 2] << 8) | hdr[ethLen - 1]) != RTG_ETHERTYPE_IP)
+        goto drop;
+
+    pIp = hdr + ethLen;
+    ipLen = (pIp[0] & 0x0F) << 2;
+    if ((pIp[0] >> 4) != 4 || ipLen < 20 || pIp[9] != RTG_IPPROTO_TCP ||
+        len < ethLen + ipLen + 20)
+        goto drop;
+
+    pTcp = pIp + ipLen;
+    tcpLen = (pTcp[12] >> 4) << 2;
+    hdrLen = ethLen + ipLen + tcpLen;
+    payLen = ((pIp[2] << 8) | pIp[3]) - ipLen - tcpLen;
+    mss = RTG_TSO_MSS(pMblk);
+
+    if (tcpLen < 20 || len < hdrLen || payLen <= 0 ||
+        hdrLen + payLen > pMblk->m_pkthdr.len || mss == 0 ||
+        ipLen + tcpLen + mss > pDrvCtrl->rtgMaxMtu ||
+        (pDrvCtrl->rtgRxScatter == TRUE && hdrLen + mss > RTG_CLSIZE))
+        goto drop;
+
+    nSegs = (payLen + mss - 1) / mss;
+    if (hp == TRUE)
+        {
+        if (nSegs > pDrvCtrl->rtgHpDescCnt)
+            goto drop;
+        if (nSegs > (int)pDrvCtrl->rtgHpFree)
+            {
+            pDrvCtrl->rtgTxHpMisses++;
+            return (EAGAIN);
+            }
+        }
+    else if (nSegs > pDrvCtrl->rtgTxFree)
+        return (EAGAIN);
+
+    for (i = 0; i < nSegs; i++)
+        {
+        if ((pTmp = endPoolTupleGet (pDrvCtrl->rtgEndObj.pNetPool)) == NULL)
+            {
+            while ((pTmp = pHead) != NULL)
+                {
+                pHead = pTmp->m_nextpkt;
+                netMblkClChainFree (pTmp);
+                }
+            return (EAGAIN);
+            }
+        pTmp->m_nextpkt = pHead;
+        pHead = pTmp;
+        }
+
+    seq = (pTcp[4] << 24) | (pTcp[5] << 16) | (pTcp[6] << 8) | pTcp[7];
+    ipId = (pIp[4] << 8) | pIp[5];
+    flags = pTcp[13];
+
+    for (i = 0, off = 0; i < nSegs; i++, off += segLen)
+        {
+        pTmp = pHead;
+        pHead = pTmp->m_nextpkt;
+        pTmp->m_nextpkt = NULL;
+
+        segLen = payLen - off;
+        if (segLen > mss)
+            segLen = mss;
+        pBuf = mtod(pTmp, UINT8 *);
+        bcopy ((char *)hdr, (char *)pBuf, hdrLen);
+        netMblkOffsetToBufCopy (pMblk, hdrLen + off, (char *)pBuf + hdrLen,
+            segLen, NULL);
+
+        pIp = pBuf + ethLen;
+        pTcp = pIp + ipLen;
+
+        /* IP header: length, ID and checksum */
+
+        len = ipLen + tcpLen + segLen;
+        pIp[2] = (UINT8)(len >> 8);
+        pIp[3] = (UINT8)len;
+        pIp[4] = (UINT8)((ipId + i) >> 8);
+        pIp[5] = (UINT8)(ipId + i);
+        pIp[10] = pIp[11] = 0;
+        sum = rtgCksumFold (rtgCksumAdd (0, pIp, ipLen));
+        pIp[10] = (UINT8)(sum >> 8);
+        pIp[11] = (UINT8)sum;
+
+        /* TCP header: sequence number, flags and checksum */
+
+        pTcp[4] = (UINT8)((seq + off) >> 24);
+        pTcp[5] = (UINT8)((seq + off) >> 16);
+        pTcp[6] = (UINT8)((seq + off) >> 8);
+        pTcp[7] = (UINT8)(seq + off);
+        pTcp[13] = flags;
+        if (i != 0)
+            pTcp[13] &= ~0x80;		/* CWR */
+        if (i != nSegs - 1)
+            pTcp[13] &= ~0x09;		/* FIN, PSH */
+        pTcp[16] = pTcp[17] = 0;
+
+        len = tcpLen + segLen;
+        sum = rtgCksumAdd (RTG_IPPROTO_TCP + len, pIp + 12, 8);
+        sum = rtgCksumFold (rtgCksumAdd (sum, pTcp, len));
+        pTcp[16] = (UINT8)(sum >> 8);
+        pTcp[17] = (UINT8)sum;
+
+        /* Zero the pad space of short frames to avoid leaking data. */
+
+        len = hdrLen + segLen;
+        if (len < ETHERSMALL)
+            {
+            bzero ((char *)pBuf + len, ETHERSMALL - len);
+            len = ETHERSMALL;
+            }
+
+        pTmp->m_len = pTmp->m_pkthdr.len = len;
+        pTmp->m_flags = pMblk->m_flags;
+        pTmp->m_pkthdr.csum_flags = pMblk->m_pkthdr.csum_flags & CSUM_VLAN;
+        pTmp->m_pkthdr.vlan = pMblk->m_pkthdr.vlan;
+
+        /* The checks above also keep each frame within rtgHpSize. */
+
+        if (hp == TRUE)
+            {
+            rtgEndHpPut (pDrvCtrl, pTmp);
+            netMblkClChainFree (pTmp);
+            continue;
+            }
+
+        /*
+         * The ring space was checked above, and each frame is
+         * a single buffer, so this shouldn't fail. If it does
+         * on the first frame, the packet goes back to the caller.
+         * Later on, the frames already queued can't be taken
+         * back, so the rest of the send is dropped and left for
+         * TCP to resend.
+         */
+
+        if (rtgEndEncap (pDrvCtrl, pTmp, NULL) != OK)
+            {
+            netMblkClChainFree (pTmp);
+            while ((pTmp = pHead) != NULL)
+                {
+                pHead = pTmp->m_nextpkt;
+                netMblkClChainFree (pTmp);
+                }
+            if (i == 0)
+                return (EAGAIN);
+            goto drop;
+            }
+        }
+
+    /* Count the large send once, as when the chip segments it. */
+
+    rtgEndTxAccount (pDrvCtrl, pMblk);
+    pDrvCtrl->rtgTxTsoSw++;
+    pDrvCtrl->rtgTxTsoSegs += nSegs;
+    if (hp == TRUE)
+        pDrvCtrl->rtgTxHpPkts += nSegs;
+    netMblkClChainFree (pMblk);
+
+    return (OK);
+
+drop:
+    pDrvCtrl->rtgTxCnt->rtgCntErrors++;
+    netMblkClChainFree (pMblk);
+
+    return (OK);
+    }
+
+/******************************************************************************
+*
+* rtgEndSendBatch - transmit a list of packets
+*
+* This function transmits the packets on the list pointed to by <ppChain>,
+* which are linked through their m_nextpkt fields. All of them are placed
+* on the TX DMA ring under a single acquisition of the TX semaphore, and
+* the chip is notified with a single write to the TX poll register once
+* they are all queued, rather than once per packet. Packets picked by
+* rtgHpClassify() go on the high priority ring instead, if it is in use.
+* They never fall back to the normal ring, which would reorder them
+* with the rest of their flow.
+*
+* If either ring fills up, the packets which could not be queued are left on
+* the list: <ppChain> is updated to point to the first of them, and
+* END_ERR_BLOCK is returned. The caller keeps ownership of those packets
+* and may retry once the MUX restarts transmission. On success, <ppChain>
+* is set to NULL.
+*
+* RETURNS: OK, ERROR, or END_ERR_BLOCK.
+*
+* ERRNO: N/A
+*/
+
+int rtgEndSendBatch
+    (
+    END_OBJ * pEnd,
+    M_BLK_ID * ppChain
+    )
+    {
+    RTG_DRV_CTRL * pDrvCtrl;
+    M_BLK_ID pMblk;
+    M_BLK_ID pNext;
+    RTG_COUNTERS * pCnt;
+    UINT32 queued = 0;
+    UINT32 hpQueued = 0;
+
+    pDrvCtrl = (RTG_DRV_CTRL *)pEnd;
+
+    if (pDrvCtrl->rtgPolling == TRUE)
+        {
+        while ((pMblk = *ppChain) != NULL)
+            {
+            *ppChain = pMblk->m_nextpkt;
+            pMblk->m_nextpkt = NULL;
+            netMblkClChainFree (pMblk);
+            }
+        return (ERROR);
+        }
+
+    END_TX_SEM_TAKE (pEnd, WAIT_FOREVER); 
+
+    if (!(pDrvCtrl->rtgCurStatus & IFM_ACTIVE))
+        goto blocked;
+
+    /*
+     * With TX completion interrupts masked, completed descriptors
+     * are reclaimed here once the ring starts running low. If that
+     * unstalls the channel, muxTxRestart() can't be called from
+     * here, so it is left to rtgEndTxHandle(), as with the timer.
+     */
+
+    if (pDrvCtrl->rtgTxReclaim == TRUE &&
+        pDrvCtrl->rtgTxFree < pDrvCtrl->rtgTxReclaimThresh)
+        {
+        pDrvCtrl->rtgTxReclaims++;
+        if (rtgEndTxReclaim (pDrvCtrl) == TRUE)
+            {
+            pDrvCtrl->rtgTxRestart = TRUE;
+            if (vxAtomic32Set (&pDrvCtrl->rtgTxPending, TRUE) == FALSE)
+                jobQueuePost (pDrvCtrl->rtgJobQueue, &pDrvCtrl->rtgTxJob);
+            }
+        }
+
+    pCnt = RTG_TX_COUNTERS(pDrvCtrl);
+    pDrvCtrl->rtgTxCnt = pCnt;
+    RTG_STATS_BEGIN(pCnt);
+
+    while ((pMblk = *ppChain) != NULL)
+        {
+        pNext = pMblk->m_nextpkt;
+        pMblk->m_nextpkt = NULL;
+
+        /*
+         * Latency critical frames go on the high priority ring,
+         * so they don't wait behind the bulk traffic on the
+         * normal ring, even when that is full. When the high
+         * priority ring is full, the batch waits for it.
+         */
+
+        if (pDrvCtrl->rtgHpDescCnt != 0 &&
+            rtgHpClassify (pDrvCtrl, pMblk) == TRUE)
+            {
+            if (rtgEndHpSend (pDrvCtrl, pMblk) != OK)
+                {
+                pMblk->m_nextpkt = pNext;
+                break;
+                }
+            hpQueued++;
+            }
+        else if (pDrvCtrl->rtgTxFree == 0 ||
+            rtgEndTxQueue (pDrvCtrl, pMblk) != OK)
+            {
+            pMblk->m_nextpkt = pNext;
+            break;
+            }
+
+        *ppChain = pNext;
+        queued++;
+        }
+
+    RTG_STATS_END(pCnt);
+
+    /*
+     * Issue one transmit command for the whole batch, kicking
+     * the high priority queue first if it has anything.
+     */
+
+    if (queued)
+        {
+        CSR_WRITE_1(pDrvCtrl->rtgDev, pDrvCtrl->rtgTxStartReg,
+            (hpQueued != 0 ? RTG_TXPP_HPQ : 0) |
+            (queued != hpQueued ? RTG_TXPP_NPQ : 0));
+        pDrvCtrl->rtgTxDoorbells++;
+        pDrvCtrl->rtgTxPkts += queued;
+        pDrvCtrl->rtgTxBatches++;
+        if (queued > pDrvCtrl->rtgTxBatchMax)
+            pDrvCtrl->rtgTxBatchMax = queued;
+        }
+
+    if (*ppChain != NULL)
         goto blocked;
 
-    /*
-     * First, try to do an in-place transmission, using
-     * gather-write DMA.
-     *
-     * With some of the RealTek chips, using the checksum offload
-     * support in conjunction with the autopadding feature results
-     * in the transmission of corrupt frames. For example, if we
-     * need to send a really small IP fragment that's less than 60
-     * bytes in size, and IP header checksumming is enabled, the
-     * resulting ethernet frame that appears on the wire will
-     * have a garbled payload. To work around this, if we're asked
-     * to transmit a short frame with checksum offload, we manually
-     * pad it out to the minimum ethernet frame size. We do this by
-     * pretending in-place DMA failed, and failing over to the
-     * coalesce case below. This is somewhat inefficient, but these
-     * kinds of runt transmissions occur fairly infrequently so
-     * the overall impact on performance is low.
-     *
-     * Note: the 8111B/8168B and 8101B PCIe devices seem to have
-     * a different checksum problem. The checksum offload support
-     * works correctly in conjunction with the hardware autopadding,
-     * however the chip will calculate incorrect TCP checksums for
-     * short TCP segments that have been manually padded as a result
-     * of the workaround for the IP header checksum botch described
-     * above. To compensate for this, we skip the manual padding of
-     * short frames if the frame contains a TCP segment. The earlier
-     * devices with the IP header checksum bug seem to handle TCP
-     * segments correctly, and this allows the PCIe devices to work
-     * properly too.
-     *
-     * We must also exclude UDP packets here too. Further testing
-     * has shown that on the 8111C chip, if we manually pad a short
-     * UDP frame, the chip will calculate an incorrect payload checksum.
-     * Presumably the device is using the frame length to determine
-     * the length of the UDP payload (it really ought to be using
-     * the length from the UDP header instead).
-     *
-     * Note that the IPNET TCP/IP stack currently never requests
-     * hardware IP header checksum offloading. We still support it
-     * in the driver though, just in case a custom protocol has
-     * need of the feature.
-     */
+    END_TX_SEM_GIVE (pEnd); 
+    return (OK);
+
+blocked:
+    pDrvCtrl->rtgTxStall = TRUE;
+    END_TX_SEM_GIVE (pEnd); 
+
+    return (END_ERR_BLOCK);
+    }
+
+/******************************************************************************
+*
+* rtgEndSend - transmit a packet
+*
+* This function transmits the packet specified in <pMblk>. The RealTek
+* 8139C+/8169 controllers implement true descriptor based DMA (unlike
+* the earlier 8139 devices). Each descriptor describes a single frame
+* fragment, and transfers are done in-place (zero copy). Frames will be
+* coalesced into a single buffer if not enough descriptors are available
+* to handle all the fragments. The transmitter performs automatic short
+* frame padding. This is the MUX send entry point; it passes the packet
+* to rtgEndSendBatch() as a list of one.
+*
+* RETURNS: OK, ERROR, or END_ERR_BLOCK.
+*
+* ERRNO: N/A
+*/
+
+LOCAL int rtgEndSend
+    (
+    END_OBJ * pEnd,
+    M_BLK_ID pMblk
+    )
+    {
+    M_BLK_ID pNext;
+    M_BLK_ID pChain;
+    int rval;
+
+    pNext = pMblk->m_nextpkt;
+    pMblk->m_nextpkt = NULL;
+    pChain = pMblk;
+
+    rval = rtgEndSendBatch (pEnd, &pChain);
+
+    /* A blocked packet goes back to the caller as it came in. */
+
+    if (pChain != NULL)
+        pMblk->m_nextpkt = pNext;
+
+    return (rval);
+    }
+
+/******************************************************************************
+*
+* rtgEndPollSend - polled mode transmit routine
+*
+* This function is similar to the rtgEndSend() routine shown above, except
+* it performs transmissions synchronously with interrupts disabled. After
+* the transmission is initiated, the routine will poll the state of the
+* TX status register associated with the current slot until transmission
+* completed. If transmission times out, this routine will return ERROR.
+*
+* RETURNS: OK, EAGAIN, or ERROR
+*
+* ERRNO: N/A
+*/
+
+LOCAL STATUS rtgEndPollSend
+    (
+    END_OBJ * pEnd,
+    M_BLK_ID pMblk
+    )
+    {
+    RTG_DRV_CTRL * pDrvCtrl;
+    VXB_DEVICE_ID pDev;
+    RTG_DESC * pDesc;
+    VXB_DMA_MAP_ID pMap;
+    UINT32 txSts;
+    UINT16 status;
+    M_BLK_ID pTmp;
+    RTG_COUNTERS * pCnt;
+    int len, i, rval;
+
+    pDrvCtrl = (RTG_DRV_CTRL *)pEnd;
+
+    if (pDrvCtrl->rtgPolling == FALSE)
+        return (ERROR);
+
+    pDev = pDrvCtrl->rtgDev;
+
+    pTmp = pDrvCtrl->rtgPollBuf;
+
+    len = netMblkToBufCopy (pMblk, mtod(pTmp, char *), NULL);
+    pTmp->m_len = pTmp->m_pkthdr.len = len;
+    pTmp->m_flags = pMblk->m_flags;
+    pTmp->m_pkthdr.csum_flags = pMblk->m_pkthdr.csum_flags;
+    pTmp->m_pkthdr.csum_data = pMblk->m_pkthdr.csum_data;
+    pTmp->m_pkthdr.vlan = pMblk->m_pkthdr.vlan;
+
+    pCnt = RTG_TX_COUNTERS(pDrvCtrl);
+    pDrvCtrl->rtgTxCnt = pCnt;
+    RTG_STATS_BEGIN(pCnt);
+    rval = rtgEndEncap (pDrvCtrl, pTmp, NULL);
+    if (rval == OK)
+        rtgEndTxAccount (pDrvCtrl, pTmp);
+    RTG_STATS_END(pCnt);
+
+    if (rval != OK)
+        return (EAGAIN);
+
+    /* Issue transmit command */
+
+    CSR_WRITE_1(pDrvCtrl->rtgDev, pDrvCtrl->rtgTxStartReg, RTG_TXPP_NPQ);
+
+    pMap = pDrvCtrl->rtgTxMblkMap[pDrvCtrl->rtgTxCons];
+    pDesc = &pDrvCtrl->rtgTxDescMem[pDrvCtrl->rtgTxCons];
+
+    for (i = 0; i < RTG_TIMEOUT; i++)
+        {
+        txSts = le32toh(pDesc->rtg_cmdsts);
+        status = CSR_READ_2(pDev, RTG_ISR);
+        if (status & RTG_TXINTRS && !(txSts & RTG_TDESC_STAT_OWN))
+           break;
+        }
+
+    CSR_WRITE_2(pDev, RTG_ISR, status);
+
+    /* Remember to unload the map once transmit completes. */
+ 
+    vxbDmaBufMapUnload (pDrvCtrl->rtgMblkTag, pMap);
+    pDrvCtrl->rtgTxMblk[pDrvCtrl->rtgTxCons] = NULL;
+    pDesc->rtg_cmdsts &= htole32(RTG_TDESC_CMD_EOR);
+    pDesc->rtg_vlanctl = 0;
+    pDrvCtrl->rtgTxFree++;
+    RTG_INC_DESC(pDrvCtrl->rtgTxCons, pDrvCtrl->rtgTxDescCnt);
+
+    if (i == RTG_TIMEOUT || (txSts & RTG_TDESC_STAT_ERR))
+        {
+        RTG_STATS_BEGIN(pCnt);
+        pCnt->rtgCntErrors++;
+        RTG_STATS_END(pCnt);
+        return (ERROR);
+        }
+
+    return (OK);
+    }
+
+/******************************************************************************
+*
+* rtgEndPollReceive - polled mode receive routine
+*
+* This function receive a packet in polled mode, with interrupts disabled.
+* It's similar in operation to the rtgEndRxHandle() routine, except it
+* doesn't process more than one packet at a time and does not load out
+* buffers. Instead, the caller supplied an mBlk tuple into which this
+* function will place the received packet.
+*
+* If the pollZeroCopy parameter is set and the caller's cluster is at
+* least as large as the ring's, the two clusters are swapped with
+* rtgEndPollSwap() instead, so the frame is not copied at all.
+*
+* If no packet is available, this routine will return EAGAIN. If the
+* supplied mBlk is too small to contain the received frame, the routine
+* will return ERROR.
+*
+* RETURNS: OK, EAGAIN, or ERROR
+*
+* ERRNO: N/A
+*/
+
+LOCAL int rtgEndPollReceive
+    (
+    END_OBJ * pEnd,
+    M_BLK_ID pMblk
+    )
+    {
+    RTG_DRV_CTRL * pDrvCtrl;
+    VXB_DEVICE_ID pDev;
+    VXB_DMA_MAP_ID pMap;
+    RTG_DESC * pDesc;
+    M_BLK_ID pPkt;
+    RTG_COUNTERS * pCnt;
+    UINT32 rxSts, rxLen, rxVlan;
+    UINT16 status;
+    BOOL zcopy;
+    int rval = ERROR;
+
+    pDrvCtrl = (RTG_DRV_CTRL *)pEnd;
+    if (pDrvCtrl->rtgPolling == FALSE)
+        return (ERROR);
+
+    if (!(pMblk->m_flags & M_EXT))
+        return (ERROR);
+
+    pDev = pDrvCtrl->rtgDev;
+
+    status = CSR_READ_2(pDev, RTG_ISR);
+    CSR_WRITE_2(pDev, RTG_ISR, status);
+
+    if (pDrvCtrl->rtgRxLineArm == TRUE)
+        cacheInvalidate (DATA_CACHE,
+            RTG_RX_LINE(pDrvCtrl, pDrvCtrl->rtgRxIdx), RTG_DESC_LINE_SIZE);
+
+    pDesc = &pDrvCtrl->rtgRxDescMem[pDrvCtrl->rtgRxIdx];
+    pPkt = pDrvCtrl->rtgRxMblk[pDrvCtrl->rtgRxIdx];
+    pMap = RTG_RX_MAP(pDrvCtrl, pDrvCtrl->rtgRxIdx);
+
+    rxSts = le32toh(pDesc->rtg_cmdsts);    
+
+    if (rxSts & RTG_RDESC_STAT_OWN)
+        return (EAGAIN);
+
+    rxLen = (rxSts & pDrvCtrl->rtgRxLenMask) - ETHER_CRC_LEN;
+    rxVlan = le32toh(pDesc->rtg_vlanctl);
+
+    if ((rxSts & (RTG_RDESC_STAT_SOF|RTG_RDESC_STAT_EOF)) !=
+        (RTG_RDESC_STAT_SOF|RTG_RDESC_STAT_EOF))
+        goto skip;
+
+    if (pDrvCtrl->rtgDevType == RTG_DEVTYPE_8169)
+        rxSts >>= 1;
+
+    /*
+     * The clusters can only be swapped if the caller's is big
+     * enough to be put in the ring, aligned as the chip needs
+     * RX buffers to be, and nobody else holds it.
+     */
+
+    zcopy = FALSE;
+    if (pDrvCtrl->rtgPollZcopy == TRUE &&
+        pMblk->pClBlk->clRefCnt == 1 &&
+        pMblk->m_extSize >= pPkt->m_extSize &&
+        ((ULONG)pMblk->m_extBuf & 7) == 0)
+        zcopy = TRUE;
+
+    if (zcopy == FALSE && pMblk->m_len < rxLen)
+        return (ERROR);
+
+    pCnt = RTG_RX_COUNTERS(pDrvCtrl);
+    RTG_STATS_BEGIN(pCnt);
+
+    if (rxSts & RTG_RDESC_STAT_RXERRSUM)
+        pCnt->rtgCntErrors++;
+    else
+        {
+        vxbDmaBufSync (pDev, pDrvCtrl->rtgMblkTag,
+            pMap, VXB_DMABUFSYNC_PREREAD);
+        if (zcopy == TRUE)
+            {
+            rtgEndPollSwap (pDrvCtrl, pMblk);
+            pMap = RTG_RX_MAP(pDrvCtrl, pDrvCtrl->rtgRxIdx);
+            }
+        else
+            {
+            m_adj (pMblk, 2);
+            bcopy (mtod(pPkt, char *), mtod(pMblk, char *), rxLen);
+            }
+        pMblk->m_flags |= M_PKTHDR;
+        pMblk->m_len = pMblk->m_pkthdr.len = rxLen;
+#ifdef RTG_RX_FIXUP
+        if (zcopy == TRUE)
+            rtgRxFixup (pMblk);
+#endif
+
+        /* Handle checksum offload. */
+
+        rtgEndRxCsum (pDrvCtrl, pMblk, rxSts, rxVlan);
+
+        if (pDrvCtrl->rtgCaps.cap_enabled & IFCAP_VLAN_HWTAGGING)
+           {
+           if (rxVlan & RTG_RDESC_VLANCTL_TAG)
+               {
+               pMblk->m_pkthdr.csum_flags |= CSUM_VLAN;
+               pMblk->m_pkthdr.vlan = (UINT16)ntohs(rxVlan & RTG_RDESC_VLANCTL_DATA);
+               }
+           }
+
+        pCnt->rtgCntOctets += pMblk->m_len;
+        if (rxSts & RTG_RDESC_STAT_UCAST)
+            pCnt->rtgCntUcasts++;
+        if (rxSts & RTG_RDESC_STAT_MCAST)
+            pCnt->rtgCntMcasts++;
+        if (rxSts & RTG_RDESC_STAT_BCAST)
+            pCnt->rtgCntBcasts++;
+
+        rval = OK;
+        }
+
+    RTG_STATS_END(pCnt);
+
+skip:
+
+    /* Reset the descriptor */
+
+    rtgEndRxArm (pDrvCtrl, pDrvCtrl->rtgRxIdx);
+
+    RTG_INC_DESC(pDrvCtrl->rtgRxIdx, pDrvCtrl->rtgRxDescCnt);
+
+    return (rval);
+    }
+
+/******************************************************************************
+*
+* rtgEndPollSwap - swap a received cluster with the caller's
+*
+* This is a helper for rtgEndPollReceive(). It gives the caller's mBlk
+* the cluster holding the frame at the current RX index, and puts the
+* caller's cluster into the ring in its place. The ring mBlk keeps the
+* same data offset and length, so the new cluster is mapped exactly as
+* the old one was. If the old cluster was a recycled buffer, it goes
+* back on the free list when the caller frees it, and the slot falls
+* back to its own DMA map.
+*
+* If the caller's cluster can't be mapped, the clusters are traded back
+* and the frame is copied into the caller's cluster instead, at the
+* offset it has in the ring's. This always fits, since the caller's
+* cluster is at least as large.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgEndPollSwap
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    M_BLK_ID pMblk
+    )
+    {
+    VXB_DMA_MAP_ID pMap;
+    RTG_RX_BUF * pRb;
+    M_BLK_ID pPkt;
+    CL_BLK_ID pClBlk;
+    char * pData;
+    int off;
+    int len;
+    int idx;
+
+    idx = pDrvCtrl->rtgRxIdx;
+    pPkt = pDrvCtrl->rtgRxMblk[idx];
+    pMap = pDrvCtrl->rtgRxMblkMap[idx];
+    pRb = pDrvCtrl->rtgRxBuf[idx];
+
+    if (pRb == NULL)
+        vxbDmaBufMapUnload (pDrvCtrl->rtgMblkTag, pMap);
+
+    pData = pPkt->m_data;
+    off = pPkt->m_data - pPkt->m_extBuf;
+    len = pPkt->m_len;
+
+    /* Trade the clusters. */
+
+    pClBlk = pPkt->pClBlk;
+    pPkt->pClBlk = pMblk->pClBlk;
+    pMblk->pClBlk = pClBlk;
+    pMblk->m_data = pData;
+
+    /* Re-arm the ring mBlk with the caller's cluster. */
+
+    pPkt->m_data = pPkt->m_extBuf + off;
+    pPkt->m_len = pPkt->m_pkthdr.len = len;
+    pPkt->m_next = NULL;
+
+    if (vxbDmaBufMapMblkLoad (pDrvCtrl->rtgDev, pDrvCtrl->rtgMblkTag,
+        pMap, pPkt, 0) == OK)
+        {
+        pMap->fragList[0].fragLen -= 8;
+        pDrvCtrl->rtgRxBuf[idx] = NULL;
+        return;
+        }
+
+    /* Trade back, and copy the frame out instead. */
+
+    vxbDmaBufMapUnload (pDrvCtrl->rtgMblkTag, pMap);
+
+    pClBlk = pPkt->pClBlk;
+    pPkt->pClBlk = pMblk->pClBlk;
+    pMblk->pClBlk = pClBlk;
+    pPkt->m_data = pData;
+    pMblk->m_data = pMblk->m_extBuf + off;
+    bcopy (pData, pMblk->m_data, len);
+
+    /*
+     * A recycled buffer keeps its own map, which was never
+     * unloaded. Otherwise the old cluster was mapped before,
+     * so mapping it again won't fail.
+     */
+
+    if (pRb == NULL)
+        {
+        (void) vxbDmaBufMapMblkLoad (pDrvCtrl->rtgDev,
+            pDrvCtrl->rtgMblkTag, pMap, pPkt, 0);
+        pMap->fragList[0].fragLen -= 8;
+        }
+
+    return;
+    }
+
+LOCAL void rtgDelay
+    (
+    UINT32 usec
+    )
+    {
+    vxbUsDelay (usec);
+    return;
+    }
+
+/*****************************************************************************
+*
+* rtgJobQueuePin - bind the job queue task to the interrupt's CPU
+*
+* This routine is posted to the job queue of rtg unit <unit> by
+* rtgEndStart() when the intCpu parameter is set and the queue was given
+* with rxQueue00. Since it runs in the context of the task servicing the
+* queue, it binds that task to <cpu>, the CPU the port's interrupt is
+* routed to. rtgEndStop() posts it again with a <cpu> of -1 to undo the
+* binding. Only the unit number is passed, since the instance may be
+* unloaded by the time the job runs.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgJobQueuePin
+    (
+    int unit,
+    int cpu
+    )
+    {
+    cpuset_t cpus;
+
+    CPUSET_ZERO(cpus);
+    if (cpu != -1)
+        CPUSET_SET(cpus, cpu);
+
+    if (taskCpuAffinitySet (taskIdSelf (), cpus) != OK)
+        RTG_LOGMSG("%s%d: can't set job queue task affinity to CPU %d\n",
+            RTG_NAME, unit, cpu, 0, 0, 0);
+
+    return;
+    }
+
+/*****************************************************************************
+*
+* rtgBusyPollTask - busy-poll the RX ring
+*
+* This is the body of the busy-poll task started by rtgEndStart() when
+* the busyPoll parameter is set. It sleeps until rtgEndIntHandle() sees
+* an RX event, at which point the RX interrupts have been masked, then
+* spins on the RX ring, passing frames up as soon as they arrive. Once
+* no frame has turned up for busyPollIdle microseconds, it unmasks the
+* RX interrupts again by running the interrupt job, and takes one more
+* look at the ring to catch frames that arrived in the meantime before
+* going back to sleep.
+*
+* The task exits when rtgEndStop() sets rtgBusyExit, giving rtgBusyDone
+* on the way out. When the EIOCPOLLSTART ioctl sets rtgBusyPark, it
+* leaves the ring in the same way, gives rtgBusyDone and goes back to
+* sleep; the RX interrupts unmasked by EIOCPOLLSTOP wake it again.
+*
+* Frames are passed to the MUX directly from this task, at priority
+* busyPollPri, and not from the job queue. Protocols bound to a busy-poll
+* port must therefore not assume that their receive routine runs in the
+* network job task; the stack's own input path takes its locks as usual.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgBusyPollTask
+    (
+    RTG_DRV_CTRL * pDrvCtrl
+    )
+    {
+    VXB_DEVICE_ID pDev;
+    UINT64 now;
+    UINT64 lastPoll;
+    UINT64 lastWork;
+
+    pDev = pDrvCtrl->rtgDev;
+
+    for (;;)
+        {
+        semTake (pDrvCtrl->rtgBusySem, WAIT_FOREVER);
+        if (pDrvCtrl->rtgBusyExit == TRUE)
+            break;
+
+        if (pDrvCtrl->rtgBusyPark == TRUE)
+            {
+            pDrvCtrl->rtgBusyPark = FALSE;
+            vxAtomic32Set (&pDrvCtrl->rtgBusyActive, FALSE);
+            semGive (pDrvCtrl->rtgBusyDone);
+            continue;
+            }
+
+        pDrvCtrl->rtgBusyWakeups++;
+        RTG_TS_GET(lastPoll);
+        lastWork = lastPoll;
+
+        while (pDrvCtrl->rtgBusyExit == FALSE)
+            {
+            if (pDrvCtrl->rtgBusyPark == TRUE ||
+                pDrvCtrl->rtgPolling == TRUE)
+                {
+                vxAtomic32Set (&pDrvCtrl->rtgBusyActive, FALSE);
+                break;
+                }
+
+            RTG_TS_GET(now);
+
+            if (rtgEndRxProcess (pDrvCtrl, pDrvCtrl->rtgRxBudget) != 0)
+                {
+                rtgLatRecord (&pDrvCtrl->rtgLatPollCnt,
+                    &pDrvCtrl->rtgLatPollSum, &pDrvCtrl->rtgLatPollMax,
+                    now - lastPoll);
+                lastWork = now;
+                }
+            else if (now - lastWork > pDrvCtrl->rtgBusyIdleTs)
+                {
+                /* Idle: have the interrupt job unmask RX interrupts. */
+
+                vxAtomic32Set (&pDrvCtrl->rtgBusyActive, FALSE);
+                if (vxAtomic32Cas (&pDrvCtrl->rtgIntPending, FALSE, TRUE))
+                    {
+                    CSR_WRITE_2(pDev, RTG_IMR, 0);
+                    jobQueuePost (pDrvCtrl->rtgJobQueue,
+                        &pDrvCtrl->rtgIntJob);
+                    }
+
+                /*
+                 * If frames slipped in, keep polling, unless an
+                 * interrupt has already woken us up again.
+                 */
+
+                if (rtgEndRxProcess (pDrvCtrl, pDrvCtrl->rtgRxBudget) == 0 ||
+                    vxAtomic32Set (&pDrvCtrl->rtgBusyActive, TRUE) == TRUE)
+                    break;
+                lastWork = now;
+                }
+
+            lastPoll = now;
+            }
+        }
+
+    semGive (pDrvCtrl->rtgBusyDone);
+
+    return;
+    }
+
+/*****************************************************************************
+*
+* rtgLatRecord - add a sample to a set of latency counters
+*
+* This routine adds the latency <delta>, in timestamp units, to the
+* sample count <pCnt>, the running total <pSum> and the maximum <pMax>.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgLatRecord
+    (
+    UINT64 * pCnt,
+    UINT64 * pSum,
+    UINT64 * pMax,
+    UINT64 delta
+    )
+    {
+    *pCnt += 1;
+    *pSum += delta;
+    if (delta > *pMax)
+        *pMax = delta;
+
+    return;
+    }
+
+/*****************************************************************************
+*
+* rtgTsToUsecs - convert timestamp units to microseconds
+*
+* This routine converts a time measured with RTG_TS_GET() into
+* microseconds, without overflowing for large totals.
+*
+* RETURNS: the time in microseconds
+*
+* ERRNO: N/A
+*/
+
+LOCAL UINT64 rtgTsToUsecs
+    (
+    UINT64 ts
+    )
+    {
+    UINT64 freq;
+
+    freq = RTG_TS_FREQ ();
+    if (freq == 0)
+        return (0);
+
+    return ((ts / freq) * 1000000 + ((ts % freq) * 1000000) / freq);
+    }
+
+/*****************************************************************************
+*
+* rtgTsToNsecs - convert timestamp units to nanoseconds
+*
+* This routine converts a time measured with RTG_TS_GET() into
+* nanoseconds, for the latency histogram bucket bounds.
+*
+* RETURNS: the time in nanoseconds
+*
+* ERRNO: N/A
+*/
+
+LOCAL UINT64 rtgTsToNsecs
+    (
+    UINT64 ts
+    )
+    {
+    UINT64 freq;
+
+    freq = RTG_TS_FREQ ();
+    if (freq == 0)
+        return (0);
+
+    return ((ts / freq) * 1000000000 + ((ts % freq) * 1000000000) / freq);
+    }
+
+/*****************************************************************************
+*
+* rtgHistAdd - count a sample in a log2 histogram
+*
+* This routine adds one to the bucket of the <nBuckets> bucket histogram
+* <pHist> that <val> falls into: bucket 0 for 0, and bucket n for values
+* from 2^(n-1) up to 2^n - 1. Values beyond the last bucket are counted
+* in it.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgHistAdd
+    (
+    UINT64 * pHist,
+    int nBuckets,
+    UINT64 val
+    )
+    {
+    int n;
+
+    for (n = 0; val != 0; n++)
+        val >>= 1;
+
+    if (n >= nBuckets)
+        n = nBuckets - 1;
+
+    pHist[n]++;
+
+    return;
+    }
+
+/*****************************************************************************
+*
+* rtgHistStamp - record the latency of an RX pipeline stage
+*
+* This routine adds the time elapsed since <since> to the histogram of
+* pipeline stage <stage>.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgHistStamp
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    int stage,
+    UINT64 since
+    )
+    {
+    UINT64 now;
+
+    RTG_TS_GET(now);
+    rtgHistAdd (pDrvCtrl->rtgHist.rtgHistStage[stage], RTG_HIST_BUCKETS,
+        now - since);
+
+    return;
+    }
+
+/*****************************************************************************
+*
+* rtgTapConfig - set up the capture tap
+*
+* This routine applies the settings in <pConf> to the capture tap of an
+* instance, and is called with the device semaphore held. Disabling the
+* tap only unpublishes it: the records already captured can still be
+* drained, and the rings are kept for the next time it is enabled. The
+* rings are allocated when the tap is first enabled. The tap is
+* unpublished while its settings change, so a producer sees either the
+* old or the new filter, apart from one that was already running.
+*
+* RETURNS: OK, EINVAL if the settings are out of range, or ENOMEM
+*
+* ERRNO: N/A
+*/
+
+LOCAL int rtgTapConfig
+    (
+    RTG_DRV_CTRL * pDrvCtrl,
+    RTG_TAP_CONF * pConf
+    )
+    {
+    RTG_TAP * pTap;
+    int i;
+
+    if (pConf->rtgTapEnable == FALSE)
+        {
+        pDrvCtrl->rtgTap = NULL;
+        return (OK);
+        }
+
+    if (pConf->rtgTapSnapLen <= 0 ||
+        pConf->rtgTapSnapLen > RTG_TAP_SNAP_MAX ||
+        pConf->rtgTapTerms < 0 || pConf->rtgTapTerms > RTG_TAP_TERMS ||
+        (pConf->rtgTapDirs & ~(RTG_TAP_DIR_RX|RTG_TAP_DIR_TX)) != 0)
+        return (EINVAL);
 
-    if (pMblk->m_pkthdr.csum_flags & (CSUM_VLAN|CSUM_IP) &&
-        !(pMblk->m_pkthdr.csum_flags & (CSUM_UDP|CSUM_TCP)) &&
-        pMblk->m_pkthdr.len < ETHERSMALL)
-        rval = ENOSPC;
-    else
-        rval = rtgEndEncap (pDrvCtrl, pMblk);
+    for (i = 0; i < pConf->rtgTapTerms; i++)
+        {
+        if (pConf->rtgTapTerm[i].rtgTapOff > RTG_TAP_SNAP_MAX - 4)
+            return (EINVAL);
+        }
 
-    /*
-     * If rtgEndEncap() returns ENOSPC, it means it ran out
-     * of TBD entries and couldn't encapsulare the whole
-     * packet fragment chain. In that case, we need to
-     * coalesce everything into a single buffer and try
-     * again. If any other error is returned, then something
-     * went wrong, and we have to abort the transmission
-     * entirely.
-     */
- 
-    if (rval == ENOSPC)
+    pTap = pDrvCtrl->rtgTapMem;
+
+    if (pTap == NULL)
         {
-        if ((pTmp = endPoolTupleGet (pDrvCtrl->rtgEndObj.pNetPool)) == NULL)
-            goto blocked;
- 
-        len = netMblkToBufCopy (pMblk, mtod(pTmp, char *), NULL);
+        pTap = malloc (sizeof(RTG_TAP));
+        if (pTap == NULL)
+            return (ENOMEM);
+        bzero ((char *)pTap, sizeof(RTG_TAP));
+
+        pTap->rtgTapMask = pDrvCtrl->rtgTapSlots - 1;
+        pTap->rtgTapSem = semMCreate (SEM_Q_PRIORITY|
+            SEM_DELETE_SAFE|SEM_INVERSION_SAFE);
+        for (i = RTG_TAP_RX; i <= RTG_TAP_TX; i++)
+            pTap->rtgTapRing[i].rtgTapRecs =
+                malloc (pDrvCtrl->rtgTapSlots * sizeof(RTG_TAP_REC));
+
+        if (pTap->rtgTapSem == NULL ||
+            pTap->rtgTapRing[RTG_TAP_RX].rtgTapRecs == NULL ||
+            pTap->rtgTapRing[RTG_TAP_TX].rtgTapRecs == NULL)
+            {
+            rtgTapFree (pTap);
+            return (ENOMEM);
+            }
 
-        /*
-         * Manually pad short frames, and zero the pad space to
-         * avoid leaking data.
-         */
+        RTG_TS_GET(pTap->rtgTapTsBase);
+        pTap->rtgTapSecBase = (UINT32)time (NULL);
 
-        if (len < ETHERSMALL)
+        pDrvCtrl->rtgTapMem = pTap;
+        }
+
+    pDrvCtrl->rtgTap = NULL;
+    VX_MEM_BARRIER_RW();
+
+    bcopy ((char *)pConf, (char *)&pTap->rtgTapConf, sizeof(RTG_TAP_CONF));
+
+    VX_MEM_BARRIER_W();
+    pDrvCtrl->rtgTap = pTap;
+
+    return (OK);
+    }
+
+/*****************************************************************************
+*
+* rtgTapFree - release a capture tap
+*
+* This routine frees the rings and semaphore of a capture tap, along
+* with the tap itself. It is used when the instance is unlinked, and
+* when setting up a tap fails part way.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgTapFree
+    (
+    RTG_TAP * pTap
+    )
+    {
+    if (pTap->rtgTapSem != NULL)
+        semDelete (pTap->rtgTapSem);
+    if (pTap->rtgTapRing[RTG_TAP_RX].rtgTapRecs != NULL)
+        free (pTap->rtgTapRing[RTG_TAP_RX].rtgTapRecs);
+    if (pTap->rtgTapRing[RTG_TAP_TX].rtgTapRecs != NULL)
+        free (pTap->rtgTapRing[RTG_TAP_TX].rtgTapRecs);
+    free (pTap);
+
+    return;
+    }
+
+/*****************************************************************************
+*
+* rtgTapRecord - copy a frame into the capture tap
+*
+* This routine is called from the RX handler and from rtgEndTxAccount()
+* for every frame while the tap is enabled. If its ring has room, the first
+* snapLen bytes of the frame, or more if a filter term lies further in,
+* are copied into the next record. The filter is run on that copy, so
+* that terms beyond the first mBlk are matched too, and the record is
+* published by advancing the producer index if the frame passes. A frame
+* that finds the ring full is counted and dropped.
+*
+* No lock is taken, since each ring is written by one context at a time.
+* RX records are written by rtgEndRxProcess(), which must already run
+* alone on the RX ring: from the RX job or RX group job under the
+* rtgRxPending flag or, on a busy-poll port, only from rtgBusyPollTask(),
+* whose interrupts never post the RX job and which is parked before
+* polled mode starts. TX records are written with the TX semaphore held,
+* or from rtgEndPollSend() in polled mode, when rtgEndSendBatch() refuses
+* to send.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgTapRecord
+    (
+    RTG_TAP * pTap,
+    M_BLK_ID pMblk,
+    int dir
+    )
+    {
+    RTG_TAP_RING * pRing;
+    RTG_TAP_TERM * pTerm;
+    RTG_TAP_REC * pRec;
+    UINT32 prod;
+    int len, snapLen;
+    int i, j;
+
+    if (!(pTap->rtgTapConf.rtgTapDirs & (1 << dir)))
+        return;
+
+    pRing = &pTap->rtgTapRing[dir];
+
+    prod = pRing->rtgTapProd;
+    if (prod - pRing->rtgTapCons > pTap->rtgTapMask)
+        {
+        pRing->rtgTapDrops++;
+        return;
+        }
+
+    /* Copy enough of the frame to cover every filter term. */
+
+    snapLen = len = pTap->rtgTapConf.rtgTapSnapLen;
+    for (i = 0; i < pTap->rtgTapConf.rtgTapTerms; i++)
+        {
+        if (pTap->rtgTapConf.rtgTapTerm[i].rtgTapOff + 4 > len)
+            len = pTap->rtgTapConf.rtgTapTerm[i].rtgTapOff + 4;
+        }
+
+    pRec = &pRing->rtgTapRecs[prod & pTap->rtgTapMask];
+    len = netMblkOffsetToBufCopy (pMblk, 0, (char *)pRec->rtgTapData,
+        len, NULL);
+
+    for (i = 0; i < pTap->rtgTapConf.rtgTapTerms; i++)
+        {
+        pTerm = &pTap->rtgTapConf.rtgTapTerm[i];
+        if (pTerm->rtgTapOff + 4 > len)
+            goto filtered;
+        for (j = 0; j < 4; j++)
             {
-            bzero (mtod(pTmp, char *) + len, ETHERSMALL - len);
-            len += ETHERSMALL - len;
+            if ((pRec->rtgTapData[pTerm->rtgTapOff + j] &
+                pTerm->rtgTapMask[j]) != pTerm->rtgTapVal[j])
+                goto filtered;
             }
-        pTmp->m_len = pTmp->m_pkthdr.len = len;
-        pTmp->m_flags = pMblk->m_flags;
-        pTmp->m_pkthdr.csum_flags = pMblk->m_pkthdr.csum_flags;
-        pTmp->m_pkthdr.csum_data = pMblk->m_pkthdr.csum_data;
-        pTmp->m_pkthdr.vlan = pMblk->m_pkthdr.vlan;
-        /* Try transmission again, should succeed this time. */
-        rval = rtgEndEncap (pDrvCtrl, pTmp);
-        if (rval == OK)
-            netMblkClChainFree (pMblk);
+        }
+
+    RTG_TS_GET(pRec->rtgTapTs);
+    pRec->rtgTapLen = pMblk->m_pkthdr.len;
+    pRec->rtgTapDir = (UINT8)dir;
+    pRec->rtgTapCapLen = (UINT16)(len < snapLen ? len : snapLen);
+
+    VX_MEM_BARRIER_W();
+    pRing->rtgTapProd = prod + 1;
+    pRing->rtgTapCaptured++;
+
+    return;
+
+filtered:
+    pRing->rtgTapFiltered++;
+    return;
+    }
+
+/*****************************************************************************
+*
+* rtgTapNext - take the oldest record from the capture tap
+*
+* This routine copies the oldest record of either ring into <pRec> and
+* frees its slot, so the RX and TX records come out in time order. The
+* caller must hold the tap semaphore.
+*
+* RETURNS: TRUE if a record was returned, FALSE if both rings are empty
+*
+* ERRNO: N/A
+*/
+
+LOCAL BOOL rtgTapNext
+    (
+    RTG_TAP * pTap,
+    RTG_TAP_REC * pRec
+    )
+    {
+    RTG_TAP_RING * pRing;
+    RTG_TAP_RING * pOldest = NULL;
+    RTG_TAP_REC * pHead;
+    UINT64 oldest = 0;
+    int i;
+
+    for (i = RTG_TAP_RX; i <= RTG_TAP_TX; i++)
+        {
+        pRing = &pTap->rtgTapRing[i];
+        if (pRing->rtgTapCons == pRing->rtgTapProd)
+            continue;
+        VX_MEM_BARRIER_R();
+        pHead = &pRing->rtgTapRecs[pRing->rtgTapCons & pTap->rtgTapMask];
+        if (pOldest == NULL || pHead->rtgTapTs < oldest)
+            {
+            pOldest = pRing;
+            oldest = pHead->rtgTapTs;
+            }
+        }
+
+    if (pOldest == NULL)
+        return (FALSE);
+
+    bcopy ((char *)&pOldest->rtgTapRecs[pOldest->rtgTapCons &
+        pTap->rtgTapMask], (char *)pRec, sizeof(RTG_TAP_REC));
+
+    /* Don't hand the slot back until the copy is complete. */
+
+    VX_MEM_BARRIER_RW();
+    pOldest->rtgTapCons++;
+
+    return (TRUE);
+    }
+
+/*****************************************************************************
+*
+* rtgInstFind - look up an instance by unit number
+*
+* This routine searches the instance registry for the rtg unit <unit>,
+* for the shell routines which take a unit number.
+*
+* RETURNS: the instance's RTG_DRV_CTRL structure, or NULL if not found
+*
+* ERRNO: N/A
+*/
+
+LOCAL RTG_DRV_CTRL * rtgInstFind
+    (
+    int unit
+    )
+    {
+    RTG_DRV_CTRL * pDrvCtrl = NULL;
+    int i;
+
+    if (rtgInstSem == NULL)
+        return (NULL);
+
+    semTake (rtgInstSem, WAIT_FOREVER);
+
+    for (i = 0; i < rtgInstCnt; i++)
+        {
+        if (rtgInsts[i]->unitNumber == (UINT32)unit)
+            {
+            pDrvCtrl = rtgInsts[i]->pDrvCtrl;
+            break;
+            }
+        }
+
+    semGive (rtgInstSem);
+
+    return (pDrvCtrl);
+    }
+
+/*****************************************************************************
+*
+* rtgPortUp - bring up one port
+*
+* This is the entry point of the per-port bring-up tasks spawned by
+* doRtgMuxConnect(). It runs rtgMuxConnect() for the port, records
+* how long that took in rtgUpMsecs and logs it, then gives <doneSem>
+* to signal completion.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void rtgPortUp
+    (
+    VXB_DEVICE_ID pDev,
+    SEM_ID doneSem
+    )
+    {
+    RTG_DRV_CTRL *pDrvCtrl;
+    ULONG start;
+
+    pDrvCtrl = pDev->pDrvCtrl;
+
+    start = tickGet ();
+    rtgMuxConnect (pDev, NULL);
+    pDrvCtrl->rtgUpMsecs = ((tickGet () - start) * 1000) / sysClkRateGet ();
+
+    RTG_LOGMSG("%s%d: %s in %d ms\n", RTG_NAME, pDev->unitNumber,
+        (pDrvCtrl->rtgMuxDevCookie != NULL ? "up" : "failed to come up"),
+        pDrvCtrl->rtgUpMsecs, 0, 0);
+
+    semGive (doneSem);
+
+    return;
+    }
+
+/*****************************************************************************
+*
+* doRtgMuxConnect - bring up all registered ports in parallel
+*
+* This routine spawns one rtgPortUp() task for each instance in the
+* registry, so that the EEPROM reads, PHY probes and autonegotiation
+* of all ports overlap, and then waits for all of them to finish. If
+* a task can't be spawned, that port is brought up inline instead.
+* The registry is copied first, so that its lock isn't held while the
+* ports come up.
+* Ports that haven't finished within RTG_UP_TIMEOUT seconds are left
+* to complete in the background.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
+
+LOCAL void doRtgMuxConnect
+    (
+    void
+    )
+    {
+    VXB_DEVICE_ID * pDevs;
+    SEM_ID doneSem;
+    char name[16];
+    ULONG start;
+    int spawned = 0;
+    int cnt;
+    int i;
+
+    doneSem = semCCreate (SEM_Q_FIFO, 0);
+    if (doneSem == NULL)
+        return;
+
+    start = tickGet ();
+
+    semTake (rtgInstSem, WAIT_FOREVER);
+
+    cnt = rtgInstCnt;
+    pDevs = malloc ((cnt ? cnt : 1) * sizeof(VXB_DEVICE_ID));
+    if (pDevs == NULL)
+        {
+        semGive (rtgInstSem);
+        semDelete (doneSem);
+        RTG_LOGMSG("%s: can't copy the instance registry\n",
+            RTG_NAME, 0, 0, 0, 0, 0);
+        return;
+        }
+    bcopy ((char *)rtgInsts, (char *)pDevs, cnt * sizeof(VXB_DEVICE_ID));
+
+    semGive (rtgInstSem);
+
+    for (i = 0; i < cnt; i++)
+        {
+        sprintf (name, "tRtgUp%d", pDevs[i]->unitNumber);
+        if (taskSpawn (name, RTG_UP_PRI, 0, RTG_UP_STACK,
+            (FUNCPTR)rtgPortUp, (_Vx_usr_arg_t)pDevs[i],
+            (_Vx_usr_arg_t)doneSem, 0, 0, 0, 0, 0, 0, 0, 0) == TASK_ID_ERROR)
+            rtgPortUp (pDevs[i], doneSem);
         else
-            netMblkClChainFree (pTmp);
+            spawned++;
         }
- 
-    if (rval != OK)
-        goto blocked;
 
-    /* Issue transmit command */
+    free (pDevs);
 
-    CSR_WRITE_1(pDrvCtrl->rtgDev, pDrvCtrl->rtgTxStartReg, RTG_TXPP_NPQ);
+    /* Reap the ports brought up inline, then wait for the tasks. */
 
-    END_TX_SEM_GIVE (pEnd); 
-    return (OK);
+    for (i = 0; i < cnt; i++)
+        {
+        if (semTake (doneSem, i < cnt - spawned ? NO_WAIT :
+            RTG_UP_TIMEOUT * sysClkRateGet ()) != OK)
+            break;
+        }
+
+    if (i < cnt)
+        {
+        RTG_LOGMSG("%s: %d of %d ports still coming up\n",
+            RTG_NAME, cnt - i, cnt, 0, 0, 0);
+
+        /* The remaining tasks still need the semaphore. */
+
+        return;
+        }
 
-blocked:
-    pDrvCtrl->rtgTxStall = TRUE;
-    END_TX_SEM_GIVE (pEnd); 
+    RTG_LOGMSG("%s: %d ports up in %d ms\n", RTG_NAME, cnt,
+        ((tickGet () - start) * 1000) / sysClkRateGet (), 0, 0, 0);
 
-    return (END_ERR_BLOCK);
+    semDelete (doneSem);
+
+    return;
     }
 
-/******************************************************************************
+/*****************************************************************************
 *
-* rtgEndPollSend - polled mode transmit routine
+* sysRtgEndInit - register the rtg driver and bring up all ports
 *
-* This function is similar to the rtgEndSend() routine shown above, except
-* it performs transmissions synchronously with interrupts disabled. After
-* the transmission is initiated, the routine will poll the state of the
-* TX status register associated with the current slot until transmission
-* completed. If transmission times out, this routine will return ERROR.
+* This routine registers the PHY drivers and the rtg driver with VxBus,
+* then brings up every rtg instance found, in parallel.
 *
-* RETURNS: OK, EAGAIN, or ERROR
+* RETURNS: OK
 *
 * ERRNO: N/A
 */
 
-LOCAL STATUS rtgEndPollSend
+STATUS sysRtgEndInit
     (
-    END_OBJ * pEnd,
-    M_BLK_ID pMblk
+    void
     )
     {
-    RTG_DRV_CTRL * pDrvCtrl;
-    VXB_DEVICE_ID pDev;
-    RTG_DESC * pDesc;
-    VXB_DMA_MAP_ID pMap;
-    UINT32 txSts;
-    UINT16 status;
-    M_BLK_ID pTmp;
-    int len, i;
-
-    pDrvCtrl = (RTG_DRV_CTRL *)pEnd;
-
-    if (pDrvCtrl->rtgPolling == FALSE)
-        return (ERROR);
+    mvPhyRegister();
+    rtgPhyRegister();
 
-    pDev = pDrvCtrl->rtgDev;
+    rtgRegister();
+    doRtgMuxConnect();
 
-    pTmp = pDrvCtrl->rtgPollBuf;
+    return (OK);
+    }
 
-    len = netMblkToBufCopy (pMblk, mtod(pTmp, char *), NULL);
-    pTmp->m_len = pTmp->m_pkthdr.len = len;
-    pTmp->m_flags = pMblk->m_flags;
-    pTmp->m_pkthdr.csum_flags = pMblk->m_pkthdr.csum_flags;
-    pTmp->m_pkthdr.csum_data = pMblk->m_pkthdr.csum_data;
-    pTmp->m_pkthdr.vlan = pMblk->m_pkthdr.vlan;
+/*****************************************************************************
+*
+* rtgTapStart - enable the capture tap of an rtg port
+*
+* This routine enables the capture tap of rtg unit <unit>, keeping the
+* first <snapLen> bytes of each frame (RTG_TAP_SNAP_MAX if 0) for the
+* directions in <dirs> (RTG_TAP_DIR_RX, RTG_TAP_DIR_TX, or both if 0).
+* No filter is set; use the EIOCSRTGTAP ioctl for that.
+*
+* RETURNS: OK, or ERROR if the unit doesn't exist or the tap can't be set up
+*
+* ERRNO: N/A
+*/
 
-    if (rtgEndEncap (pDrvCtrl, pTmp) != OK)
-        return (EAGAIN);
+STATUS rtgTapStart
+    (
+    int unit,
+    int snapLen,
+    int dirs
+    )
+    {
+    RTG_DRV_CTRL * pDrvCtrl;
+    RTG_TAP_CONF conf;
+    int rval;
 
-    /* Issue transmit command */
+    pDrvCtrl = rtgInstFind (unit);
+    if (pDrvCtrl == NULL)
+        return (ERROR);
 
-    CSR_WRITE_1(pDrvCtrl->rtgDev, pDrvCtrl->rtgTxStartReg, RTG_TXPP_NPQ);
+    bzero ((char *)&conf, sizeof(conf));
+    conf.rtgTapEnable = TRUE;
+    conf.rtgTapSnapLen = (snapLen == 0 ? RTG_TAP_SNAP_MAX : snapLen);
+    conf.rtgTapDirs = (dirs == 0 ? RTG_TAP_DIR_RX|RTG_TAP_DIR_TX : dirs);
 
-    pMap = pDrvCtrl->rtgTxMblkMap[pDrvCtrl->rtgTxCons];
-    pDesc = &pDrvCtrl->rtgTxDescMem[pDrvCtrl->rtgTxCons];
+    semTake (pDrvCtrl->rtgDevSem, WAIT_FOREVER);
+    rval = rtgTapConfig (pDrvCtrl, &conf);
+    semGive (pDrvCtrl->rtgDevSem);
 
-    for (i = 0; i < RTG_TIMEOUT; i++)
-        {
-        txSts = le32toh(pDesc->rtg_cmdsts);
-        status = CSR_READ_2(pDev, RTG_ISR);
-        if (status & RTG_TXINTRS && !(txSts & RTG_TDESC_STAT_OWN))
-           break;
-        }
+    return (rval == OK ? OK : ERROR);
+    }
 
-    CSR_WRITE_2(pDev, RTG_ISR, status);
+/*****************************************************************************
+*
+* rtgTapStop - disable the capture tap of an rtg port
+*
+* This routine disables the capture tap of rtg unit <unit>. Frames
+* already captured can still be drained with rtgTapSave().
+*
+* RETURNS: OK, or ERROR if the unit doesn't exist
+*
+* ERRNO: N/A
+*/
 
-    /* Remember to unload the map once transmit completes. */
- 
-    vxbDmaBufMapUnload (pDrvCtrl->rtgMblkTag, pMap);
-    pDrvCtrl->rtgTxMblk[pDrvCtrl->rtgTxCons] = NULL;
-    pDesc->rtg_cmdsts &= htole32(RTG_TDESC_CMD_EOR);
-    pDesc->rtg_vlanctl = 0;
-    pDrvCtrl->rtgTxFree++;
-    RTG_INC_DESC(pDrvCtrl->rtgTxCons, pDrvCtrl->rtgTxDescCnt);
+STATUS rtgTapStop
+    (
+    int unit
+    )
+    {
+    RTG_DRV_CTRL * pDrvCtrl;
+    RTG_TAP_CONF conf;
 
-    if (i == RTG_TIMEOUT || (txSts & RTG_TDESC_STAT_ERR))
-        {
-        pDrvCtrl->rtgOutErrors++;
+    pDrvCtrl = rtgInstFind (unit);
+    if (pDrvCtrl == NULL)
         return (ERROR);
-        }
 
-    pDrvCtrl->rtgOutOctets += pMblk->m_pkthdr.len;
-    if ((UINT8)pMblk->m_data[0] == 0xFF)
-        pDrvCtrl->rtgOutBcasts++;
-    else if ((UINT8)pMblk->m_data[0] & 0x1)
-        pDrvCtrl->rtgOutMcasts++;
-    else
-        pDrvCtrl->rtgOutUcasts++;
+    bzero ((char *)&conf, sizeof(conf));
+
+    semTake (pDrvCtrl->rtgDevSem, WAIT_FOREVER);
+    (void) rtgTapConfig (pDrvCtrl, &conf);
+    semGive (pDrvCtrl->rtgDevSem);
 
     return (OK);
     }
 
-/******************************************************************************
-*
-* rtgEndPollReceive - polled mode receive routine
+/*****************************************************************************
 *
-* This function receive a packet in polled mode, with interrupts disabled.
-* It's similar in operation to the rtgEndRxHandle() routine, except it
-* doesn't process more than one packet at a time and does not load out
-* buffers. Instead, the caller supplied an mBlk tuple into which this
-* function will place the received packet.
+* rtgTapSave - drain the capture tap of an rtg port to a pcap file
 *
-* If no packet is available, this routine will return EAGAIN. If the
-* supplied mBlk is too small to contain the received frame, the routine
-* will return ERROR.
+* This routine writes the frames captured by the tap of rtg unit <unit>
+* to <fileName> in libpcap format, oldest first. If <count> is 0, it
+* writes what has been captured so far; otherwise it keeps draining the
+* tap until <count> frames have been written or the tap is disabled.
+* Time stamps are relative to the time the tap was first enabled.
 *
-* RETURNS: OK, EAGAIN, or ERROR
+* RETURNS: OK, or ERROR if the unit has no tap or the file can't be written
 *
 * ERRNO: N/A
 */
 
-LOCAL int rtgEndPollReceive
+STATUS rtgTapSave
     (
-    END_OBJ * pEnd,
-    M_BLK_ID pMblk
+    int unit,
+    char * fileName,
+    int count
     )
     {
     RTG_DRV_CTRL * pDrvCtrl;
-    VXB_DEVICE_ID pDev;
-    VXB_DMA_MAP_ID pMap;
-    RTG_DESC * pDesc;
-    M_BLK_ID pPkt;
-    UINT32 rxSts, rxLen, rxVlan;
-    UINT16 status;
-    int rval = ERROR;
-
-    pDrvCtrl = (RTG_DRV_CTRL *)pEnd;
-    if (pDrvCtrl->rtgPolling == FALSE)
-        return (ERROR);
+    RTG_TAP * pTap;
+    RTG_TAP_REC rec;
+    RTG_PCAP_HDR hdr;
+    RTG_PCAP_REC pcapRec;
+    UINT64 usecs;
+    STATUS rval = OK;
+    int fd;
+    int saved = 0;
 
-    if (!(pMblk->m_flags & M_EXT))
+    pDrvCtrl = rtgInstFind (unit);
+    if (pDrvCtrl == NULL || pDrvCtrl->rtgTapMem == NULL || fileName == NULL)
         return (ERROR);
 
-    pDev = pDrvCtrl->rtgDev;
-
-    status = CSR_READ_2(pDev, RTG_ISR);
-    CSR_WRITE_2(pDev, RTG_ISR, status);
-
-    pDesc = &pDrvCtrl->rtgRxDescMem[pDrvCtrl->rtgRxIdx];
-    pPkt = pDrvCtrl->rtgRxMblk[pDrvCtrl->rtgRxIdx];
-    pMap = pDrvCtrl->rtgRxMblkMap[pDrvCtrl->rtgRxIdx];
-
-    rxSts = le32toh(pDesc->rtg_cmdsts);    
-
-    if (rxSts & RTG_RDESC_STAT_OWN)
-        return (EAGAIN);
-
-    rxLen = (rxSts & pDrvCtrl->rtgRxLenMask) - ETHER_CRC_LEN;
-    rxVlan = le32toh(pDesc->rtg_vlanctl);
-
-    if ((rxSts & (RTG_RDESC_STAT_SOF|RTG_RDESC_STAT_EOF)) !=
-        (RTG_RDESC_STAT_SOF|RTG_RDESC_STAT_EOF))
-        goto skip;
-
-    if (pDrvCtrl->rtgDevType == RTG_DEVTYPE_8169)
-        rxSts >>= 1;
+    pTap = pDrvCtrl->rtgTapMem;
 
-    if (pMblk->m_len < rxLen)
+    fd = open (fileName, O_CREAT|O_WRONLY|O_TRUNC, 0644);
+    if (fd < 0)
         return (ERROR);
 
-    if (rxSts & RTG_RDESC_STAT_RXERRSUM)
-        pDrvCtrl->rtgInErrors++;
-    else
+    hdr.rtgPcapMagic = RTG_PCAP_MAGIC;
+    hdr.rtgPcapMajor = RTG_PCAP_MAJOR;
+    hdr.rtgPcapMinor = RTG_PCAP_MINOR;
+    hdr.rtgPcapZone = 0;
+    hdr.rtgPcapSigFigs = 0;
+    hdr.rtgPcapSnapLen = RTG_TAP_SNAP_MAX;
+    hdr.rtgPcapLinkType = RTG_PCAP_ETHERNET;
+
+    if (write (fd, (char *)&hdr, sizeof(hdr)) != sizeof(hdr))
         {
-        vxbDmaBufSync (pDev, pDrvCtrl->rtgMblkTag,
-            pMap, VXB_DMABUFSYNC_PREREAD);
-        m_adj (pMblk, 2);
-        pMblk->m_flags |= M_PKTHDR;
-        pMblk->m_len = pMblk->m_pkthdr.len = rxLen;
-        bcopy (mtod(pPkt, char *), mtod(pMblk, char *), rxLen);
+        close (fd);
+        return (ERROR);
+        }
 
-        /* Handle checksum offload. */
+    semTake (pTap->rtgTapSem, WAIT_FOREVER);
 
-        if (pDrvCtrl->rtgCaps.cap_enabled & IFCAP_RXCSUM)
+    while (count == 0 || saved < count)
+        {
+        if (rtgTapNext (pTap, &rec) == FALSE)
             {
-            if (rxSts & RTG_RDESC_STAT_PROTOID)
-                pMblk->m_pkthdr.csum_flags |= CSUM_IP_CHECKED;
-            if (!(rxSts & RTG_RDESC_STAT_IPSUMBAD))
-                pMblk->m_pkthdr.csum_flags |= CSUM_IP_VALID;
-            if ((RTG_TCPPKT(rxSts) && !(rxSts & RTG_RDESC_STAT_TCPSUMBAD)) ||
-                (RTG_UDPPKT(rxSts) && !(rxSts & RTG_RDESC_STAT_UDPSUMBAD)))
-                {
-                pMblk->m_pkthdr.csum_flags |= CSUM_DATA_VALID|CSUM_PSEUDO_HDR;
-                pMblk->m_pkthdr.csum_data = 0xffff;
-                }
+            if (count == 0 || pDrvCtrl->rtgTap == NULL)
+                break;
+            taskDelay (1);
+            continue;
             }
 
-        if (pDrvCtrl->rtgCaps.cap_enabled & IFCAP_VLAN_HWTAGGING)
-           {
-           if (rxVlan & RTG_RDESC_VLANCTL_TAG)
-               {
-               pMblk->m_pkthdr.csum_flags |= CSUM_VLAN;
-               pMblk->m_pkthdr.vlan = (UINT16)ntohs(rxVlan & RTG_RDESC_VLANCTL_DATA);
-               }
-           }
+        usecs = rtgTsToUsecs (rec.rtgTapTs - pTap->rtgTapTsBase);
+        pcapRec.rtgPcapSec = pTap->rtgTapSecBase + (UINT32)(usecs / 1000000);
+        pcapRec.rtgPcapUsec = (UINT32)(usecs % 1000000);
+        pcapRec.rtgPcapCapLen = rec.rtgTapCapLen;
+        pcapRec.rtgPcapLen = rec.rtgTapLen;
 
-        pDrvCtrl->rtgInOctets += pMblk->m_len;
-        if (rxSts & RTG_RDESC_STAT_UCAST)
-            pDrvCtrl->rtgInUcasts++;
-        if (rxSts & RTG_RDESC_STAT_MCAST)
-            pDrvCtrl->rtgInMcasts++;
-        if (rxSts & RTG_RDESC_STAT_BCAST)
-            pDrvCtrl->rtgInBcasts++;
+        if (write (fd, (char *)&pcapRec, sizeof(pcapRec)) !=
+            sizeof(pcapRec) ||
+            write (fd, (char *)rec.rtgTapData, rec.rtgTapCapLen) !=
+            rec.rtgTapCapLen)
+            {
+            rval = ERROR;
+            break;
+            }
 
-        rval = OK;
+        saved++;
         }
 
-skip:
-
-    /* Reset the descriptor */
+    semGive (pTap->rtgTapSem);
 
-    pDesc->rtg_bufaddr_lo = htole32(RTG_ADDR_LO(pMap->fragList[0].frag));
-    pDesc->rtg_bufaddr_hi = htole32(RTG_ADDR_HI(pMap->fragList[0].frag));
-    if (pDrvCtrl->rtgRxIdx == (pDrvCtrl->rtgRxDescCnt - 1))
-        pDesc->rtg_cmdsts = htole32(pMap->fragList[0].fragLen |
-            RTG_RDESC_CMD_OWN | RTG_RDESC_CMD_EOR);
-    else
-        pDesc->rtg_cmdsts = htole32(pMap->fragList[0].fragLen |
-            RTG_RDESC_CMD_OWN);
+    close (fd);
 
-    RTG_INC_DESC(pDrvCtrl->rtgRxIdx, pDrvCtrl->rtgRxDescCnt);
+    RTG_LOGMSG("%s%d: %d frames saved\n", RTG_NAME, unit, saved,
+        0, 0, 0);
 
     return (rval);
     }
 
-LOCAL void rtgDelay
-    (
-    UINT32 usec
-    )
-    {
-    vxbUsDelay (usec);
-    return;
-    }
+/*****************************************************************************
+*
+* rtgLatShow - display the RX pipeline latency histograms of an rtg port
+*
+* This routine prints the latency histograms kept for rtg unit <unit>
+* when its latHist parameter is set: for each pipeline stage, the
+* non-empty buckets with their upper bounds in nanoseconds. It also
+* prints the histogram of frames per RX pass and the RX and TX ring
+* high-water marks.
+*
+* RETURNS: N/A
+*
+* ERRNO: N/A
+*/
 
-LOCAL void doRtgMuxConnect
+void rtgLatShow
     (
-    void
+    int unit
     )
     {
-    void * unused;
-    int i; 
+    LOCAL const char * stages[RTG_HIST_STAGES] =
+        {
+        "ISR to interrupt job",
+        "interrupt to RX pass",
+        "RX pass to MUX delivery"
+        };
+    RTG_DRV_CTRL * pDrvCtrl;
+    RTG_LAT_HIST * pHist;
+    int i, n;
+
+    pDrvCtrl = rtgInstFind (unit);
+    if (pDrvCtrl == NULL)
+        {
+        printf ("%s%d: no such unit\n", RTG_NAME, unit);
+        return;
+        }
+
+    if (pDrvCtrl->rtgHistOn == FALSE)
+        {
+        printf ("%s%d: latency histograms not enabled\n", RTG_NAME, unit);
+        return;
+        }
+
+    pHist = &pDrvCtrl->rtgHist;
+
+    for (i = 0; i < RTG_HIST_STAGES; i++)
+        {
+        printf ("%s%d: %s\n", RTG_NAME, unit, stages[i]);
+        for (n = 0; n < RTG_HIST_BUCKETS; n++)
+            {
+            if (pHist->rtgHistStage[i][n] == 0)
+                continue;
+            if (n == RTG_HIST_BUCKETS - 1)
+                printf ("    >= %10llu ns: %llu\n",
+                    rtgTsToNsecs (1ULL << (n - 1)),
+                    pHist->rtgHistStage[i][n]);
+            else
+                printf ("    <  %10llu ns: %llu\n",
+                    rtgTsToNsecs (1ULL << n), pHist->rtgHistStage[i][n]);
+            }
+        }
 
-    for ( i = 0; i < CurrentRtgNum; ++i )
+    printf ("%s%d: frames per RX pass\n", RTG_NAME, unit);
+    for (n = 0; n < RTG_HIST_BATCH_BUCKETS; n++)
         {
-        printf("unit = %d name = %s\n", pDevTemp[i]->unitNumber, pDevTemp[i]->pName);
-        rtgMuxConnect(pDevTemp[i], unused);
+        if (pHist->rtgHistBatch[n] == 0)
+            continue;
+        if (n == RTG_HIST_BATCH_BUCKETS - 1)
+            printf ("    >= %5u: %llu\n", 1U << (n - 1),
+                pHist->rtgHistBatch[n]);
+        else
+            printf ("    <  %5u: %llu\n", 1U << n, pHist->rtgHistBatch[n]);
         }
+
+    printf ("%s%d: RX ring high-water %u of %d, TX ring high-water %u of %d\n",
+        RTG_NAME, unit, pHist->rtgHistRxOccMax, pDrvCtrl->rtgRxDescCnt,
+        pHist->rtgHistTxOccMax, pDrvCtrl->rtgTxDescCnt);
+
+    return;
     }
 
-STATUS sysRtgEndInit
+/*****************************************************************************
+*
+* rtgTxClassifySet - install a high priority TX classifier on an rtg port
+*
+* This routine makes rtg unit <unit> call <func> for each outbound packet
+* to decide whether it goes on the high priority TX ring, in place of
+* the default VLAN priority and DSCP test. <func> is called with the TX
+* semaphore held, and must return TRUE for the packets to send ahead of
+* the others. This allows, for example, frames from particular sockets
+* to be picked by a mark the application puts in them. A <func> of NULL
+* restores the default test.
+*
+* RETURNS: OK, or ERROR if the unit doesn't exist or has no high
+* priority TX ring
+*
+* ERRNO: N/A
+*/
+
+STATUS rtgTxClassifySet
     (
-    void
+    int unit,
+    RTG_TX_CLASSIFY func
     )
     {
-    mvPhyRegister();
-    rtgPhyRegister();
+    RTG_DRV_CTRL * pDrvCtrl;
 
-    rtgRegister();
-    doRtgMuxConnect();
+    pDrvCtrl = rtgInstFind (unit);
+    if (pDrvCtrl == NULL || pDrvCtrl->rtgHpDescCnt == 0)
+        return (ERROR);
+
+    pDrvCtrl->rtgHpClassify = func;
+
+    return (OK);
     }
@@ -11,6 +11,32 @@
 /*
 modification history
 --------------------
+02h,17oct26,agt  Add the high priority TX ring
+02g,17oct26,agt  Add the pre-mapped TX bounce ring
+02f,17oct26,agt  Add software RSS queues
+02e,17oct26,agt  Add the RX pipeline latency histograms
+02d,17oct26,agt  Add the capture tap
+02c,17oct26,agt  Add the fast probe flag, probe time and EEPROM clock delay
+02b,17oct26,agt  Add the refcounted multicast hash table
+02a,17oct26,agt  Add cached descriptor ring support
+01z,17oct26,agt  Add busy-poll RX and RX latency counters
+01y,17oct26,agt  Add the zero-copy polled receive flag
+01x,17oct26,agt  Add MSI and interrupt CPU affinity state
+01w,17oct26,agt  Add the instance registry and bring-up task settings
+01v,17oct26,agt  Fix the tally counter layout, add 64-bit tally totals
+01u,17oct26,agt  Replace the software MIB counters with 64-bit
+                 counters kept per direction, with seq-protected reads
+01t,17oct26,agt  Add scatter RX state for multi-descriptor jumbo frames
+01s,17oct26,agt  Add IPv6 checksum offload bits for V2 descriptors
+01r,17oct26,agt  Add TCP segmentation offload definitions
+01q,17oct26,agt  Add interrupt-free TX reclaim
+01p,17oct26,agt  Add batched transmit and TX doorbell statistics
+01o,17oct26,agt  Add batched RX delivery
+01n,17oct26,agt  Add recycled RX buffer pool
+01m,17oct26,agt  Add RX copybreak support
+01l,17oct26,agt  Add ring size limits, mask-based RTG_INC_DESC()
+01k,17oct26,agt  Add RX budget and RX fairness group support
+01j,17oct26,agt  Add interrupt moderation support
 01i,16apr10,wap  Add support for RTL8168DP
 01h,17feb10,jc0  LP64 adaptation.
 01g,27feb09,wap  Add support for RTL8103EL
@@ -347,6 +373,14 @@ IMPORT void rtgRegister (void);
 
 #define RTG_EE_SIGNATURE	0x8129
 
+/*
+ * Half period of the bit-banged EEPROM clock, in microseconds. The
+ * 93C46/93C56 parts need at most 1us clock high and low times across
+ * their whole supply range.
+ */
+
+#define RTG_EE_DELAY		1
+
 /* Strapping config 0 */
 
 #define RTG_CFG0		0x0051
@@ -589,6 +623,17 @@ IMPORT void rtgRegister (void);
 
 #define RTG_MAXTXFRAMELEN	0x00EC
 
+/*
+ * The countdown timer (RTG_TIMER) is clocked from the bus clock:
+ * 33MHz on the PCI parts and 125MHz on the PCIe parts. Writing any
+ * value to RTG_TIMER resets the count to zero. When the count reaches
+ * the value in the timer interrupt register, RTG_ISR_TIMER_EXPIRED
+ * is set. Writing 0 to the timer interrupt register disables it.
+ */
+
+#define RTG_TIMER_CLK_PCI	33	/* ticks per microsecond */
+#define RTG_TIMER_CLK_PCIE	125	/* ticks per microsecond */
+
 /*
  * RTL8168DP only
  * The 8168DB has an internal management processor, and the
@@ -633,6 +678,7 @@ typedef struct rtg_desc
 #define RTG_TDESC_CMD_UDPCSUM	0x00020000      /* UDP checksum enable */
 #define RTG_TDESC_CMD_IPCSUM	0x00040000      /* IP header checksum enable */
 #define RTG_TDESC_CMD_MSSVAL	0x07FF0000      /* Large send MSS value */
+#define RTG_TDESC_CMD_MSSVAL_SHIFT	16
 #define RTG_TDESC_CMD_LGSEND	0x08000000      /* TCP large send enable */
 #define RTG_TDESC_CMD_EOF	0x10000000      /* end of frame marker */
 #define RTG_TDESC_CMD_SOF	0x20000000      /* start of frame marker */
@@ -644,6 +690,11 @@ typedef struct rtg_desc
 
 /* RTL8138C/CP only */
 
+#define RTG_TDESC_VLANCTL_MSSVAL	0x1FFC0000      /* Large send MSS value */
+#define RTG_TDESC_VLANCTL_MSSVAL_SHIFT	18
+#define RTG_TDESC_VLANCTL_TCPHO	0x0FFC0000      /* IPv6 L4 header offset */
+#define RTG_TDESC_VLANCTL_TCPHO_SHIFT	18
+#define RTG_TDESC_VLANCTL_IPV6CSUM	0x10000000
 #define RTG_TDESC_VLANCTL_IPCSUM	0x20000000
 #define RTG_TDESC_VLANCTL_TCPCSUM	0x40000000
 #define RTG_TDESC_VLANCTL_UDPCSUM	0x80000000
@@ -718,28 +769,35 @@ typedef struct rtg_desc
                                  RTG_PROTOID_UDPIP)
 
 /*
- * Statistics counter structure (8139C+ and 8169 only)
+ * Statistics counter structure (8139C+ and 8169 only). This is the
+ * layout of the tally counters the chip writes out when
+ * RTG_DUMPSTATSLO_DUMP is set. The block is 64 bytes long and must
+ * be 64-byte aligned.
  */
 typedef struct rtg_stats
     {
     volatile UINT32                rtg_tx_pkts_lo;
     volatile UINT32                rtg_tx_pkts_hi;
+    volatile UINT32                rtg_rx_pkts_lo;
+    volatile UINT32                rtg_rx_pkts_hi;
     volatile UINT32                rtg_tx_errs_lo;
     volatile UINT32                rtg_tx_errs_hi;
-    volatile UINT32                rtg_tx_errs;
+    volatile UINT32                rtg_rx_errs;
     volatile UINT16                rtg_missed_pkts;
     volatile UINT16                rtg_rx_framealign_errs;
     volatile UINT32                rtg_tx_onecoll;
     volatile UINT32                rtg_tx_multicolls;
-    volatile UINT32                rtg_rx_ucasts_hi;
     volatile UINT32                rtg_rx_ucasts_lo;
+    volatile UINT32                rtg_rx_ucasts_hi;
     volatile UINT32                rtg_rx_bcasts_lo;
     volatile UINT32                rtg_rx_bcasts_hi;
     volatile UINT32                rtg_rx_mcasts;
     volatile UINT16                rtg_tx_aborts;
-    volatile UINT16                rtg_rx_underruns;
+    volatile UINT16                rtg_tx_underruns;
     } RTG_STATS;
 
+#define RTG_STATS_DMA_ALIGN	64
+
 /*
  * The RealTek PCIe chips require RX buffers to be aligned on a
  * quadword boundary. This is a bit of a problem for us, because
@@ -768,7 +826,10 @@ typedef struct rtg_stats
 
 /*
  * The 8139C+ allows a maximum of 64 descriptors per DMA ring. The
- * 8169 and other gigabit controllers allow up to 1024.
+ * 8169 and other gigabit controllers allow up to 1024. The ring sizes
+ * below are the defaults; they can be overridden with the rxDescCnt
+ * and txDescCnt parameters, but must always be a power of two so
+ * that RTG_INC_DESC() can wrap the ring index with a mask.
  */
 
 #define RTG_RX_DESC_8139	64
@@ -777,13 +838,611 @@ typedef struct rtg_stats
 #define RTG_RX_DESC_8169	128
 #define RTG_TX_DESC_8169	128
 
-#define RTG_INC_DESC(x, y)	(x) = ((x) + 1) % (y)
+#define RTG_DESC_MAX_8139	64
+#define RTG_DESC_MAX_8169	1024
+#define RTG_DESC_MIN		(RTG_MAXFRAG * 2)
+
+#define RTG_INC_DESC(x, y)	(x) = ((x) + 1) & ((y) - 1)
+
+/*
+ * The netpool holds enough tuples to fill both rings twice over,
+ * but never fewer than the 512 the driver has always used.
+ */
+
+#define RTG_POOL_MIN		512
+#define RTG_POOL_SIZE(rx, tx)	\
+    ((((rx) + (tx)) * 2) > RTG_POOL_MIN ? (((rx) + (tx)) * 2) : RTG_POOL_MIN)
 
 #define RTG_ADDR_LO(y)           ((UINT32)((UINT64)(y) & 0xFFFFFFFF))
 #define RTG_ADDR_HI(y)           (((UINT32)((UINT64)(y) >> 32) & 0xFFFFFFFF))
 
 #define RTG_NAME	"rtg"
 
+/*
+ * Interrupt moderation policies. With RTG_INTRMOD_STATIC, RX and TX
+ * completion interrupts are replaced by a fixed timer holdoff whenever
+ * an interrupt finds at least intrModFrames frames of work. With
+ * RTG_INTRMOD_ADAPTIVE, the holdoff is scaled between RTG_INTRMOD_MINUSECS
+ * and intrModUsecs to keep the smoothed number of frames handled per
+ * interrupt close to intrModFrames.
+ */
+
+#define RTG_INTRMOD_OFF		0
+#define RTG_INTRMOD_STATIC	1
+#define RTG_INTRMOD_ADAPTIVE	2
+
+#define RTG_INTRMOD_USECS	100	/* default max holdoff */
+#define RTG_INTRMOD_FRAMES	8	/* default frames per interrupt */
+#define RTG_INTRMOD_MINUSECS	8
+
+#define RTG_INTRMOD_INTRS	(RTG_INTRS & ~(RTG_ISR_RX_OK|RTG_ISR_TX_OK))
+
+/*
+ * Driver private ioctls. These are kept well clear of the
+ * EIOC codes defined in end.h.
+ */
+
+#define EIOCGRTGINTRMOD		0x52540001	/* get RTG_INTRMOD_INFO */
+#define EIOCSRTGRXBUDGET	0x52540002	/* set RX frames per pass */
+#define EIOCGRTGRXSTATS		0x52540003	/* get RTG_RXPASS_STATS */
+#define EIOCGRTGTXSTATS		0x52540004	/* get RTG_TX_STATS */
+#define EIOCGRTGSTATS64		0x52540005	/* get RTG_STATS64 */
+#define EIOCGRTGTALLY		0x52540006	/* get RTG_TALLY64 */
+#define EIOCGRTGLATENCY		0x52540007	/* get RTG_LATENCY */
+#define EIOCSRTGTAP		0x52540008	/* set RTG_TAP_CONF */
+#define EIOCGRTGTAP		0x52540009	/* get RTG_TAP_INFO */
+#define EIOCGRTGTAPREAD		0x5254000A	/* drain via RTG_TAP_READ */
+#define EIOCGRTGLATHIST		0x5254000B	/* get RTG_LAT_HIST */
+
+typedef struct rtg_intrmod_info
+    {
+    int			rtgModMode;	/* RTG_INTRMOD_xxx */
+    UINT32		rtgModUsecs;	/* configured (max) holdoff */
+    UINT32		rtgModFrames;	/* configured frames threshold */
+    UINT32		rtgModCurUsecs;	/* holdoff currently in use */
+    UINT32		rtgModPpi;	/* smoothed frames/interrupt, x16 */
+    UINT32		rtgModIntrs;	/* interrupts serviced */
+    UINT32		rtgModTimerIntrs; /* timer expirations serviced */
+    } RTG_INTRMOD_INFO;
+
+/*
+ * Software RSS. When the rxQueue01 parameter and up name further job
+ * queues, each received IPv4 or IPv6 frame is hashed on its addresses
+ * and, for unfragmented TCP and UDP, its ports, and passed up on the
+ * job queue the hash selects, so a flow always stays on one queue.
+ * Queue 0 is the instance's own job queue, whose frames are passed up
+ * inline; frames for the others are handed over in a list at the end
+ * of each RX pass, and drained by a job on that queue.
+ */
+
+#define RTG_RSS_MAX		8
+
+typedef struct rtg_rxpass_stats
+    {
+    int			rtgRxBudget;	/* frames per pass */
+    int			rtgRxWeight;	/* round-robin weight */
+    BOOL		rtgRxFair;	/* member of an RX group */
+    UINT32		rtgRxPasses;	/* RX passes run */
+    UINT32		rtgRxPassFrames; /* descriptors consumed */
+    UINT32		rtgRxBudgetHits; /* passes that used the budget */
+    UINT32		rtgRxPassMax;	/* most descriptors in one pass */
+    UINT32		rtgRxCopybreak;	/* copybreak threshold, bytes */
+    UINT32		rtgRxCopies;	/* frames copied to small clusters */
+    UINT32		rtgRxRecycleCnt; /* recycled RX buffers */
+    UINT32		rtgRxRecycleHits; /* refills from recycled buffers */
+    UINT32		rtgRxRecycleMisses; /* refills from the netpool */
+    int			rtgRxBatch;	/* RTG_RXBATCH_xxx */
+    UINT32		rtgRxUpcalls;	/* calls into the MUX receive routine */
+    BOOL		rtgRxScatter;	/* jumbo frames span descriptors */
+    UINT32		rtgRxChains;	/* multi-descriptor frames received */
+    UINT32		rtgRxChainErrs;	/* multi-descriptor frames dropped */
+    UINT32		rtgRxMcastWrites; /* multicast filter register loads */
+    int			rtgRxRssQueues;	/* job queues frames are spread over */
+    UINT32		rtgRxRssFrames[RTG_RSS_MAX]; /* frames per queue */
+    } RTG_RXPASS_STATS;
+
+typedef struct rtg_tx_stats
+    {
+    UINT32		rtgTxPkts;	/* packets queued to the TX ring */
+    UINT32		rtgTxDoorbells;	/* TX poll register writes */
+    UINT32		rtgTxBatches;	/* rtgEndSendBatch() calls */
+    UINT32		rtgTxBatchMax;	/* most packets queued in one batch */
+    BOOL		rtgTxReclaim;	/* TX completion interrupts masked */
+    UINT32		rtgTxReclaimThresh; /* send path reclaim watermark */
+    UINT32		rtgTxReclaims;	/* reclaims done from the send path */
+    UINT32		rtgTxReclaimTimers; /* backstop timer expirations */
+    int			rtgTsoMode;	/* RTG_TSO_xxx */
+    UINT32		rtgTxTsoHw;	/* large sends handed to the chip */
+    UINT32		rtgTxTsoSw;	/* large sends segmented by the driver */
+    UINT32		rtgTxTsoSegs;	/* frames built by software TSO */
+    UINT32		rtgTxCoalesce;	/* frames that had to be coalesced */
+    UINT32		rtgTxBounced;	/* ... copied into a bounce buffer */
+    UINT32		rtgTxBncMisses;	/* ... copied into an mBlk tuple */
+    int			rtgTxBncCnt;	/* bounce buffers, 0 if disabled */
+    int			rtgTxHpCnt;	/* high priority descriptors, or 0 */
+    UINT32		rtgTxHpPkts;	/* frames sent on the high priority ring */
+    UINT32		rtgTxHpMisses;	/* times it was found full */
+    } RTG_TX_STATS;
+
+/*
+ * RX latency. The interrupt figures run from the interrupt to the
+ * start of the RX pass it triggered; the poll figures are the time
+ * between the busy-poll checks which found frames and the checks
+ * before them, which bounds how long a frame waited to be seen.
+ */
+
+typedef struct rtg_latency
+    {
+    BOOL		rtgLatBusyPoll;	/* busy-poll mode enabled */
+    UINT64		rtgLatIntrCnt;	/* interrupt-driven RX passes */
+    UINT64		rtgLatIntrUsecs; /* total interrupt latency */
+    UINT64		rtgLatIntrMax;	/* worst interrupt latency, usecs */
+    UINT64		rtgLatPollCnt;	/* busy-poll checks finding frames */
+    UINT64		rtgLatPollUsecs; /* total poll interval */
+    UINT64		rtgLatPollMax;	/* worst poll interval, usecs */
+    UINT64		rtgLatWakeups;	/* busy-poll task woken by interrupt */
+    } RTG_LATENCY;
+
+/*
+ * RX pipeline latency histograms, kept when the latHist parameter is
+ * set. Each stage has a log2 histogram of time stamp deltas: bucket 0
+ * counts deltas of 0, and bucket n (n > 0) deltas from 2^(n-1) up to
+ * 2^n - 1 time stamp units, the last bucket taking everything longer.
+ * rtgHistTsFreq gives the time stamp units per second. The stages are
+ * the ISR to the interrupt job, the interrupt to the start of the RX
+ * pass serving it (run by the RX job or the busy-poll task), and the
+ * start of the RX pass to each hand-off to the MUX. The RX pass sizes
+ * use the same log2 buckets, counting frames.
+ */
+
+#define RTG_HIST_BUCKETS	40
+#define RTG_HIST_BATCH_BUCKETS	12
+
+#define RTG_HIST_ISR_INT	0	/* ISR to interrupt job */
+#define RTG_HIST_INT_RX		1	/* interrupt to RX pass */
+#define RTG_HIST_RX_MUX		2	/* RX pass to MUX delivery */
+#define RTG_HIST_STAGES		3
+
+typedef struct rtg_lat_hist
+    {
+    BOOL		rtgHistEnabled;
+    UINT64		rtgHistTsFreq;	/* time stamp units per second */
+    UINT64		rtgHistStage[RTG_HIST_STAGES][RTG_HIST_BUCKETS];
+    UINT64		rtgHistBatch[RTG_HIST_BATCH_BUCKETS]; /* frames/pass */
+    UINT32		rtgHistRxOccMax; /* most RX descriptors full at once */
+    UINT32		rtgHistTxOccMax; /* most TX descriptors in use */
+    } RTG_LAT_HIST;
+
+IMPORT void rtgLatShow (int);
+
+/*
+ * Capture tap. Each direction has a single-producer ring of records,
+ * filled by the RX handler and by rtgEndTxAccount() (which always runs
+ * with the TX semaphore held), and drained by one reader at a time.
+ * A record holds the first snapLen bytes of a frame. A frame is only
+ * recorded if, for every filter term, the four bytes at rtgTapOff
+ * ANDed with rtgTapMask equal rtgTapVal; the terms may lie anywhere in
+ * the first RTG_TAP_SNAP_MAX bytes of the frame, whatever its layout
+ * in mBlks and whatever the snap length.
+ */
+
+#define RTG_TAP_SLOTS		1024	/* default records per direction */
+#define RTG_TAP_SNAP_MAX	128	/* most bytes kept per frame */
+#define RTG_TAP_TERMS		4
+
+#define RTG_TAP_RX		0
+#define RTG_TAP_TX		1
+#define RTG_TAP_DIR_RX		(1 << RTG_TAP_RX)
+#define RTG_TAP_DIR_TX		(1 << RTG_TAP_TX)
+
+typedef struct rtg_tap_term
+    {
+    UINT16		rtgTapOff;	/* byte offset in the frame */
+    UINT8		rtgTapMask[4];
+    UINT8		rtgTapVal[4];
+    } RTG_TAP_TERM;
+
+typedef struct rtg_tap_conf
+    {
+    BOOL		rtgTapEnable;
+    int			rtgTapDirs;	/* RTG_TAP_DIR_xxx */
+    int			rtgTapSnapLen;	/* at most RTG_TAP_SNAP_MAX */
+    int			rtgTapTerms;	/* filter terms used, 0 for all */
+    RTG_TAP_TERM	rtgTapTerm[RTG_TAP_TERMS];
+    } RTG_TAP_CONF;
+
+typedef struct rtg_tap_info
+    {
+    BOOL		rtgTapEnabled;
+    int			rtgTapSlots;	/* records per direction */
+    UINT64		rtgTapCaptured[2]; /* records written, RX and TX */
+    UINT64		rtgTapFiltered[2]; /* frames rejected by the filter */
+    UINT64		rtgTapDrops[2];	/* frames lost to a full ring */
+    } RTG_TAP_INFO;
+
+typedef struct rtg_tap_rec
+    {
+    UINT64		rtgTapTs;	/* RTG_TS_GET() time stamp */
+    UINT32		rtgTapLen;	/* frame length */
+    UINT16		rtgTapCapLen;	/* bytes in rtgTapData */
+    UINT8		rtgTapDir;	/* RTG_TAP_RX or RTG_TAP_TX */
+    UINT8		rtgTapPad;
+    UINT8		rtgTapData[RTG_TAP_SNAP_MAX];
+    } RTG_TAP_REC;
+
+typedef struct rtg_tap_read
+    {
+    RTG_TAP_REC *	rtgTapBuf;	/* where to put the records */
+    int			rtgTapMax;	/* room in rtgTapBuf */
+    int			rtgTapCnt;	/* records returned */
+    } RTG_TAP_READ;
+
+IMPORT STATUS rtgTapStart (int, int, int);
+IMPORT STATUS rtgTapStop (int);
+IMPORT STATUS rtgTapSave (int, char *, int);
+
+/*
+ * Software statistics. Each direction has its own set of 64-bit
+ * counters, on a cache line of its own, which belongs to the only
+ * context that updates it: the RX counters to whichever job or task is
+ * draining the RX ring, and the TX counters to the holder of the TX
+ * semaphore. The sets are not per CPU, since the
+ * tasks doing the updates can migrate at any time. No atomic operations
+ * are needed; the sequence number is odd while an update is in
+ * progress, so that readers on 32-bit targets never see a torn 64-bit
+ * value. Nothing is ever reset.
+ */
+
+#define RTG_STATS_ALIGN		64
+
+typedef struct rtg_counters
+    {
+    volatile UINT32	rtgCntSeq;
+    UINT64		rtgCntOctets;
+    UINT64		rtgCntUcasts;
+    UINT64		rtgCntMcasts;
+    UINT64		rtgCntBcasts;
+    UINT64		rtgCntErrors;
+    UINT64		rtgCntDiscards;	/* RX only */
+    } RTG_COUNTERS;
+
+typedef union rtg_counters_pad
+    {
+    RTG_COUNTERS	rtgCnt;
+    UINT8		rtgCntPad[RTG_STATS_ALIGN];
+    } RTG_COUNTERS_PAD;
+
+typedef struct rtg_sw_stats
+    {
+    RTG_COUNTERS_PAD	rtgSwRx;
+    RTG_COUNTERS_PAD	rtgSwTx;
+    } RTG_SW_STATS;
+
+typedef struct rtg_stats64
+    {
+    RTG_COUNTERS	rtgStatsRx;
+    RTG_COUNTERS	rtgStatsTx;
+    } RTG_STATS64;
+
+/*
+ * Hardware tally counters, extended to 64 bits. The chip's counters
+ * are 16, 32 or 64 bits wide; they are dumped once per stats poll and
+ * the difference from the previous dump is added to these totals.
+ * RX FIFO overflows aren't tallied by the chip, so they're counted
+ * from the interrupt status.
+ */
+
+typedef struct rtg_tally64
+    {
+    UINT64		rtgTlyTxPkts;
+    UINT64		rtgTlyRxPkts;
+    UINT64		rtgTlyTxErrs;
+    UINT64		rtgTlyRxErrs;
+    UINT64		rtgTlyMissed;
+    UINT64		rtgTlyAlignErrs;
+    UINT64		rtgTlyTxOneColl;
+    UINT64		rtgTlyTxMultiColl;
+    UINT64		rtgTlyRxUcasts;
+    UINT64		rtgTlyRxBcasts;
+    UINT64		rtgTlyRxMcasts;
+    UINT64		rtgTlyTxAborts;
+    UINT64		rtgTlyTxUnderruns;
+    UINT64		rtgTlyRxFifoOflows;
+    } RTG_TALLY64;
+
+#define RTG_RX_COUNTERS(p)	(&(p)->rtgStats->rtgSwRx.rtgCnt)
+#define RTG_TX_COUNTERS(p)	(&(p)->rtgStats->rtgSwTx.rtgCnt)
+
+#define RTG_STATS_BEGIN(c)	\
+    do { (c)->rtgCntSeq++; VX_MEM_BARRIER_W(); } while (0)
+#define RTG_STATS_END(c)	\
+    do { VX_MEM_BARRIER_W(); (c)->rtgCntSeq++; } while (0)
+
+/*
+ * RX fairness group. All rtg instances with the rxFairness parameter
+ * set which use the same job queue are serviced by one group job in
+ * weighted round-robin order.
+ */
+
+#define RTG_RX_GROUP_MAX	16
+
+/*
+ * RX copybreak. Frames no longer than the rxCopybreak parameter are
+ * copied into a cluster from a private pool of small clusters, and
+ * the original DMA-mapped cluster is handed straight back to the chip.
+ * The pool holds RTG_CB_RATIO clusters per RX descriptor.
+ */
+
+#define RTG_CB_CLSIZE		256
+#define RTG_CB_RATIO		2
+#define RTG_COPYBREAK_MAX	(RTG_CB_CLSIZE - 16)
+
+/*
+ * Recycled RX buffer. These buffers are DMA mapped once, when the
+ * pool is created, and stay mapped for the life of the instance.
+ * When the stack frees one, its cluster free routine puts it back
+ * on the instance's free list, from which the RX handler re-arms
+ * descriptors without going through vxbDmaBuf again.
+ */
+
+#define RTG_RB_HEADROOM		8
+
+/*
+ * RX delivery modes. With RTG_RXBATCH_OFF, each frame is passed to
+ * the MUX as soon as it has been reaped. With RTG_RXBATCH_LIST, the
+ * frames reaped in one RX pass are collected and then passed up one
+ * at a time once the ring has been serviced. With RTG_RXBATCH_CHAIN,
+ * they are linked through m_nextpkt and passed up with a single call;
+ * this must only be used with a stack which accepts packet chains.
+ */
+
+#define RTG_RXBATCH_OFF		0
+#define RTG_RXBATCH_LIST	1
+#define RTG_RXBATCH_CHAIN	2
+
+/*
+ * Interrupt-free TX reclaim. The TX completion interrupts are masked,
+ * and completed descriptors are reclaimed by the send path whenever
+ * the number of free descriptors drops below a watermark. A backstop
+ * timer, RTG_TXRECLAIM_MS milliseconds by default, makes sure buffers
+ * are released even when nothing more is sent.
+ */
+
+#define RTG_TXRECLAIM_INTRS	(RTG_ISR_TX_OK|RTG_ISR_TX_NODESC)
+#define RTG_TXRECLAIM_MS	10
+
+/*
+ * TX bounce ring. Frames that have to be coalesced, because their
+ * chain has too many fragments or they are runts that need manual
+ * padding, are copied into one of these buffers instead of a fresh
+ * mBlk tuple. Each buffer is cache aligned, holds a full frame and
+ * stays DMA mapped for the life of the instance. The buffers are
+ * handed out and released in ring order, since TX descriptors
+ * complete in order.
+ */
+
+#define RTG_TX_BOUNCE		32	/* default number of bounce buffers */
+
+/*
+ * Short frames that have to be padded by the driver rather than by the
+ * chip, because of the checksum offload bugs described in
+ * rtgEndTxQueue().
+ */
+
+#define RTG_TX_NEEDS_PAD(m)						\
+    (((m)->m_pkthdr.csum_flags & (CSUM_VLAN|CSUM_IP)) &&		\
+    !((m)->m_pkthdr.csum_flags &					\
+    (CSUM_UDP|CSUM_TCP|CSUM_UDPv6|CSUM_TCPv6)) &&			\
+    (m)->m_pkthdr.len < ETHERSMALL)
+
+/*
+ * High priority TX ring. The chip serves this ring, at RTG_TXRINGBASE1,
+ * ahead of the normal one. Frames picked by the classifier are copied
+ * into a buffer of their own, which stays DMA mapped for the life of
+ * the instance, so a descriptor can be reused as soon as the chip is
+ * done with it; the send path reclaims them itself. By default, frames
+ * with a VLAN priority of at least RTG_TX_HP_PCP or a DSCP of at least
+ * RTG_TX_HP_DSCP (CS6 and CS7, network control) are picked. A
+ * classifier installed with rtgTxClassifySet() replaces this test.
+ */
+
+#define RTG_TX_HP_MAX		64	/* most high priority descriptors */
+#define RTG_TX_HP_PCP		6
+#define RTG_TX_HP_DSCP		48
+
+typedef BOOL (*RTG_TX_CLASSIFY) (M_BLK_ID);
+
+IMPORT STATUS rtgTxClassifySet (int, RTG_TX_CLASSIFY);
+
+/*
+ * TCP segmentation offload. With RTG_TSO_HW, large IPv4 TCP sends are
+ * handed to the chip using the large send bits in the TX descriptors.
+ * With RTG_TSO_SW, the driver still advertises TSO to the stack but
+ * cuts the packet into MSS sized frames itself; this is used on chips
+ * whose large send support can't be trusted, and when jumbo frames are
+ * enabled, since the chip can't do large send with jumbo frames. The
+ * stack passes the MSS in the tso_segsz field of the packet header;
+ * csum_data holds the header lengths, as for checksum offload.
+ */
+
+#define RTG_TSO_OFF		0
+#define RTG_TSO_HW		1
+#define RTG_TSO_SW		2
+
+#define RTG_TSO_MSS(m)		((m)->m_pkthdr.tso_segsz)
+#define RTG_TSO_MAXLEN		(65535 + ETHER_HDR_LEN + 4)
+#define RTG_TSO_MAXFRAG		32
+#define RTG_TSO_HDRMAX		(ETHER_HDR_LEN + 4 + 60 + 60)
+
+/*
+ * The multicast filter is a 64-bit hash indexed by the top six bits of
+ * the big-endian CRC32 of the group address. Each bucket carries a
+ * reference count so that a join or leave only touches the MAR
+ * registers when a bucket becomes used or unused.
+ */
+
+#define RTG_MCAST_BUCKETS	64
+#define RTG_MCAST_BUCKET(a)	\
+    (endEtherCrc32BeGet ((const UINT8 *)(a), ETHER_ADDR_LEN) >> 26)
+
+/*
+ * Cached descriptor rings. Descriptors are 16 bytes, so a 64-byte
+ * cache line holds RTG_DESC_PER_LINE of them. Where DMA is cache
+ * coherent, as on x86, cached rings need no maintenance at all.
+ * Elsewhere only the RX ring is cached, and RX descriptors are handed
+ * back to the chip a whole cache line at a time, so that a flush never
+ * overwrites a descriptor the chip has written. Only the line being
+ * handed back is flushed, and only the line about to be read is
+ * invalidated. The TX ring stays uncached there, since the chip writes
+ * back status into lines the CPU is still filling.
+ */
+
+#define RTG_DESC_PER_LINE	4
+#define RTG_DESC_LINE_SIZE	(RTG_DESC_PER_LINE * sizeof(RTG_DESC))
+#define RTG_RX_LINE(p, i)	\
+    ((void *)&(p)->rtgRxDescMem[(i) & ~(RTG_DESC_PER_LINE - 1)])
+
+#if (CPU_FAMILY == I80X86)
+#define RTG_DESC_COHERENT	TRUE
+#else
+#define RTG_DESC_COHERENT	FALSE
+#endif
+
+/*
+ * Busy-poll RX. A task spins on the RX ring with the RX interrupts
+ * masked, and falls back to interrupts once no frame has arrived for
+ * busyPollIdle microseconds (RTG_BUSY_IDLE by default).
+ */
+
+#define RTG_BUSY_PRI		10
+#define RTG_BUSY_STACK		8192
+#define RTG_BUSY_IDLE		1000
+
+/*
+ * Timestamps for the latency counters. On x86 the TSC is used;
+ * elsewhere the system clock tick is the best we have.
+ */
+
+#if (CPU_FAMILY == I80X86)
+#define RTG_TS_GET(x)		pentiumTscGet64 ((INT64 *)&(x))
+#define RTG_TS_FREQ()		sysGetTSCCountPerSec ()
+#else
+#define RTG_TS_GET(x)		((x) = (UINT64)tickGet ())
+#define RTG_TS_FREQ()		((UINT64)sysClkRateGet ())
+#endif
+
+#define RTG_ETHERTYPE_IP	0x0800
+#define RTG_ETHERTYPE_VLAN	0x8100
+#define RTG_IPPROTO_TCP		6
+#define RTG_ETHERTYPE_IPV6	0x86DD
+#define RTG_IPPROTO_UDP		17
+
+/* Big-endian 32-bit word at a possibly unaligned address */
+
+#define RTG_RSS_WORD(p)							\
+    (((UINT32)(p)[0] << 24) | ((UINT32)(p)[1] << 16) |			\
+    ((UINT32)(p)[2] << 8) | (UINT32)(p)[3])
+
+/*
+ * Instance registry and bring-up. Attached instances are kept in a
+ * table which starts with RTG_INST_MIN slots and doubles as needed.
+ * sysRtgEndInit() brings each port up in its own task, and waits up
+ * to RTG_UP_TIMEOUT seconds for all of them to finish.
+ */
+
+#define RTG_INST_MIN		4
+#define RTG_UP_PRI		50
+#define RTG_UP_STACK		8192
+#define RTG_UP_TIMEOUT		10
+
+typedef struct rtg_rx_buf
+    {
+    struct rtg_rx_buf *	rtgRbNext;
+    char *		rtgRbBuf;
+    VXB_DMA_MAP_ID	rtgRbMap;
+    } RTG_RX_BUF;
+
+/* Map backing RX descriptor slot <i>, recycled or not */
+
+#define RTG_RX_MAP(p, i)						\
+    ((p)->rtgRxBuf[(i)] != NULL ?					\
+    (p)->rtgRxBuf[(i)]->rtgRbMap : (p)->rtgRxMblkMap[(i)])
+
+typedef struct rtg_rx_group
+    {
+    struct rtg_rx_group *	rtgGrpNext;
+    JOB_QUEUE_ID		rtgGrpQueue;
+    QJOB			rtgGrpJob;
+    atomic32Val_t		rtgGrpPending;
+    int				rtgGrpStart;
+    struct rtg_drv_ctrl *	rtgGrpMembers[RTG_RX_GROUP_MAX];
+    } RTG_RX_GROUP;
+
+typedef struct rtg_rss_queue
+    {
+    QJOB			rtgRssJob;
+    JOB_QUEUE_ID		rtgRssQueue;
+    atomic32Val_t		rtgRssPending;
+    spinlockIsr_t		rtgRssLock;
+    M_BLK_ID			rtgRssHead;
+    M_BLK_ID			rtgRssTail;
+    UINT32			rtgRssFrames;
+    struct rtg_drv_ctrl *	rtgRssDrvCtrl;
+    } RTG_RSS_QUEUE;
+
+/*
+ * Capture tap rings. The indices run freely; the producer only writes
+ * rtgTapProd and its counters, the reader only rtgTapCons. Producers
+ * are serialized by the RX pass exclusion (RX side) and the TX
+ * semaphore (TX side); see rtgTapRecord().
+ */
+
+typedef struct rtg_tap_ring
+    {
+    volatile UINT32	rtgTapProd;
+    volatile UINT32	rtgTapCons;
+    UINT64		rtgTapCaptured;
+    UINT64		rtgTapFiltered;
+    UINT64		rtgTapDrops;
+    RTG_TAP_REC *	rtgTapRecs;
+    } RTG_TAP_RING;
+
+typedef struct rtg_tap
+    {
+    RTG_TAP_CONF	rtgTapConf;
+    UINT32		rtgTapMask;	/* slots - 1 */
+    UINT64		rtgTapTsBase;	/* RTG_TS_GET() at rtgTapSecBase */
+    UINT32		rtgTapSecBase;	/* time () when first enabled */
+    SEM_ID		rtgTapSem;	/* serializes readers */
+    RTG_TAP_RING	rtgTapRing[2];
+    } RTG_TAP;
+
+/* rtgTapSave() writes a libpcap file, in host byte order */
+
+#define RTG_PCAP_MAGIC		0xA1B2C3D4
+#define RTG_PCAP_MAJOR		2
+#define RTG_PCAP_MINOR		4
+#define RTG_PCAP_ETHERNET	1
+
+typedef struct rtg_pcap_hdr
+    {
+    UINT32		rtgPcapMagic;
+    UINT16		rtgPcapMajor;
+    UINT16		rtgPcapMinor;
+    INT32		rtgPcapZone;
+    UINT32		rtgPcapSigFigs;
+    UINT32		rtgPcapSnapLen;
+    UINT32		rtgPcapLinkType;
+    } RTG_PCAP_HDR;
+
+typedef struct rtg_pcap_rec
+    {
+    UINT32		rtgPcapSec;
+    UINT32		rtgPcapUsec;
+    UINT32		rtgPcapCapLen;
+    UINT32		rtgPcapLen;
+    } RTG_PCAP_REC;
+
 #define RTG_DEVTYPE_8139CPLUS	1
 #define RTG_DEVTYPE_8101E	2
 #define RTG_DEVTYPE_8169	3
@@ -820,8 +1479,10 @@ typedef struct rtg_drv_ctrl
     UINT8		rtgTxCur;
     UINT8		rtgTxLast;
     volatile BOOL	rtgTxStall;
+    BOOL		rtgTxRestart;	/* muxTxRestart() owed by rtgEndTxHandle() */
 
     BOOL		rtgPolling;
+    BOOL		rtgPollZcopy;	/* swap clusters in polled RX */
     M_BLK_ID		rtgPollBuf;
     UINT16		rtgIntMask;
     UINT16		rtgIntrs;
@@ -832,17 +1493,55 @@ typedef struct rtg_drv_ctrl
 
     END_IFDRVCONF	rtgEndStatsConf;
     END_IFCOUNTERS	rtgEndStatsCounters;
-    UINT32		rtgInErrors;
-    UINT32		rtgInDiscards;
-    UINT32		rtgInUcasts;
-    UINT32		rtgInMcasts;
-    UINT32		rtgInBcasts;
-    UINT32		rtgInOctets;
-    UINT32		rtgOutErrors;
-    UINT32		rtgOutUcasts;
-    UINT32		rtgOutMcasts;
-    UINT32		rtgOutBcasts;
-    UINT32		rtgOutOctets;
+    RTG_SW_STATS	*rtgStats;
+    RTG_COUNTERS	*rtgTxCnt;	/* TX counters of the current sender */
+    RTG_STATS64		rtgStatsLast;	/* totals at the last stats poll */
+
+    /* Hardware tally counters */
+    BOOL		rtgHwStats;
+    VXB_DMA_TAG_ID	rtgTallyTag;
+    VXB_DMA_MAP_ID	rtgTallyMap;
+    RTG_STATS		*rtgTallyMem;
+    BOOL		rtgTallyBusy;
+    BOOL		rtgTallyPrimed;
+    RTG_STATS		rtgTallyRaw;	/* chip values at the last dump */
+    RTG_TALLY64		rtgTally;	/* running totals */
+    RTG_TALLY64		rtgTallyLast;	/* totals at the last stats poll */
+    UINT32		rtgRxFifoOflows;
+
+    /* Interrupt delivery */
+    BOOL		rtgMsi;		/* vector is an MSI, not shared */
+    int			rtgIntCpu;	/* CPU for vector and job queue */
+    BOOL		rtgJobQueuePinned;
+
+    /* Busy-poll RX */
+    BOOL		rtgBusyPoll;
+    int			rtgBusyCpu;
+    int			rtgBusyPri;
+    UINT32		rtgBusyIdle;	/* usecs before falling back */
+    UINT64		rtgBusyIdleTs;	/* the same, in timestamp units */
+    TASK_ID		rtgBusyTask;
+    SEM_ID		rtgBusySem;	/* wakes the busy-poll task */
+    SEM_ID		rtgBusyDone;	/* given when the task exits or parks */
+    volatile BOOL	rtgBusyExit;
+    volatile BOOL	rtgBusyPark;	/* polled mode wants the ring */
+    atomic32Val_t	rtgBusyActive;	/* polling, RX interrupts masked */
+    UINT64		rtgBusyWakeups;
+
+    /* RX latency counters, in timestamp units */
+    UINT64		rtgIntTs;	/* time of the last interrupt */
+    UINT64		rtgRxEvtTs;	/* RX event awaiting service, or 0 */
+    UINT64		rtgLatIntrCnt;
+    UINT64		rtgLatIntrSum;
+    UINT64		rtgLatIntrMax;
+    UINT64		rtgLatPollCnt;
+    UINT64		rtgLatPollSum;
+    UINT64		rtgLatPollMax;
+
+    /* RX pipeline latency histograms */
+    BOOL		rtgHistOn;
+    UINT64		rtgRxPassTs;	/* start of the current RX pass */
+    RTG_LAT_HIST	rtgHist;
 
     /* Begin MII/ifmedia required fields. */
     END_MEDIALIST	*rtgMediaList;
@@ -864,6 +1563,125 @@ typedef struct rtg_drv_ctrl
 
     UINT32		rtgRxLenMask;
     UINT8		rtgTxStartReg;
+    UINT8		rtgTimerIntReg;
+    UINT32		rtgTimerClk;
+
+    /* Interrupt moderation state */
+    int			rtgIntrModMode;
+    UINT32		rtgIntrModUsecs;
+    UINT32		rtgIntrModFrames;
+    UINT32		rtgIntrModCur;
+    UINT32		rtgIntrModPpi;
+    atomic32Val_t	rtgIntrModPkts;
+    UINT32		rtgIntrModIntrs;
+    UINT32		rtgIntrModTimerIntrs;
+
+    /* RX budget and fairness */
+    int			rtgRxBudget;
+    int			rtgRxWeight;
+    BOOL		rtgRxFair;
+    RTG_RX_GROUP *	rtgRxGroup;
+    UINT32		rtgRxPasses;
+    UINT32		rtgRxPassFrames;
+    UINT32		rtgRxBudgetHits;
+    UINT32		rtgRxPassMax;
+
+    /* RX copybreak */
+    UINT32		rtgRxCopybreak;
+    UINT32		rtgRxCopies;
+    NET_POOL_ID		rtgCbPool;
+    char *		rtgCbMblkMem;
+    char *		rtgCbClMem;
+
+    /* Recycled RX buffers */
+    RTG_RX_BUF *	rtgRbPool;
+    RTG_RX_BUF *	rtgRbFree;
+    RTG_RX_BUF **	rtgRxBuf;
+    char *		rtgRbMem;
+    int			rtgRbCnt;
+    int			rtgRbSize;
+    spinlockIsr_t	rtgRbLock;
+    int			rtgRbOut;	/* buffers not on the free list */
+    BOOL		rtgRbDying;	/* instance unlinked */
+    QJOB		rtgRbJob;	/* frees the instance when rtgRbOut hits 0 */
+    UINT32		rtgRbHits;
+    UINT32		rtgRbMisses;
+
+    /* RX delivery */
+    int			rtgRxBatch;
+    UINT32		rtgRxUpcalls;
+
+    /* Software RSS */
+    int			rtgRssCnt;	/* job queues in use, 1 for no RSS */
+    RTG_RSS_QUEUE	rtgRss[RTG_RSS_MAX];
+
+    /* Multicast hash filter */
+    UINT16		rtgMcastRef[RTG_MCAST_BUCKETS];
+    UINT32		rtgMcastHash[2];
+    UINT32		rtgMcastWrites;
+
+    /* Cached descriptor rings */
+    BOOL		rtgDescCached;
+    BOOL		rtgRxLineArm;	/* re-arm RX a cache line at a time */
+
+    /* Scatter RX */
+    BOOL		rtgRxScatter;
+    M_BLK_ID		rtgRxHead;
+    M_BLK_ID		rtgRxTail;
+    UINT32		rtgRxChains;
+    UINT32		rtgRxChainErrs;
+
+    /* TX batching */
+    UINT32		rtgTxPkts;
+    UINT32		rtgTxDoorbells;
+    UINT32		rtgTxBatches;
+    UINT32		rtgTxBatchMax;
+
+    /* TX reclaim */
+    UINT16		rtgIntrMask;
+    BOOL		rtgTxReclaim;
+    int			rtgTxReclaimThresh;
+    int			rtgTxReclaimMs;
+    int			rtgTxReclaimTicks;
+    volatile BOOL	rtgTxReclaimRun;
+    WDOG_ID		rtgTxReclaimWd;
+    UINT32		rtgTxReclaims;
+    UINT32		rtgTxReclaimTimers;
+
+    /* TCP segmentation offload */
+    int			rtgTsoMode;
+    UINT32		rtgTxTsoHw;
+    UINT32		rtgTxTsoSw;
+    UINT32		rtgTxTsoSegs;
+
+    /* TX bounce ring */
+    char *		rtgBncMem;
+    VXB_DMA_MAP_ID *	rtgBncMap;
+    BOOL *		rtgTxBnc;	/* per descriptor: holds a bounce buffer */
+    int			rtgBncCnt;
+    int			rtgBncSize;
+    int			rtgBncProd;
+    int			rtgBncFree;
+    UINT32		rtgTxCoalesce;
+    UINT32		rtgTxBounced;
+    UINT32		rtgTxBncMisses;
+
+    /* High priority TX ring */
+    VXB_DMA_TAG_ID	rtgHpDescTag;
+    VXB_DMA_MAP_ID	rtgHpDescMap;
+    RTG_DESC		*rtgHpDescMem;
+    char *		rtgHpMem;
+    VXB_DMA_MAP_ID *	rtgHpMap;
+    int			rtgHpDescCnt;	/* 0 if disabled */
+    int			rtgHpSize;
+    UINT32		rtgHpProd;
+    UINT32		rtgHpCons;
+    UINT32		rtgHpFree;
+    int			rtgHpPcp;	/* -1 to ignore the VLAN priority */
+    int			rtgHpDscp;	/* -1 to ignore the DSCP */
+    RTG_TX_CLASSIFY	rtgHpClassify;
+    UINT32		rtgTxHpPkts;
+    UINT32		rtgTxHpMisses;
 
     VXB_DMA_TAG_ID	rtgRxDescTag;
     VXB_DMA_MAP_ID	rtgRxDescMap;
@@ -891,8 +1709,19 @@ typedef struct rtg_drv_ctrl
     SEM_ID		rtgDevSem;
 
     int			rtgMaxMtu;
+
+    UINT32		rtgUpMsecs;	/* time taken to bring the port up */
+    BOOL		rtgFastProbe;	/* take the station address from IDRx */
+    UINT32		rtgProbeUsecs;	/* time taken to get the address */
+
+    /* Capture tap, NULL while disabled */
+    RTG_TAP *		rtgTap;
+    RTG_TAP *		rtgTapMem;
+    int			rtgTapSlots;
     } RTG_DRV_CTRL;
 
+IMPORT int rtgEndSendBatch (END_OBJ *, M_BLK_ID *);
+
 #define RTG_BAR(p)   ((RTG_DRV_CTRL *)(p)->pDrvCtrl)->rtgBar
 #define RTG_HANDLE(p)   ((RTG_DRV_CTRL *)(p)->pDrvCtrl)->rtgHandle
 